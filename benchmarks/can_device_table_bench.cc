@@ -0,0 +1,109 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  benchmarks/can_device_table_bench.cc
+ * @brief 比较CanDeviceTable和原来的std::unordered_map按ID查找设备的耗时
+ * @note  模拟一条挂着十几个设备的总线，查找的ID里有一部分没有注册(比如别的节点发的报文)，和实际接收路径上的情况一致
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "librm/hal/can_device_table.hpp"
+
+namespace {
+
+struct FakeDevice {
+  rm::u32 id;
+};
+
+constexpr rm::usize kLookups = 20'000'000;
+constexpr int kRounds = 5;
+
+/**
+ * @brief 跑kRounds轮，取最快的一轮，返回每次查找的平均耗时(ns)
+ */
+template <typename Find>
+double Measure(const std::vector<rm::u16> &ids, Find &&find) {
+  double best_ns = 1e30;
+  for (int round = 0; round < kRounds; ++round) {
+    rm::usize hits = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (rm::usize i = 0; i < kLookups; ++i) {
+      const FakeDevice *device = find(ids[i & (ids.size() - 1)]);
+      hits += device != nullptr ? device->id & 1 : 0;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    // 防止编译器把整个循环优化掉
+    volatile rm::usize sink = hits;
+    (void)sink;
+    const double ns = std::chrono::duration<double, std::nano>(end - start).count() / kLookups;
+    best_ns = ns < best_ns ? ns : best_ns;
+  }
+  return best_ns;
+}
+
+}  // namespace
+
+int main() {
+  // 8个DJI电机(0x201~0x208)、4个达妙电机(0x11~0x14)、两个超级电容/裁判系统之类的自定义ID
+  const std::vector<rm::u16> registered = {0x201, 0x202, 0x203, 0x204, 0x205, 0x206, 0x207,
+                                           0x208, 0x11,  0x12,  0x13,  0x14,  0x211, 0x300};
+  std::vector<FakeDevice> devices;
+  devices.reserve(registered.size());
+  for (const rm::u16 id : registered) {
+    devices.push_back({id});
+  }
+
+  std::unordered_map<rm::u32, FakeDevice *> map;
+  rm::hal::CanDeviceTable<FakeDevice> table;
+  for (auto &device : devices) {
+    map[device.id] = &device;
+    table.Insert(device.id, &device);
+  }
+
+  // 查找序列：大约80%是注册过的ID，其余是随机的未知ID；长度取2的幂，循环使用
+  std::vector<rm::u16> ids(1 << 16);
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<rm::usize> pick(0, registered.size() - 1);
+  std::uniform_int_distribution<int> percent(0, 99);
+  std::uniform_int_distribution<rm::u16> any_id(0, 0x7ff);
+  for (auto &id : ids) {
+    id = percent(rng) < 80 ? registered[pick(rng)] : any_id(rng);
+  }
+
+  const double map_ns = Measure(ids, [&map](rm::u16 id) -> const FakeDevice * {
+    const auto it = map.find(id);
+    return it == map.end() ? nullptr : it->second;
+  });
+  const double table_ns = Measure(ids, [&table](rm::u16 id) -> const FakeDevice * { return table.Find(id); });
+
+  std::printf("%zu devices, %zu lookups x %d rounds (best round)\n", registered.size(), kLookups, kRounds);
+  std::printf("std::unordered_map : %6.2f ns/lookup\n", map_ns);
+  std::printf("CanDeviceTable     : %6.2f ns/lookup\n", table_ns);
+  std::printf("speedup            : %6.2fx\n", map_ns / table_ns);
+  return 0;
+}
@@ -0,0 +1,219 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  benchmarks/serial_rx_bench.cc
+ * @brief 比较串口接收的两种做法：每个fd一个阻塞read的线程，和共享的IoUringEngine
+ * @note  用pty模拟串口，不需要真实硬件。发送端按固定频率写入带发送时间戳的小包，接收端统计从写入到回调的延迟；
+ *        发完之后再空闲一段时间，统计空闲期间整个进程消耗的CPU时间，接收线程如果在空转会在这里暴露出来
+ * @note  接收用的fd和Serial::OpenRxFd()一样以非阻塞方式打开；阻塞线程那一组会把它改回阻塞
+ * @note  io_uring那一组只在CMake找到liburing、定义了LIBRM_USE_IO_URING时编译
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "librm/core/typedefs.h"
+#if defined(LIBRM_USE_IO_URING)
+#include "librm/hal/linux/io_uring_engine.h"
+#endif
+
+namespace {
+
+constexpr int kPackets = 2000;
+constexpr auto kInterval = std::chrono::microseconds(1000);  // 1kHz，和裁判系统、IMU这类串口设备的数据频率相当
+constexpr auto kIdle = std::chrono::seconds(1);
+constexpr rm::usize kPacketSize = 16;  // 前8字节是发送时的steady_clock时间戳(ns)
+
+rm::i64 NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+double ProcessCpuMs() {
+  struct ::timespec ts {};
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief 从字节流里切出完整的包并记录延迟，pty可能把几个包合并成一次读取，也可能把一个包拆开
+ */
+class LatencyRecorder {
+ public:
+  void Feed(const rm::u8 *data, rm::usize size) {
+    const rm::i64 now = NowNs();
+    for (rm::usize i = 0; i < size; ++i) {
+      this->pending_[this->pending_size_++] = data[i];
+      if (this->pending_size_ == kPacketSize) {
+        rm::i64 sent;
+        std::memcpy(&sent, this->pending_, sizeof(sent));
+        this->latencies_us_.push_back((now - sent) / 1e3);
+        this->pending_size_ = 0;
+      }
+    }
+    this->received_.store(this->latencies_us_.size(), std::memory_order_release);
+  }
+
+  [[nodiscard]] rm::usize received() const { return this->received_.load(std::memory_order_acquire); }
+
+  void Print(const char *name, double busy_cpu_ms, double idle_cpu_ms) {
+    std::sort(this->latencies_us_.begin(), this->latencies_us_.end());
+    double sum = 0;
+    for (const double latency : this->latencies_us_) {
+      sum += latency;
+    }
+    const rm::usize count = this->latencies_us_.size();
+    std::printf("%-16s: %4zu/%d packets, latency avg %7.1f us, p50 %7.1f us, p99 %7.1f us, "
+                "cpu %6.1f ms while receiving, %6.1f ms while idle\n",
+                name, count, kPackets, count > 0 ? sum / count : 0.0, count > 0 ? this->latencies_us_[count / 2] : 0.0,
+                count > 0 ? this->latencies_us_[count * 99 / 100] : 0.0, busy_cpu_ms, idle_cpu_ms);
+  }
+
+ private:
+  rm::u8 pending_[kPacketSize]{};
+  rm::usize pending_size_{0};
+  std::vector<double> latencies_us_{};
+  std::atomic<rm::usize> received_{0};
+};
+
+/**
+ * @brief 打开一对pty，从设备端用原始模式，返回主端fd，rx_fd是以非阻塞方式再打开一次的从设备
+ */
+int OpenPty(int &rx_fd) {
+  int master;
+  int slave;
+  char name[64];
+  if (openpty(&master, &slave, name, nullptr, nullptr) != 0) {
+    std::perror("openpty");
+    return -1;
+  }
+  struct ::termios options {};
+  tcgetattr(slave, &options);
+  cfmakeraw(&options);
+  tcsetattr(slave, TCSANOW, &options);
+  rx_fd = open(name, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  close(slave);
+  return master;
+}
+
+/**
+ * @brief 按固定频率发送kPackets个包，然后空闲kIdle，返回接收期间和空闲期间进程消耗的CPU时间
+ */
+void Drive(int master, const LatencyRecorder &recorder, double &busy_cpu_ms, double &idle_cpu_ms) {
+  const double start_cpu = ProcessCpuMs();
+  auto next = std::chrono::steady_clock::now();
+  for (int i = 0; i < kPackets; ++i) {
+    next += kInterval;
+    std::this_thread::sleep_until(next);
+    rm::u8 packet[kPacketSize]{};
+    const rm::i64 now = NowNs();
+    std::memcpy(packet, &now, sizeof(now));
+    if (write(master, packet, sizeof(packet)) != static_cast<ssize_t>(sizeof(packet))) {
+      std::perror("write");
+    }
+  }
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+  while (recorder.received() < kPackets && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  const double idle_start_cpu = ProcessCpuMs();
+  busy_cpu_ms = idle_start_cpu - start_cpu;
+  std::this_thread::sleep_for(kIdle);
+  idle_cpu_ms = ProcessCpuMs() - idle_start_cpu;
+}
+
+void RunBlockingThread() {
+  int rx_fd;
+  const int master = OpenPty(rx_fd);
+  if (master < 0) {
+    return;
+  }
+  fcntl(rx_fd, F_SETFL, fcntl(rx_fd, F_GETFL) & ~O_NONBLOCK);
+  LatencyRecorder recorder;
+  std::atomic<bool> running{true};
+  std::thread reader([&] {
+    rm::u8 buffer[256];
+    while (running.load(std::memory_order_relaxed)) {
+      const ssize_t size = read(rx_fd, buffer, sizeof(buffer));
+      if (size > 0) {
+        recorder.Feed(buffer, size);
+      }
+    }
+  });
+  double busy_cpu_ms;
+  double idle_cpu_ms;
+  Drive(master, recorder, busy_cpu_ms, idle_cpu_ms);
+  running = false;
+  const rm::u8 wakeup[1]{};
+  write(master, wakeup, sizeof(wakeup));  // 让阻塞的read返回
+  reader.join();
+  recorder.Print("blocking thread", busy_cpu_ms, idle_cpu_ms);
+  close(rx_fd);
+  close(master);
+}
+
+#if defined(LIBRM_USE_IO_URING)
+void RunIoUring() {
+  int rx_fd;
+  const int master = OpenPty(rx_fd);
+  if (master < 0) {
+    return;
+  }
+  LatencyRecorder recorder;
+  rm::hal::linux_::IoUringEngine engine;
+  engine.Begin();
+  engine.AddRecv(rx_fd, 256, 16, [&recorder](const rm::u8 *data, rm::usize size) { recorder.Feed(data, size); });
+  double busy_cpu_ms;
+  double idle_cpu_ms;
+  Drive(master, recorder, busy_cpu_ms, idle_cpu_ms);
+  engine.Remove(rx_fd);
+  engine.Stop();
+  recorder.Print("io_uring engine", busy_cpu_ms, idle_cpu_ms);
+  close(rx_fd);
+  close(master);
+}
+#endif
+
+}  // namespace
+
+int main() {
+  std::printf("%d packets of %zu bytes at %lld Hz over a pty, then %lld s idle\n", kPackets, kPacketSize,
+              static_cast<long long>(std::chrono::seconds(1) / kInterval), static_cast<long long>(kIdle.count()));
+  RunBlockingThread();
+#if defined(LIBRM_USE_IO_URING)
+  RunIoUring();
+#else
+  std::printf("io_uring engine : skipped, built without liburing (LIBRM_USE_IO_URING)\n");
+#endif
+  return 0;
+}
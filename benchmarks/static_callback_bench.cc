@@ -0,0 +1,113 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  benchmarks/static_callback_bench.cc
+ * @brief 比较StaticCallback和原来的unordered_map<句柄, std::function>分发HAL回调的开销
+ * @note  用模拟HAL在电脑上跑，耗时用DWT->CYCCNT读出来，模拟的DWT按SystemCoreClock把主机时间换算成周期数，
+ *        所以结果是"主机上的耗时折算成168MHz下的周期数"，只能用来比较两种做法，不等于单片机上的实际周期数。
+ *        把这个文件和驱动一起编进单片机工程(去掉LIBRM_STM32_FAKE_HAL)就能测到真实的周期数
+ */
+
+#include <cstdio>
+#include <functional>
+#include <unordered_map>
+
+#include "librm/core/time.hpp"
+#include "librm/hal/stm32/hal.h"
+#include "librm/hal/stm32/static_callback.h"
+
+namespace {
+
+/**
+ * @brief 代替驱动对象，回调里只累加一个计数，测的就是分发本身的开销
+ */
+struct FakeDriver {
+  volatile rm::u32 rx_count{0};
+  void OnRx() { this->rx_count = this->rx_count + 1; }
+};
+
+struct RxTag;
+using RxCallback = rm::hal::stm32::StaticCallback<void(CAN_HandleTypeDef *), RxTag, 3>;
+
+// 原来的做法：所有句柄共用一个C回调，进中断时按句柄查表，再调用std::function
+std::unordered_map<CAN_HandleTypeDef *, std::function<void()>> legacy_callbacks;
+
+void LegacyRxCallback(CAN_HandleTypeDef *hcan) { legacy_callbacks[hcan](); }
+
+constexpr rm::u32 kIrqs = 3'000'000;
+constexpr int kRounds = 5;
+
+/**
+ * @brief 模拟kIrqs次接收中断，轮流在三个句柄上触发，跑kRounds轮取最快的一轮
+ * @return 每次中断分发的平均周期数
+ */
+double MeasureCycles(CAN_HandleTypeDef *const (&handles)[3]) {
+  double best = 1e30;
+  for (int round = 0; round < kRounds; ++round) {
+    const rm::u32 start = DWT->CYCCNT;
+    for (rm::u32 i = 0; i < kIrqs; ++i) {
+      CAN_HandleTypeDef *hcan = handles[i % 3];
+      // 不让编译器看穿句柄里的函数指针，保持和真实中断一样的间接调用
+      asm volatile("" : "+r"(hcan) : : "memory");
+      hcan->RxFifo0MsgPendingCallback(hcan);
+    }
+    const rm::u32 cycles = DWT->CYCCNT - start;
+    const double per_irq = static_cast<double>(cycles) / kIrqs;
+    best = per_irq < best ? per_irq : best;
+  }
+  return best;
+}
+
+}  // namespace
+
+int main() {
+  rm::core::time::EnableDwt();
+  CAN_HandleTypeDef hcan1{CAN1}, hcan2{CAN2}, hcan3{CAN1};
+  CAN_HandleTypeDef *const handles[3] = {&hcan1, &hcan2, &hcan3};
+  FakeDriver drivers[3];
+
+  for (int i = 0; i < 3; ++i) {
+    FakeDriver *driver = &drivers[i];
+    legacy_callbacks[handles[i]] = [driver]() { driver->OnRx(); };
+    handles[i]->RxFifo0MsgPendingCallback = &LegacyRxCallback;
+  }
+  const double legacy_cycles = MeasureCycles(handles);
+
+  for (int i = 0; i < 3; ++i) {
+    handles[i]->RxFifo0MsgPendingCallback = RxCallback::Register<&FakeDriver::OnRx>(&drivers[i]);
+  }
+  const double static_cycles = MeasureCycles(handles);
+  for (auto &driver : drivers) {
+    RxCallback::Unregister(&driver);
+  }
+
+  std::printf("%u IRQs x %d rounds over 3 handles (best round, cycles @ %lu Hz)\n", kIrqs, kRounds,
+              static_cast<unsigned long>(SystemCoreClock));
+  const double ns_per_cycle = 1e9 / SystemCoreClock;
+  std::printf("unordered_map + std::function : %6.2f cycles/IRQ (%6.2f ns)\n", legacy_cycles,
+              legacy_cycles * ns_per_cycle);
+  std::printf("StaticCallback                : %6.2f cycles/IRQ (%6.2f ns)\n", static_cycles,
+              static_cycles * ns_per_cycle);
+  std::printf("speedup                       : %6.2fx\n", legacy_cycles / static_cycles);
+  return 0;
+}
@@ -28,6 +28,12 @@ find_package(JetsonGPIO QUIET)                       # jetson
 
 get_directory_property(DEFS COMPILE_DEFINITIONS)
 
+# 在主机上用模拟的HAL库(src/librm/hal/stm32/fake)编译STM32驱动，用来做单元测试和测中断回调的耗时
+option(LIBRM_STM32_FAKE_HAL "Build the STM32 drivers on the host against a fake HAL" OFF)
+if (LIBRM_STM32_FAKE_HAL)
+    set(LIBRM_PLATFORM "STM32")
+endif ()
+
 if (DEFINED LIBRM_PLATFORM)                                         # 如果用户定义了LIBRM_PLATFORM变量
     if (NOT "${LIBRM_PLATFORM}" IN_LIST LIBRM_AVAIABLE_PLATFORMS)   # 但是用户定义的平台不在可用平台列表里
         message(WARNING "[librm]: Invalid platform: ${LIBRM_PLATFORM}\n"
@@ -31,6 +31,7 @@
 /******** CORE ********/
 #include "librm/core/cmsis_rtos.h"
 #include "librm/core/thread_pool.hpp"
+#include "librm/core/spsc_queue.hpp"
 #include "librm/core/typedefs.h"
 #include "librm/core/exception.h"
 #include "librm/core/time.hpp"
@@ -46,6 +47,7 @@
 /******** DEVICE ********/
 #include "librm/device/device.h"
 #include "librm/device/can_device.hpp"
+#include "librm/device/can_device_set.hpp"
 #include "librm/device/actuator/directdrive_motor.hpp"
 #include "librm/device/actuator/dji_motor.hpp"
 #include "librm/device/actuator/dm_motor.hpp"
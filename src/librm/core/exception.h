@@ -41,8 +41,8 @@ namespace rm {
  * @param e 异常类型
  */
 inline void Throw(const std::exception& e) {
-#if defined(LIBRM_PLATFORM_LINUX)
-  throw e;
+#if defined(LIBRM_PLATFORM_LINUX) || defined(LIBRM_STM32_FAKE_HAL)
+  throw e;  // 用模拟HAL在电脑上跑时也直接抛出，方便测试
 #elif defined(LIBRM_PLATFORM_STM32)
   // TODO 裸机不能直接抛异常，但为了防止进一步出错，先把程序停在这里
   while (true) {
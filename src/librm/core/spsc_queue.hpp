@@ -0,0 +1,145 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/core/spsc_queue.hpp
+ * @brief 单生产者单消费者无锁环形队列
+ */
+
+#ifndef LIBRM_CORE_SPSC_QUEUE_HPP
+#define LIBRM_CORE_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <memory>
+
+#include "librm/core/typedefs.h"
+
+namespace rm::core {
+
+/**
+ * @brief 单生产者单消费者(SPSC)无锁环形队列
+ * @note  缓冲区在构造时一次性分配好，容量向上取整到2的幂，之后Push/Pop都不会再分配内存
+ * @note  同一时刻只能有一个线程(或中断)调用Push，一个线程调用Pop；两者可以在不同线程/中断里并发执行
+ * @tparam T 元素类型，需要可以拷贝赋值
+ */
+template <typename T>
+class SpscQueue {
+ public:
+  /**
+   * @param capacity 队列容量，会被向上取整到2的幂
+   */
+  explicit SpscQueue(usize capacity) {
+    usize size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    this->buffer_ = std::make_unique<T[]>(size);
+    this->mask_ = size - 1;
+  }
+
+  // 禁止拷贝构造
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  /**
+   * @brief  向队尾写入一个元素，只能由生产者调用
+   * @param  item 要写入的元素
+   * @return 队列已满时返回false，元素不会被写入
+   */
+  bool Push(const T &item) {
+    const usize tail = this->tail_.load(std::memory_order_relaxed);
+    if (tail - this->head_.load(std::memory_order_acquire) > this->mask_) {
+      return false;
+    }
+    this->buffer_[tail & this->mask_] = item;
+    this->tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief  从队首取出一个元素，只能由消费者调用
+   * @param  item 取出的元素
+   * @return 队列为空时返回false
+   */
+  bool Pop(T &item) {
+    const usize head = this->head_.load(std::memory_order_relaxed);
+    if (head == this->tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = this->buffer_[head & this->mask_];
+    this->head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief  一次向队尾写入多个元素，只能由生产者调用
+   * @param  items 要写入的元素
+   * @param  count 元素数量
+   * @return 剩余空间不够放下所有元素时返回false，一个元素也不会写入
+   */
+  bool PushBulk(const T *items, usize count) {
+    const usize tail = this->tail_.load(std::memory_order_relaxed);
+    if (count > this->capacity() - (tail - this->head_.load(std::memory_order_acquire))) {
+      return false;
+    }
+    for (usize i = 0; i < count; ++i) {
+      this->buffer_[(tail + i) & this->mask_] = items[i];
+    }
+    this->tail_.store(tail + count, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief  一次从队首取出多个元素，只能由消费者调用
+   * @param  items 取出的元素
+   * @param  count 最多取出多少个元素
+   * @return 实际取出的元素数量
+   */
+  usize PopBulk(T *items, usize count) {
+    const usize head = this->head_.load(std::memory_order_relaxed);
+    const usize available = this->tail_.load(std::memory_order_acquire) - head;
+    if (count > available) {
+      count = available;
+    }
+    for (usize i = 0; i < count; ++i) {
+      items[i] = this->buffer_[(head + i) & this->mask_];
+    }
+    this->head_.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  [[nodiscard]] usize size() const {
+    return this->tail_.load(std::memory_order_acquire) - this->head_.load(std::memory_order_acquire);
+  }
+  [[nodiscard]] bool empty() const { return this->size() == 0; }
+  [[nodiscard]] usize capacity() const { return this->mask_ + 1; }
+
+ private:
+  std::unique_ptr<T[]> buffer_;
+  usize mask_{0};
+  std::atomic<usize> head_{0};  // 下一个要读的位置，只由消费者写
+  std::atomic<usize> tail_{0};  // 下一个要写的位置，只由生产者写
+};
+
+}  // namespace rm::core
+
+#endif  // LIBRM_CORE_SPSC_QUEUE_HPP
@@ -33,6 +33,7 @@
 
 #if defined(LIBRM_PLATFORM_STM32)
 #include "librm/core/cmsis_rtos.h"
+#include "librm/hal/stm32/critical_section.h"
 #include "librm/hal/stm32/hal.h"
 #endif
 #include "librm/core/typedefs.h"
@@ -58,16 +59,23 @@ inline void SleepMs(u32 ms) {
 }
 
 /**
- * @brief 给STM32平台使用的延时函数
- * @param us 延时时间，单位为微秒
+ * @brief 启用DWT周期计数器
  */
-inline void SleepUs(u32 us) {
+inline void EnableDwt() {
   if (!(CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk)) {
     CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
   }
   if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
     DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
   }
+}
+
+/**
+ * @brief 给STM32平台使用的延时函数
+ * @param us 延时时间，单位为微秒
+ */
+inline void SleepUs(u32 us) {
+  EnableDwt();
 
   u32 start = DWT->CYCCNT;
   u32 ticks = us * (HAL_RCC_GetSysClockFreq() / 1000000);
@@ -78,6 +86,37 @@ inline void SleepUs(u32 us) {
 }
 #endif
 
+/**
+ * @brief  获取单调递增的微秒时间戳，CAN报文的接收时间戳也使用这个时钟
+ * @return STM32平台上是DWT周期计数器扩展到64位之后换算出来的时间；Linux平台上是CLOCK_MONOTONIC(steady_clock)，
+ *         不受NTP和手动改系统时间影响，SocketCan会把内核给报文打的CLOCK_REALTIME时间戳换算到这个时钟
+ * @note   STM32平台上DWT计数器是32位的，168MHz下约25.6秒(2^32个周期)溢出一次，这个函数靠比较相邻两次读到的值来累加
+ *         溢出次数，所以至少每25秒要调用一次，否则会漏算溢出，时间戳会倒退。总线上有报文时接收中断里都会调用；
+ *         总线可能长时间空闲时，要在某个周期性的任务里调用一次这个函数来维持
+ */
+inline u64 NowUs() {
+#if defined(LIBRM_PLATFORM_STM32)
+  static u32 last_cyccnt = 0;
+  static u64 cyccnt_high = 0;
+  EnableDwt();
+  u64 cycles;
+  {
+    // 中断和任务里都可能调用，读取和更新溢出计数时要关中断
+    hal::stm32::CriticalSection critical_section;
+    const u32 cyccnt = DWT->CYCCNT;
+    if (cyccnt < last_cyccnt) {
+      cyccnt_high += 1ull << 32;
+    }
+    last_cyccnt = cyccnt;
+    cycles = cyccnt_high | cyccnt;
+  }
+  return cycles / (SystemCoreClock / 1000000);
+#else
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
 /**
  * @param  duration 延时时间
  */
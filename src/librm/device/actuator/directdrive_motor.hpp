@@ -46,7 +46,11 @@ namespace rm::device {
 class DirectDriveMotor : public CanDevice {
  public:
   DirectDriveMotor(hal::CanInterface &can, usize id)
-      : CanDevice(can, 0x50 + id, 0x60 + id, 0x70 + id, 0x80 + id, 0x90 + id, 0xa0 + id, 0xb0 + id), id_(id) {}
+      : CanDevice(can, 0x50 + id, 0x60 + id, 0x70 + id, 0x80 + id, 0x90 + id, 0xa0 + id, 0xb0 + id), id_(id) {
+    // 只有0x50+id是周期性的反馈帧，其他ID是查询和参数读写的应答；控制帧每4个电机共用一帧
+    can.DeclareTraffic(0x50 + id, 8, 1000.f);
+    can.DeclareTraffic(id < 5 ? TxCommandId::kDrive1234 : TxCommandId::kDrive5678, 8, kCanDefaultControlRateHz);
+  }
 
  private:
   template <typename ParamType, usize OpCode>
@@ -271,6 +275,9 @@ class DirectDriveMotor : public CanDevice {
   [[nodiscard]] inline f32 master_voltage() const { return feedback_.master_voltage; }
 
  private:
+  template <typename...>
+  friend class CanDeviceSet;
+
   void RxCallback(const hal::CanMsg *msg) override;
 };
 
@@ -118,6 +118,9 @@ class DjiMotor final : public CanDevice {
   /*************/
 
  private:
+  template <typename...>
+  friend class CanDeviceSet;
+
   void RxCallback(const hal::CanMsg *msg) override;
 
   u16 id_{};         // 电机ID
@@ -147,6 +150,9 @@ DjiMotor<motor_type>::DjiMotor(hal::CanInterface &can, u16 id, bool reversed)
   if (DjiMotorProperties<motor_type>::tx_buf_.find(&can) == DjiMotorProperties<motor_type>::tx_buf_.end()) {
     DjiMotorProperties<motor_type>::tx_buf_.insert({&can, {0}});
   }
+  // 反馈帧由电调固定以1kHz发送，控制帧每4个电机共用一帧
+  can.DeclareTraffic(DjiMotorProperties<motor_type>::kRxIdBase + id, 8, 1000.f);
+  can.DeclareTraffic(DjiMotorProperties<motor_type>::kControlId[id <= 4 ? 0 : 1], 8, kCanDefaultControlRateHz);
 }
 
 /**
@@ -131,7 +131,11 @@ class DmMotor final : public CanDevice {
    * @param reversed    是否反转
    */
   DmMotor(hal::CanInterface &can, DmMotorSettings<control_mode> settings, bool reversed = false)
-      : CanDevice(can, settings.master_id), settings_(settings), reversed_(reversed) {}
+      : CanDevice(can, settings.master_id), settings_(settings), reversed_(reversed) {
+    // 达妙电机每收到一帧控制报文回一帧反馈
+    can.DeclareTraffic(settings.slave_id, 8, kCanDefaultControlRateHz);
+    can.DeclareTraffic(settings.master_id, 8, kCanDefaultControlRateHz);
+  }
 
   // 禁止拷贝构造
   DmMotor(const DmMotor &) = delete;
@@ -226,6 +230,9 @@ class DmMotor final : public CanDevice {
   /*************/
 
  private:
+  template <typename...>
+  friend class CanDeviceSet;
+
   /**
    * @brief CAN回调函数，解码收到的反馈报文
    * @param msg   收到的报文
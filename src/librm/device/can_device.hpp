@@ -28,10 +28,22 @@
 #ifndef LIBRM_CAN_DEVICE_HPP
 #define LIBRM_CAN_DEVICE_HPP
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include "librm/hal/can_interface.h"
 
 namespace rm::device {
 
+/**
+ * @brief 设备在构造时声明控制帧流量用的默认控制频率(Hz)，实际频率不一样时可以用CanInterface::DeclareTraffic()覆盖
+ */
+constexpr f32 kCanDefaultControlRateHz = 1000.f;
+
+template <typename... Devices>
+class CanDeviceSet;
+
 /**
  * @brief CAN设备的基类
  * @note  这个类是抽象基类，用来被CAN设备类继承，不能实例化。
@@ -42,6 +54,9 @@ namespace rm::device {
  * @note  框架对CAN总线和设备的封装使用观察者模式，CAN设备向CAN总线类"注册"自己，并且告知自己要接收哪些ID的报文；
  *        基于具体平台实现，CAN总线类会用轮询或接管中断的方式接收所有报文，每接收到一条报文，它就会寻找有没有注册过想要接收这条报文的设备，
  *        如果有，这个设备的RxCallback()函数就会被CAN总线类调用。
+ * @note  电机反馈这类报文只有最新的一帧有用，总线上每来一帧都走一遍完整的解码比较浪费；
+ *        调用EnableConflation()开启最新值模式之后，收到的报文只会覆盖这个ID的槽位，由控制循环每个周期调用一次ProcessLatest()，
+ *        把每个ID自上次以来最新的一帧交给RxCallback()。处理得慢也不会积压，CPU开销只和控制频率有关，和总线上的报文频率无关
  */
 class CanDevice {
  public:
@@ -52,7 +67,8 @@ class CanDevice {
    * @param rx_std_ids 这个设备的rx消息标准帧id列表
    */
   template <typename... IdList>
-  explicit CanDevice(hal::CanInterface &can, IdList... rx_std_ids) : can_(&can) {
+  explicit CanDevice(hal::CanInterface &can, IdList... rx_std_ids)
+      : can_(&can), rx_std_ids_{static_cast<u32>(rx_std_ids)...} {
     (can.RegisterDevice(*this, rx_std_ids), ...);
   }
 
@@ -62,8 +78,136 @@ class CanDevice {
 
   virtual void RxCallback(const hal::CanMsg *msg) = 0;
 
+  /**
+   * @brief 最新值模式下，有新报文到达时调用的通知函数；每次ProcessLatest()之后最多通知一次
+   */
+  using LatestNotifyFunction = void (*)(void *arg);
+
+  /**
+   * @brief 开启最新值模式，收到的报文只覆盖对应ID的槽位，要调用ProcessLatest()才会交给RxCallback()
+   * @note  要在CAN外设Begin()之前调用
+   * @param notify 有新报文到达时调用的通知函数，可以为空；在接收中断或者接收线程里调用，不能阻塞
+   * @param arg    传给通知函数的参数
+   */
+  void EnableConflation(LatestNotifyFunction notify = nullptr, void *arg = nullptr) {
+    this->latest_ = std::make_unique<LatestSlot[]>(this->rx_std_ids_.size());
+    this->latest_notify_ = notify;
+    this->latest_notify_arg_ = arg;
+  }
+
+  /**
+   * @brief  最新值模式下，把每个ID自上次调用以来收到的最新一帧交给RxCallback()，在控制循环里每个周期调用一次
+   * @return 交给RxCallback()的报文数量
+   */
+  usize ProcessLatest() {
+    if (this->latest_ == nullptr) {
+      return 0;
+    }
+    // 先清掉标志再读槽位，读的过程中到达的报文会再触发一次通知，不会被漏掉
+    this->latest_pending_.store(false, std::memory_order_relaxed);
+    usize count = 0;
+    hal::CanMsg msg;
+    for (usize i = 0; i < this->rx_std_ids_.size(); ++i) {
+      if (this->latest_[i].Load(msg)) {
+        this->RxCallback(&msg);
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  /**
+   * @return 是否开启了最新值模式
+   */
+  [[nodiscard]] bool conflating() const { return this->latest_ != nullptr; }
+
+  /**
+   * @return 设备挂在哪个CAN接口上
+   */
+  [[nodiscard]] hal::CanInterface &can() const { return *this->can_; }
+
+  /**
+   * @return 这个设备要接收的所有标准帧ID
+   */
+  [[nodiscard]] const std::vector<u32> &rx_std_ids() const { return this->rx_std_ids_; }
+
+  /**
+   * @return 最新值模式下，还没被ProcessLatest()处理就被新报文覆盖掉的报文数量
+   */
+  [[nodiscard]] u32 conflated_count() const { return this->conflated_count_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 把收到的报文交给设备，CAN接口收到报文时调用这个函数而不是直接调用RxCallback()
+   * @note  一个ID的报文只能由一个线程或者中断调用这个函数
+   */
+  void Deliver(const hal::CanMsg &msg) {
+    if (this->latest_ == nullptr) {
+      this->RxCallback(&msg);
+      return;
+    }
+    for (usize i = 0; i < this->rx_std_ids_.size(); ++i) {
+      if (this->rx_std_ids_[i] != msg.rx_std_id) {
+        continue;
+      }
+      if (this->latest_[i].Store(msg)) {
+        this->conflated_count_.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (!this->latest_pending_.exchange(true, std::memory_order_acq_rel) && this->latest_notify_ != nullptr) {
+        this->latest_notify_(this->latest_notify_arg_);
+      }
+      return;
+    }
+  }
+
  protected:
   hal::CanInterface *can_;
+
+ private:
+  /**
+   * @brief 最新值模式下一个ID的槽位，用seqlock保护，接收方和ProcessLatest()之间不需要锁
+   */
+  struct LatestSlot {
+    std::atomic<u32> sequence{0};  // 奇数表示正在写
+    std::atomic<u32> consumed{0};  // ProcessLatest()上次处理到的sequence
+    hal::CanMsg msg{};
+
+    /**
+     * @return 上一帧还没被读走就被覆盖了时返回true
+     */
+    bool Store(const hal::CanMsg &src) {
+      const u32 seq = this->sequence.load(std::memory_order_relaxed);
+      this->sequence.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      this->msg = src;
+      this->sequence.store(seq + 2, std::memory_order_release);
+      return seq != this->consumed.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return 有没读过的新报文时返回true；正好赶上写者在写时返回false，写者写完会再通知一次
+     */
+    bool Load(hal::CanMsg &dst) {
+      while (true) {
+        const u32 seq = this->sequence.load(std::memory_order_acquire);
+        if (seq == this->consumed.load(std::memory_order_relaxed) || (seq & 1)) {
+          return false;
+        }
+        dst = this->msg;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (this->sequence.load(std::memory_order_relaxed) == seq) {
+          this->consumed.store(seq, std::memory_order_relaxed);
+          return true;
+        }
+      }
+    }
+  };
+
+  std::vector<u32> rx_std_ids_;
+  std::unique_ptr<LatestSlot[]> latest_{};
+  LatestNotifyFunction latest_notify_{nullptr};
+  void *latest_notify_arg_{nullptr};
+  std::atomic<bool> latest_pending_{false};
+  std::atomic<u32> conflated_count_{0};
 };
 
 }  // namespace rm::device
@@ -0,0 +1,149 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/device/can_device_set.hpp
+ * @brief 编译期确定的CAN设备集合，接收时不查表、不走虚函数
+ */
+
+#ifndef LIBRM_DEVICE_CAN_DEVICE_SET_HPP
+#define LIBRM_DEVICE_CAN_DEVICE_SET_HPP
+
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "librm/core/exception.h"
+#include "librm/core/typedefs.h"
+#include "librm/device/can_device.hpp"
+#include "librm/hal/can_interface.h"
+
+namespace rm::device {
+
+/**
+ * @brief  把一条总线上类型已知的设备打包成一个集合，收到报文时用ID直接查出设备下标，
+ *         再按下标跳到对应类型的RxCallback()。这里是按具体类型调用的，省掉了设备表查找和虚函数调用
+ * @note   解码函数能不能被内联，取决于它和它用到的函数是不是都定义在头文件里：DjiMotor可以整个内联进来；
+ *         DmMotor的RxCallback()在头文件里，但里面调用的IntToFloat()在utils.cc里；
+ *         DirectDriveMotor和SuperCap的RxCallback()定义在.cc里，只是从虚函数调用变成了直接调用
+ * @note   用法：
+ *         @code
+ *         DjiMotor<GM6020> yaw(can, 1);
+ *         DmMotor pitch(can, {...});
+ *         CanDeviceSet<DjiMotor<GM6020>, DmMotor> devices(can, yaw, pitch);
+ *         can.Begin();
+ *         @endcode
+ *         设备的ID是构造时才确定的，所以ID到下标的映射表在构造时生成，表的长度是这些设备最大和最小ID之差加一。
+ *         集合里的设备必须都挂在can上，否则抛出异常；一个接口上只能有一个集合，集合的生命周期不能比can长；
+ *         不在集合里的设备仍然走原来的查表+虚函数路径。
+ *         开启了最新值模式的设备，收到的报文照样交给Deliver()
+ * @tparam Devices 设备类型，都必须继承自CanDevice
+ */
+template <typename... Devices>
+class CanDeviceSet {
+  static_assert(sizeof...(Devices) > 0, "CanDeviceSet needs at least one device");
+  static_assert(sizeof...(Devices) < 0xff, "Too many devices in one CanDeviceSet");
+  static_assert((std::is_base_of_v<CanDevice, Devices> && ...), "Devices must derive from CanDevice");
+
+ public:
+  CanDeviceSet(hal::CanInterface &can, Devices &...devices) : can_(&can), devices_{&devices...} {
+    u32 min_id = ~0u;
+    u32 max_id = 0;
+    for (const CanDevice *device : {static_cast<const CanDevice *>(&devices)...}) {
+      if (&device->can() != &can) {
+        Throw(std::runtime_error("CanDeviceSet: every device must be registered on the same CAN interface"));
+        return;
+      }
+      for (const u32 id : device->rx_std_ids()) {
+        min_id = std::min(min_id, id);
+        max_id = std::max(max_id, id);
+      }
+    }
+    if (min_id <= max_id) {
+      this->base_id_ = min_id;
+      this->index_.assign(max_id - min_id + 1, kNoDevice);
+      this->BuildIndex(std::index_sequence_for<Devices...>{});
+    }
+    this->can_->SetRxFastPath(&CanDeviceSet::Dispatch, this);
+  }
+  CanDeviceSet() = delete;
+  CanDeviceSet(const CanDeviceSet &) = delete;
+  CanDeviceSet &operator=(const CanDeviceSet &) = delete;
+  ~CanDeviceSet() { this->can_->ClearRxFastPath(this); }
+
+  /**
+   * @brief 接收快速路径，由CAN接口在收到报文时调用
+   * @return 报文的ID属于集合里的设备时返回true
+   */
+  static bool Dispatch(void *context, const hal::CanMsg &msg) {
+    auto *self = static_cast<CanDeviceSet *>(context);
+    const u32 offset = msg.rx_std_id - self->base_id_;
+    if (offset >= self->index_.size()) {
+      return false;
+    }
+    const u8 index = self->index_[offset];
+    if (index == kNoDevice) {
+      return false;
+    }
+    self->Invoke(index, msg, std::index_sequence_for<Devices...>{});
+    return true;
+  }
+
+ private:
+  static constexpr u8 kNoDevice = 0xff;
+
+  template <usize... I>
+  void BuildIndex(std::index_sequence<I...>) {
+    (this->AddDevice(static_cast<u8>(I), *std::get<I>(this->devices_)), ...);
+  }
+
+  void AddDevice(u8 index, const CanDevice &device) {
+    for (const u32 id : device.rx_std_ids()) {
+      this->index_[id - this->base_id_] = index;
+    }
+  }
+
+  template <usize... I>
+  void Invoke(u8 index, const hal::CanMsg &msg, std::index_sequence<I...>) {
+    (void)((index == I ? (Call(*std::get<I>(this->devices_), msg), true) : false) || ...);
+  }
+
+  template <typename T>
+  static void Call(T &device, const hal::CanMsg &msg) {
+    if (device.conflating()) {
+      device.Deliver(msg);
+      return;
+    }
+    device.T::RxCallback(&msg);
+  }
+
+  hal::CanInterface *can_;
+  std::tuple<Devices *...> devices_;
+  u32 base_id_{0};
+  std::vector<u8> index_{};
+};
+
+}  // namespace rm::device
+
+#endif  // LIBRM_DEVICE_CAN_DEVICE_SET_HPP
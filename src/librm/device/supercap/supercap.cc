@@ -35,7 +35,12 @@ namespace rm::device {
 
 using modules::algorithm::utils::Map;
 
-SuperCap::SuperCap(hal::CanInterface &can) : CanDevice(can, 0x30) {}
+SuperCap::SuperCap(hal::CanInterface &can) : CanDevice(can, 0x30) {
+  // 按常用的频率估算：反馈100Hz，功率缓冲50Hz转发，设置10Hz发送
+  can.DeclareTraffic(0x30, 8, 100.f);
+  can.DeclareTraffic(0x2e, 8, 50.f);
+  can.DeclareTraffic(0x2f, 8, 10.f);
+}
 
 /**
  * @return 电容两端电压(V)
@@ -0,0 +1,192 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/can_bus_planner.hpp
+ * @brief 启动时根据设备声明的报文估算CAN总线负载
+ */
+
+#ifndef LIBRM_HAL_CAN_BUS_PLANNER_HPP
+#define LIBRM_HAL_CAN_BUS_PLANNER_HPP
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#include "librm/core/exception.h"
+#include "librm/core/typedefs.h"
+#include "librm/hal/can_interface.h"
+
+namespace rm::hal {
+
+/**
+ * @brief 一条总线的负载估算结果
+ */
+struct CanBusLoad {
+  f32 frames_per_second;  ///< 每秒多少帧
+  f32 bits_per_second;    ///< 按最坏情况位填充算的每秒位数，CAN FD开了BRS时数据段折算成仲裁段位速率下的位数
+  f32 utilization;        ///< 负载率，1表示总线被占满
+};
+
+/**
+ * @brief 负载超过阈值时怎么处理
+ */
+enum class CanBusPlanAction {
+  kWarn,   ///< 调用警告函数，程序继续运行
+  kThrow,  ///< 抛出异常
+};
+
+/**
+ * @brief  CAN总线负载规划器，在所有设备构造完、总线启动之前检查每条总线的负载
+ * @note   设备在构造时会用CanInterface::DeclareTraffic()声明自己收发的周期性报文，比如大疆电机的1kHz反馈和控制帧；
+ *         规划器把一条总线上声明的报文按最坏情况的位填充折算成位数，除以波特率得到负载率。
+ *         超过8字节的报文按CAN FD帧计算；总线给了数据段位速率时认为开了BRS，数据段按数据段位速率计算占用的时间。
+ *         负载率长期超过70%左右时，低优先级的报文会被频繁推迟，表现为随机的控制延迟，而不是明确的错误
+ * @note   用法：
+ *         @code
+ *         CanBusPlanner planner(0.7f, CanBusPlanAction::kThrow);
+ *         planner.AddBus("can1", can1, 1000000).AddBus("can2", can2, 1000000, 5000000);
+ *         planner.Check();
+ *         @endcode
+ */
+class CanBusPlanner {
+ public:
+  /**
+   * @brief 负载超过阈值时调用的警告函数
+   */
+  using WarningHandler = void (*)(const char *bus_name, const CanBusLoad &load, f32 threshold);
+
+  /**
+   * @param threshold 负载率阈值，超过它就警告或者抛异常
+   * @param action    超过阈值时怎么处理
+   */
+  explicit CanBusPlanner(f32 threshold = 0.7f, CanBusPlanAction action = CanBusPlanAction::kWarn)
+      : threshold_(threshold), action_(action) {}
+
+  /**
+   * @brief 加入一条要检查的总线
+   * @param name         总线的名字，只用于警告信息
+   * @param can          CAN接口
+   * @param bitrate      波特率(bit/s)，CAN FD总线是仲裁段的位速率
+   * @param data_bitrate CAN FD数据段的位速率(bit/s)，0表示没有开BRS，数据段也按bitrate传输
+   */
+  CanBusPlanner &AddBus(const char *name, const CanInterface &can, u32 bitrate, u32 data_bitrate = 0) {
+    this->buses_.push_back({name, &can, bitrate, data_bitrate});
+    return *this;
+  }
+
+  /**
+   * @brief 设置负载超过阈值时调用的警告函数，Linux上默认打印到stderr，STM32上默认什么都不做
+   */
+  void set_warning_handler(WarningHandler handler) { this->warning_handler_ = handler; }
+
+  /**
+   * @brief  估算一条总线的负载
+   * @param  can          CAN接口
+   * @param  bitrate      波特率(bit/s)，CAN FD总线是仲裁段的位速率
+   * @param  data_bitrate CAN FD数据段的位速率(bit/s)，0表示没有开BRS
+   * @return 负载估算结果
+   */
+  static CanBusLoad Estimate(const CanInterface &can, u32 bitrate, u32 data_bitrate = 0) {
+    CanBusLoad load{0, 0, 0};
+    if (bitrate == 0) {
+      return load;
+    }
+    const bool brs = data_bitrate != 0 && data_bitrate != bitrate;
+    f32 busy_seconds = 0;  // 每秒里总线被占用的时间
+    for (const auto &traffic : can.declared_traffic()) {
+      load.frames_per_second += traffic.rate_hz;
+      if (traffic.size > 8) {
+        busy_seconds += traffic.rate_hz * CanFdFrameBits(traffic.size, brs).seconds(bitrate, data_bitrate);
+      } else {
+        busy_seconds += traffic.rate_hz * static_cast<f32>(CanFrameBits(traffic.size)) / static_cast<f32>(bitrate);
+      }
+    }
+    load.bits_per_second = busy_seconds * static_cast<f32>(bitrate);
+    load.utilization = busy_seconds;
+    return load;
+  }
+
+  /**
+   * @brief  检查所有总线，负载超过阈值时按构造时指定的方式处理
+   * @return 所有总线都没有超过阈值时返回true
+   */
+  bool Check() const {
+    bool ok = true;
+    for (const auto &bus : this->buses_) {
+      const CanBusLoad load = Estimate(*bus.can, bus.bitrate, bus.data_bitrate);
+      if (load.utilization <= this->threshold_) {
+        continue;
+      }
+      ok = false;
+      if (this->action_ == CanBusPlanAction::kThrow) {
+        char message[128];
+        std::snprintf(message, sizeof(message), "CAN bus %s overloaded: %.0f%% > %.0f%%", bus.name,
+                      load.utilization * 100.f, this->threshold_ * 100.f);
+#if defined(LIBRM_PLATFORM_LINUX)
+        throw std::runtime_error(message);
+#else
+        Throw(std::runtime_error(message));
+#endif
+      }
+      if (this->warning_handler_ != nullptr) {
+        this->warning_handler_(bus.name, load, this->threshold_);
+      }
+    }
+    return ok;
+  }
+
+  /**
+   * @brief 遍历所有总线的估算结果，可以用来在启动时打印负载
+   * @param fn 形如void(const char *name, const CanBusLoad &load)的函数
+   */
+  template <typename Fn>
+  void ForEach(Fn &&fn) const {
+    for (const auto &bus : this->buses_) {
+      fn(bus.name, Estimate(*bus.can, bus.bitrate, bus.data_bitrate));
+    }
+  }
+
+ private:
+  struct Bus {
+    const char *name;
+    const CanInterface *can;
+    u32 bitrate;
+    u32 data_bitrate;
+  };
+
+  static void DefaultWarningHandler(const char *bus_name, const CanBusLoad &load, f32 threshold) {
+#if defined(LIBRM_PLATFORM_LINUX)
+    std::fprintf(stderr, "[librm] CAN bus %s worst-case load %.0f%% (%.0f frames/s) exceeds %.0f%%\n", bus_name,
+                 load.utilization * 100.f, load.frames_per_second, threshold * 100.f);
+#endif
+  }
+
+  f32 threshold_;
+  CanBusPlanAction action_;
+  WarningHandler warning_handler_{&DefaultWarningHandler};
+  std::vector<Bus> buses_{};
+};
+
+}  // namespace rm::hal
+
+#endif  // LIBRM_HAL_CAN_BUS_PLANNER_HPP
@@ -0,0 +1,292 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/can_bus_stats.hpp
+ * @brief 按ID统计CAN总线的帧率、到达间隔分布、丢帧和总线负载率
+ */
+
+#ifndef LIBRM_HAL_CAN_BUS_STATS_HPP
+#define LIBRM_HAL_CAN_BUS_STATS_HPP
+
+#include <array>
+#include <atomic>
+
+#include "librm/core/time.hpp"
+#include "librm/core/typedefs.h"
+#include "librm/hal/can_interface.h"
+
+namespace rm::hal {
+
+/**
+ * @brief  CAN总线统计
+ * @note   作为CanMonitor挂到CAN接口上使用：
+ *         @code
+ *         rm::hal::CanBusStats<> stats;
+ *         can.AttachMonitor(stats);
+ *         @endcode
+ * @note   所有统计量都是原子变量，任何线程都可以随时无锁地读取；读到的各个值之间不保证是同一时刻的快照
+ * @note   只跟踪标准帧ID，按ID索引的表占2KB；同时出现的ID超过kMaxIds个之后，新的ID只计入总数
+ * @tparam kMaxIds 最多单独统计多少个ID
+ */
+template <usize kMaxIds = 32>
+class CanBusStats final : public CanMonitor {
+  static_assert(kMaxIds < 255, "kMaxIds must fit in u8 index");
+
+ public:
+  /// 到达间隔直方图的桶数，第i个桶统计间隔在[2^i, 2^(i+1))us之间的帧，最后一个桶包括所有更长的间隔
+  static constexpr usize kHistogramBuckets = 16;
+  /// 计算总线负载率的统计窗口长度
+  static constexpr u32 kLoadWindowUs = 100'000;
+
+  CanBusStats() {
+    for (auto &entry : this->index_) {
+      entry.store(kNoSlot, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief 单个ID的统计量快照
+   */
+  struct IdStats {
+    u32 id;
+    bool known;                ///< 是否有设备注册了这个ID
+    u32 rx_frames;             ///< 收到的帧数
+    u32 tx_frames;             ///< 发出的帧数
+    u32 rx_dropped;            ///< 接收队列满被丢弃的帧数
+    u32 tx_dropped;            ///< 发送队列满或者发送失败被丢弃的帧数
+    u32 mean_interval_us;      ///< 平均到达间隔(指数滑动平均)
+    u32 max_interval_us;       ///< 最大到达间隔
+    std::array<u32, kHistogramBuckets> interval_histogram;  ///< 到达间隔直方图
+
+    /**
+     * @return 按平均到达间隔估算的帧率(Hz)，还没收到两帧时返回0
+     */
+    [[nodiscard]] f32 rate_hz() const { return this->mean_interval_us == 0 ? 0.f : 1e6f / this->mean_interval_us; }
+  };
+
+  void OnRx(const CanMsg &msg, bool known) override {
+    if (!known) {
+      this->unknown_id_frames_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // 负载窗口收发共用Now()这一个时钟；到达间隔只和同一个ID的上一帧比，优先用更准的接收时间戳
+    this->AddBits(msg, Now());
+    const u32 now_us = msg.timestamp_us != 0 ? static_cast<u32>(msg.timestamp_us) : Now();
+
+    Slot *slot = this->Acquire(msg.rx_std_id);
+    if (slot == nullptr) {
+      return;
+    }
+    slot->known.store(known, std::memory_order_relaxed);
+    // 接收回调只会在同一个上下文里调用(接收中断或者接收线程)，间隔相关的量只有这一个写者
+    if (slot->rx_frames.fetch_add(1, std::memory_order_relaxed) > 0) {
+      const u32 interval = now_us - slot->last_rx_us.load(std::memory_order_relaxed);
+      const u32 mean = slot->mean_interval_us.load(std::memory_order_relaxed);
+      slot->mean_interval_us.store(mean == 0 ? interval : mean - mean / 8 + interval / 8, std::memory_order_relaxed);
+      if (interval > slot->max_interval_us.load(std::memory_order_relaxed)) {
+        slot->max_interval_us.store(interval, std::memory_order_relaxed);
+      }
+      slot->interval_histogram[Bucket(interval)].fetch_add(1, std::memory_order_relaxed);
+    }
+    slot->last_rx_us.store(now_us, std::memory_order_relaxed);
+  }
+
+  void OnRxDrop(const CanMsg &msg) override {
+    if (Slot *slot = this->Acquire(msg.rx_std_id)) {
+      slot->rx_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void OnTx(const CanMsg &msg) override {
+    this->AddBits(msg, Now());
+    if (Slot *slot = this->Acquire(msg.rx_std_id)) {
+      slot->tx_frames.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void OnTxDrop(const CanMsg &msg) override {
+    if (Slot *slot = this->Acquire(msg.rx_std_id)) {
+      slot->tx_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void OnTxQueueDepth(usize depth) override {
+    const u32 value = depth;
+    this->tx_queue_depth_.store(value, std::memory_order_relaxed);
+    u32 max = this->max_tx_queue_depth_.load(std::memory_order_relaxed);
+    while (value > max && !this->max_tx_queue_depth_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  /**
+   * @brief  读取一个ID的统计量
+   * @param  id    标准帧ID
+   * @param  stats 输出
+   * @return 这个ID还没有出现过或者没有单独统计时返回false
+   */
+  bool Get(u32 id, IdStats &stats) const {
+    if (id >= this->index_.size()) {
+      return false;
+    }
+    const u8 index = this->index_[id].load(std::memory_order_acquire);
+    if (index == kNoSlot) {
+      return false;
+    }
+    this->slots_[index].Load(id, stats);
+    return true;
+  }
+
+  /**
+   * @brief 遍历所有已经出现过的ID的统计量
+   * @param fn 回调函数，参数为const IdStats &
+   */
+  template <typename Fn>
+  void ForEach(Fn &&fn) const {
+    for (u32 id = 0; id < this->index_.size(); ++id) {
+      IdStats stats;
+      if (this->Get(id, stats)) {
+        fn(stats);
+      }
+    }
+  }
+
+  /**
+   * @brief  估算总线负载率
+   * @param  bitrate 总线的(仲裁段)位速率，单位bps
+   * @return 最近一个完整统计窗口内的负载率，0~1；按最坏情况的位填充估算，实际负载率会略低一些
+   */
+  [[nodiscard]] f32 bus_load(u32 bitrate) const {
+    const u32 window_us = this->last_window_us_.load(std::memory_order_relaxed);
+    if (window_us == 0 || bitrate == 0) {
+      return 0.f;
+    }
+    return static_cast<f32>(this->last_window_bits_.load(std::memory_order_relaxed)) / bitrate / (window_us * 1e-6f);
+  }
+
+  /// 收到的没有设备注册的ID的帧数
+  [[nodiscard]] u32 unknown_id_frames() const { return this->unknown_id_frames_.load(std::memory_order_relaxed); }
+  /// 因为ID超出标准帧范围或者统计表满了而没有单独统计的帧数
+  [[nodiscard]] u32 untracked_frames() const { return this->untracked_frames_.load(std::memory_order_relaxed); }
+  /// 发送队列当前的深度
+  [[nodiscard]] u32 tx_queue_depth() const { return this->tx_queue_depth_.load(std::memory_order_relaxed); }
+  /// 发送队列出现过的最大深度
+  [[nodiscard]] u32 max_tx_queue_depth() const { return this->max_tx_queue_depth_.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr u8 kNoSlot = 0xff;
+
+  struct Slot {
+    std::atomic<bool> known{false};
+    std::atomic<u32> rx_frames{0};
+    std::atomic<u32> tx_frames{0};
+    std::atomic<u32> rx_dropped{0};
+    std::atomic<u32> tx_dropped{0};
+    std::atomic<u32> last_rx_us{0};
+    std::atomic<u32> mean_interval_us{0};
+    std::atomic<u32> max_interval_us{0};
+    std::array<std::atomic<u32>, kHistogramBuckets> interval_histogram{};
+
+    void Load(u32 id, IdStats &stats) const {
+      stats.id = id;
+      stats.known = this->known.load(std::memory_order_relaxed);
+      stats.rx_frames = this->rx_frames.load(std::memory_order_relaxed);
+      stats.tx_frames = this->tx_frames.load(std::memory_order_relaxed);
+      stats.rx_dropped = this->rx_dropped.load(std::memory_order_relaxed);
+      stats.tx_dropped = this->tx_dropped.load(std::memory_order_relaxed);
+      stats.mean_interval_us = this->mean_interval_us.load(std::memory_order_relaxed);
+      stats.max_interval_us = this->max_interval_us.load(std::memory_order_relaxed);
+      for (usize i = 0; i < kHistogramBuckets; ++i) {
+        stats.interval_histogram[i] = this->interval_histogram[i].load(std::memory_order_relaxed);
+      }
+    }
+  };
+
+  static u32 Now() { return static_cast<u32>(core::time::NowUs()); }
+
+  static usize Bucket(u32 interval_us) {
+    usize bucket = 0;
+    while (interval_us > 1 && bucket < kHistogramBuckets - 1) {
+      interval_us >>= 1;
+      ++bucket;
+    }
+    return bucket;
+  }
+
+  /**
+   * @brief 找到一个ID对应的统计槽，第一次出现的ID会分配一个新的槽；收发两边可能同时分配，所以用CAS认领
+   */
+  Slot *Acquire(u32 id) {
+    if (id >= this->index_.size()) {
+      this->untracked_frames_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    u8 index = this->index_[id].load(std::memory_order_acquire);
+    if (index != kNoSlot) {
+      return &this->slots_[index];
+    }
+    const u32 next = this->next_slot_.fetch_add(1, std::memory_order_relaxed);
+    if (next >= kMaxIds) {
+      this->next_slot_.store(kMaxIds, std::memory_order_relaxed);
+      this->untracked_frames_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    // 另一个线程抢先给这个ID分配了槽的话，刚才拿到的槽就浪费掉了，这种情况只会在ID第一次出现时发生
+    if (!this->index_[id].compare_exchange_strong(index, next, std::memory_order_acq_rel)) {
+      return &this->slots_[index];
+    }
+    return &this->slots_[next];
+  }
+
+  void AddBits(const CanMsg &msg, u32 now_us) {
+    // 这里只知道仲裁段的位速率，CAN FD帧数据段的位数也按仲裁段算，开了BRS时负载率偏保守
+    const usize bits = msg.fd ? CanFdFrameBits(msg.dlc, false).nominal : CanFrameBits(msg.dlc);
+    this->window_bits_.fetch_add(bits, std::memory_order_relaxed);
+    u32 start = this->window_start_us_.load(std::memory_order_relaxed);
+    const u32 elapsed = now_us - start;
+    if (start == 0) {
+      this->window_start_us_.compare_exchange_strong(start, now_us, std::memory_order_relaxed);
+    } else if (elapsed >= kLoadWindowUs && elapsed < 0x8000'0000 &&
+               this->window_start_us_.compare_exchange_strong(start, now_us, std::memory_order_relaxed)) {
+      this->last_window_bits_.store(this->window_bits_.exchange(0, std::memory_order_relaxed),
+                                    std::memory_order_relaxed);
+      this->last_window_us_.store(elapsed, std::memory_order_relaxed);
+    }
+  }
+
+  std::array<std::atomic<u8>, 2048> index_;
+  std::array<Slot, kMaxIds> slots_{};
+  std::atomic<u32> next_slot_{0};
+
+  std::atomic<u32> unknown_id_frames_{0};
+  std::atomic<u32> untracked_frames_{0};
+  std::atomic<u32> tx_queue_depth_{0};
+  std::atomic<u32> max_tx_queue_depth_{0};
+
+  std::atomic<u32> window_start_us_{0};
+  std::atomic<u32> window_bits_{0};
+  std::atomic<u32> last_window_bits_{0};
+  std::atomic<u32> last_window_us_{0};
+};
+
+}  // namespace rm::hal
+
+#endif  // LIBRM_HAL_CAN_BUS_STATS_HPP
@@ -0,0 +1,121 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/can_device_table.hpp
+ * @brief 按标准帧ID直接索引的CAN设备表
+ */
+
+#ifndef LIBRM_HAL_CAN_DEVICE_TABLE_HPP
+#define LIBRM_HAL_CAN_DEVICE_TABLE_HPP
+
+#include <array>
+#include <memory>
+
+#include "librm/core/typedefs.h"
+
+namespace rm::hal {
+
+/**
+ * @brief  按11位标准帧ID直接索引的设备表，用于在收到报文时找到对应的设备
+ * @note   两级结构：2048个ID分成16页，每页128项，只有注册过设备的页才会分配内存；
+ *         一般的机器人上所有设备的ID都集中在一两页里，所以只占1KB左右的内存
+ * @note   查找只需要两次数组索引，没有哈希计算，可以放心在中断里调用
+ * @note   插入只应该在初始化阶段进行，插入和查找不能并发
+ * @tparam T 表项类型，表里存的是T*
+ */
+template <typename T>
+class CanDeviceTable {
+ public:
+  /**
+   * @brief  注册一个表项
+   * @param  id    标准帧ID
+   * @param  entry 表项
+   * @return ID超出标准帧范围或者这个ID已经被注册过时返回false
+   */
+  bool Insert(u32 id, T *entry) {
+    if (id >= kNumIds) {
+      return false;
+    }
+    auto &page = this->pages_[id >> kPageBits];
+    if (page == nullptr) {
+      page = std::make_unique<Page>();
+      page->fill(nullptr);
+    }
+    if ((*page)[id & kPageMask] != nullptr) {
+      return false;
+    }
+    (*page)[id & kPageMask] = entry;
+    ++this->size_;
+    return true;
+  }
+
+  /**
+   * @param  id 标准帧ID
+   * @return 这个ID对应的表项，没有注册过时返回nullptr
+   */
+  [[nodiscard]] T *Find(u32 id) const {
+    if (id >= kNumIds) {
+      return nullptr;
+    }
+    const Page *page = this->pages_[id >> kPageBits].get();
+    return page == nullptr ? nullptr : (*page)[id & kPageMask];
+  }
+
+  /**
+   * @brief 按ID从小到大遍历所有表项
+   * @param fn 形如void(u32 id, T *entry)的函数
+   */
+  template <typename Fn>
+  void ForEach(Fn &&fn) const {
+    for (u32 page_index = 0; page_index < kNumPages; ++page_index) {
+      const Page *page = this->pages_[page_index].get();
+      if (page == nullptr) {
+        continue;
+      }
+      for (u32 i = 0; i < kPageSize; ++i) {
+        if ((*page)[i] != nullptr) {
+          fn((page_index << kPageBits) | i, (*page)[i]);
+        }
+      }
+    }
+  }
+
+  [[nodiscard]] usize size() const { return this->size_; }
+  [[nodiscard]] bool empty() const { return this->size_ == 0; }
+
+ private:
+  static constexpr u32 kNumIds = 2048;
+  static constexpr u32 kPageBits = 7;
+  static constexpr u32 kPageSize = 1u << kPageBits;
+  static constexpr u32 kPageMask = kPageSize - 1;
+  static constexpr u32 kNumPages = kNumIds / kPageSize;
+
+  using Page = std::array<T *, kPageSize>;
+
+  std::array<std::unique_ptr<Page>, kNumPages> pages_{};
+  usize size_{0};
+};
+
+}  // namespace rm::hal
+
+#endif  // LIBRM_HAL_CAN_DEVICE_TABLE_HPP
@@ -0,0 +1,110 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/can_filter.hpp
+ * @brief 根据设备注册的ID列表生成硬件/内核CAN过滤器
+ */
+
+#ifndef LIBRM_HAL_CAN_FILTER_HPP
+#define LIBRM_HAL_CAN_FILTER_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include "librm/core/typedefs.h"
+
+namespace rm::hal {
+
+/**
+ * @brief 一组ID/掩码过滤器，(rx_id & mask) == (id & mask)的报文会被接收
+ */
+struct CanFilter {
+  u32 id;
+  u32 mask;
+};
+
+/**
+ * @brief  计算一个过滤器会放行多少个ID
+ * @param  filter  过滤器
+ * @param  id_bits ID的位数，标准帧为11
+ */
+inline u32 CanFilterAcceptedIds(const CanFilter &filter, u32 id_bits = 11) {
+  u32 fixed_bits = 0;
+  for (u32 bit = 0; bit < id_bits; ++bit) {
+    fixed_bits += (filter.mask >> bit) & 1u;
+  }
+  return 1u << (id_bits - fixed_bits);
+}
+
+/**
+ * @brief  根据需要接收的ID列表生成不超过max_filters个过滤器
+ * @note   一开始每个ID对应一个精确匹配的过滤器；如果数量超过max_filters，就不断把"合并后多放行的ID最少"的两个过滤器合并成一个，
+ *         直到数量满足要求。合并后的过滤器只会多放行一些ID，不会漏掉任何需要的ID，多出来的报文由软件分发时丢弃
+ * @param  ids         需要接收的ID列表，可以有重复
+ * @param  max_filters 最多能用几个过滤器
+ * @param  id_bits     ID的位数，标准帧为11
+ * @return 过滤器列表，ids为空时返回空列表
+ */
+inline std::vector<CanFilter> BuildCanFilters(std::vector<u32> ids, usize max_filters, u32 id_bits = 11) {
+  const u32 full_mask = (1u << id_bits) - 1;
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+  std::vector<CanFilter> filters;
+  filters.reserve(ids.size());
+  for (u32 id : ids) {
+    filters.push_back({id & full_mask, full_mask});
+  }
+  if (max_filters == 0) {
+    return {};
+  }
+
+  while (filters.size() > max_filters) {
+    usize best_a = 0, best_b = 1;
+    u32 best_cost = UINT32_MAX;
+    CanFilter best_merged{};
+    for (usize a = 0; a < filters.size(); ++a) {
+      for (usize b = a + 1; b < filters.size(); ++b) {
+        CanFilter merged;
+        merged.mask = filters[a].mask & filters[b].mask & ~(filters[a].id ^ filters[b].id) & full_mask;
+        merged.id = filters[a].id & merged.mask;
+        const u32 before = CanFilterAcceptedIds(filters[a], id_bits) + CanFilterAcceptedIds(filters[b], id_bits);
+        const u32 after = CanFilterAcceptedIds(merged, id_bits);
+        const u32 cost = after > before ? after - before : 0;
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_a = a;
+          best_b = b;
+          best_merged = merged;
+        }
+      }
+    }
+    filters[best_a] = best_merged;
+    filters.erase(filters.begin() + best_b);
+  }
+  return filters;
+}
+
+}  // namespace rm::hal
+
+#endif  // LIBRM_HAL_CAN_FILTER_HPP
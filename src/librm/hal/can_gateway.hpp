@@ -0,0 +1,229 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/can_gateway.hpp
+ * @brief 在两个CAN接口之间按ID转发报文的网关
+ */
+
+#ifndef LIBRM_HAL_CAN_GATEWAY_HPP
+#define LIBRM_HAL_CAN_GATEWAY_HPP
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "librm/core/exception.h"
+#include "librm/core/time.hpp"
+#include "librm/core/typedefs.h"
+#include "librm/hal/can_filter.hpp"
+#include "librm/hal/can_interface.h"
+
+namespace rm::hal {
+
+/**
+ * @brief 转发方向
+ */
+enum class CanGatewayDirection {
+  kAToB,
+  kBToA,
+};
+
+/**
+ * @brief  CAN网关，把一个CAN接口上收到的报文按路由规则转发到另一个CAN接口上
+ * @note   典型用法是把低优先级的设备挪到第二条总线上，而主控上的设备类和控制代码不用改：
+ *         @code
+ *         CanGateway gateway(can_main, can_aux);
+ *         gateway.AddRoute(CanGatewayDirection::kAToB, 0x2e, 0x7fe);         // 超级电容的控制帧转发到辅助总线
+ *         gateway.AddRoute(CanGatewayDirection::kBToA, 0x30, 0x7ff, 100.f);  // 超级电容的反馈转发回主总线，最多100Hz
+ *         gateway.Begin();
+ *         @endcode
+ * @note   网关作为CanMonitor挂在两个接口上，一侧的报文有两个来源，都会按路由转发：
+ *         1. 这条总线上别的节点发来的报文(OnRx)
+ *         2. 本机挂在这个接口上的设备发出去的报文(OnTx)，比如上面超级电容的设备类在can_main上发的控制帧
+ *         转发时调用目标接口的WriteLoopback()，报文既发到目标总线上，也交给本机挂在目标接口上的设备，
+ *         所以超级电容的反馈从can_aux转发回来之后，挂在can_main上的设备类照样能收到。
+ *         转发路径上不分配内存、不拷贝报文，也不经过额外的队列
+ * @note   每条路由可以限制转发频率，用的是令牌桶(GCRA)算法，只需要一个原子变量，回调在哪个线程里执行都没有关系
+ * @note   防止环路：转发进某一侧的报文在那一侧还会以OnTx/OnRx的形式出现，所以一帧报文的ID如果匹配某条转发进这一侧的路由，
+ *         就不会再从这一侧转发出去。也就是说同一个ID只能单向经过网关，两个方向的路由不要重叠
+ * @note   路由要在Begin()之前添加好
+ */
+class CanGateway {
+ public:
+  /**
+   * @param a 一侧的CAN接口
+   * @param b 另一侧的CAN接口
+   */
+  CanGateway(CanInterface &a, CanInterface &b)
+      : port_a_(*this, b, CanGatewayDirection::kAToB), port_b_(*this, a, CanGatewayDirection::kBToA), a_(&a), b_(&b) {}
+
+  ~CanGateway() { this->Stop(); }
+
+  // 禁止拷贝构造
+  CanGateway(const CanGateway &) = delete;
+  CanGateway &operator=(const CanGateway &) = delete;
+
+  /**
+   * @brief  添加一条路由规则，一帧报文按添加的顺序匹配，只按第一条匹配上的规则转发
+   * @param  direction   转发方向
+   * @param  id          要转发的报文ID
+   * @param  mask        掩码，(rx_id & mask) == (id & mask)的报文会被转发
+   * @param  max_rate_hz 最多每秒转发多少帧，0表示不限制
+   * @param  burst       限速时最多允许连续转发多少帧
+   * @return 路由编号，用来查询统计信息
+   */
+  usize AddRoute(CanGatewayDirection direction, u16 id, u16 mask, f32 max_rate_hz = 0, u32 burst = 1) {
+    auto route = std::make_unique<Route>();
+    route->direction = direction;
+    route->filter = {id, mask};
+    if (max_rate_hz > 0) {
+      route->interval_us = static_cast<u64>(1e6f / max_rate_hz);
+      route->tolerance_us = route->interval_us * (burst > 0 ? burst - 1 : 0);
+    }
+    this->routes_.push_back(std::move(route));
+    return this->routes_.size() - 1;
+  }
+
+  /**
+   * @brief 开始转发
+   */
+  void Begin() {
+    if (!this->a_->AttachMonitor(this->port_a_) || !this->b_->AttachMonitor(this->port_b_)) {
+      this->Stop();
+#if defined(LIBRM_PLATFORM_LINUX)
+      throw std::runtime_error("Too many CAN monitors");
+#else
+      Throw(std::runtime_error("Too many CAN monitors"));
+#endif
+    }
+  }
+
+  /**
+   * @brief 停止转发
+   */
+  void Stop() {
+    this->a_->DetachMonitor(this->port_a_);
+    this->b_->DetachMonitor(this->port_b_);
+  }
+
+  /**
+   * @return 这条路由转发了多少帧
+   */
+  [[nodiscard]] u32 forwarded_count(usize route) const {
+    return this->routes_.at(route)->forwarded.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @return 这条路由因为超过限速或者目标接口放不下而丢弃了多少帧
+   */
+  [[nodiscard]] u32 dropped_count(usize route) const {
+    return this->routes_.at(route)->dropped.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Route {
+    CanGatewayDirection direction;
+    CanFilter filter;
+    u64 interval_us{0};   // 两帧之间的最小间隔，0表示不限速
+    u64 tolerance_us{0};  // 允许比理论时间提前多少，决定了能连续转发几帧
+    std::atomic<u64> theoretical_arrival_us{0};
+    std::atomic<u32> forwarded{0};
+    std::atomic<u32> dropped{0};
+
+    /**
+     * @brief GCRA限速：每转发一帧，理论到达时间往后推一个间隔；现在离理论到达时间太远说明超速了
+     */
+    bool Admit(u64 now_us) {
+      if (this->interval_us == 0) {
+        return true;
+      }
+      u64 tat = this->theoretical_arrival_us.load(std::memory_order_relaxed);
+      while (true) {
+        const u64 start = tat > now_us ? tat : now_us;
+        if (start - now_us > this->tolerance_us) {
+          return false;
+        }
+        if (this->theoretical_arrival_us.compare_exchange_weak(tat, start + this->interval_us,
+                                                               std::memory_order_relaxed)) {
+          return true;
+        }
+      }
+    }
+  };
+
+  /**
+   * @brief 挂在一侧接口上的监视器，收到报文就交给网关转发到另一侧
+   */
+  class Port final : public CanMonitor {
+   public:
+    Port(CanGateway &gateway, CanInterface &destination, CanGatewayDirection direction)
+        : gateway_(&gateway), destination_(&destination), direction_(direction) {}
+
+    void OnRx(const CanMsg &msg, bool known) override { this->gateway_->Forward(*this, msg); }
+    void OnTx(const CanMsg &msg) override { this->gateway_->Forward(*this, msg); }
+
+   private:
+    friend class CanGateway;
+    CanGateway *gateway_;
+    CanInterface *destination_;
+    CanGatewayDirection direction_;
+  };
+
+  /**
+   * @brief 按第一条匹配的路由转发；ID匹配某条反方向的路由时不转发，防止环路
+   */
+  void Forward(const Port &port, const CanMsg &msg) {
+    Route *route = nullptr;
+    for (const auto &candidate : this->routes_) {
+      if ((msg.rx_std_id & candidate->filter.mask) != (candidate->filter.id & candidate->filter.mask)) {
+        continue;
+      }
+      if (candidate->direction != port.direction_) {
+        return;  // 这个ID是从另一侧转发进来的，不能再转发回去
+      }
+      if (route == nullptr) {
+        route = candidate.get();
+      }
+    }
+    if (route == nullptr) {
+      return;
+    }
+    if (msg.dlc > port.destination_->max_data_length() || !route->Admit(core::time::NowUs())) {
+      route->dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    port.destination_->WriteLoopback(msg.rx_std_id, msg.data.data(), msg.dlc);
+    route->forwarded.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Port port_a_;  // 挂在a上，转发到b
+  Port port_b_;  // 挂在b上，转发到a
+  CanInterface *a_;
+  CanInterface *b_;
+  std::vector<std::unique_ptr<Route>> routes_{};
+};
+
+}  // namespace rm::hal
+
+#endif  // LIBRM_HAL_CAN_GATEWAY_HPP
@@ -28,9 +28,21 @@
 #ifndef LIBRM_HAL_CAN_INTERFACE_H
 #define LIBRM_HAL_CAN_INTERFACE_H
 
+#if defined(LIBRM_PLATFORM_STM32)
+#include "librm/hal/stm32/hal.h"
+#endif
+
+#include "librm/core/exception.h"
+#include "librm/core/time.hpp"
 #include "librm/core/typedefs.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <vector>
+#if defined(LIBRM_PLATFORM_LINUX)
+#include <thread>
+#endif
 
 namespace rm::device {
 class CanDevice;
@@ -38,24 +50,213 @@ class CanDevice;
 
 namespace rm::hal {
 
+/**
+ * @brief 一帧CAN报文最多能携带的数据长度
+ * @note  只有bxCAN的STM32上不可能收发CAN FD帧，保持8字节，避免每个发送队列都多占好几KB的RAM
+ */
+#if defined(LIBRM_PLATFORM_STM32) && !defined(HAL_FDCAN_MODULE_ENABLED)
+constexpr usize kCanMaxDataLength = 8;
+#else
+constexpr usize kCanMaxDataLength = 64;
+#endif
+
 struct CanMsg {
-  std::array<u8, 8> data;
+  std::array<u8, kCanMaxDataLength> data;
   u32 rx_std_id;
-  u32 dlc;
+  u32 dlc;          ///< 数据长度(字节)，CAN FD帧可能是0~8、12、16、20、24、32、48、64
+  bool fd{false};   ///< 是否是CAN FD帧
+  bool brs{false};  ///< CAN FD帧的数据段是否切换到了更高的位速率
+  /**
+   * @brief 接收时间戳(us)，和core::time::NowUs()使用同一个时钟，0表示没有时间戳
+   * @note  可以在RxCallback里用core::time::NowUs() - timestamp_us计算反馈的延迟，或者用相邻两帧的时间差代替固定的控制周期
+   */
+  u64 timestamp_us{0};
+};
+
+/**
+ * @brief  把CAN FD的DLC编码(0~15)转换成数据长度(字节)
+ * @param  dlc DLC编码
+ * @return 数据长度
+ */
+constexpr usize CanDlcToLength(u8 dlc) {
+  constexpr u8 kLength[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+  return kLength[dlc & 0xf];
+}
+
+/**
+ * @brief  把数据长度转换成能装下它的最小的CAN FD DLC编码(0~15)
+ * @param  size 数据长度(字节)，不能超过64
+ * @return DLC编码
+ */
+constexpr u8 CanLengthToDlc(usize size) {
+  if (size <= 8) {
+    return size;
+  }
+  u8 dlc = 9;
+  while (CanDlcToLength(dlc) < size) {
+    ++dlc;
+  }
+  return dlc;
+}
+
+/**
+ * @brief  CAN FD帧只能是几种固定的长度，把数据长度向上取整到能装下它的最短帧长
+ * @param  size 数据长度(字节)，不能超过64
+ * @return 实际的帧数据长度，多出来的字节发送时补0
+ */
+constexpr usize CanFdPaddedLength(usize size) { return CanDlcToLength(CanLengthToDlc(size)); }
+
+/**
+ * @brief  估算一帧经典CAN标准帧在总线上占用的位数，用来估算总线负载率
+ * @note   只适用于经典CAN帧，CAN FD帧的格式不一样，用CanFdFrameBits()
+ * @param  size                 数据长度(字节)，0~8
+ * @param  worst_case_stuffing  是否按最坏情况计入填充位
+ * @return 位数，包括3位帧间隔
+ */
+constexpr usize CanFrameBits(usize size, bool worst_case_stuffing = true) {
+  // SOF(1) + ID(11) + RTR(1) + IDE(1) + r0(1) + DLC(4) + 数据 + CRC(15)，这一段需要位填充
+  const usize stuffed = 34 + 8 * size;
+  // CRC界定符(1) + ACK(2) + EOF(7) + 帧间隔(3)
+  return stuffed + 13 + (worst_case_stuffing ? (stuffed - 1) / 4 : 0);
+}
+
+/**
+ * @brief CAN FD帧的位数，开了BRS时数据段按数据段位速率传输，要分开算
+ */
+struct CanFdFrameBitCount {
+  usize nominal;  ///< 按仲裁段位速率传输的位数
+  usize data;     ///< 按数据段位速率传输的位数，没开BRS时是0，全部计入nominal
+
+  /**
+   * @return 这一帧在总线上占用的时间(s)
+   */
+  [[nodiscard]] constexpr f32 seconds(u32 bitrate, u32 data_bitrate) const {
+    return static_cast<f32>(this->nominal) / static_cast<f32>(bitrate) +
+           (this->data == 0 ? 0.f : static_cast<f32>(this->data) / static_cast<f32>(data_bitrate));
+  }
+};
+
+/**
+ * @brief  估算一帧CAN FD标准帧在总线上占用的位数
+ * @note   按ISO 11898-1:2015的帧格式：数据不超过16字节时用CRC17，否则用CRC21；
+ *         CRC段前面有4位填充计数，它和CRC一起每4位插入一个固定填充位，其余部分按动态填充算
+ * @param  size                 数据长度(字节)，会向上取整到CAN FD的帧长
+ * @param  brs                  是否开了BRS，开了的话从BRS到CRC段结束按数据段位速率传输
+ * @param  worst_case_stuffing  是否按最坏情况计入动态填充位
+ * @return 两种位速率下各自的位数，包括3位帧间隔
+ */
+constexpr CanFdFrameBitCount CanFdFrameBits(usize size, bool brs, bool worst_case_stuffing = true) {
+  size = CanFdPaddedLength(size);
+  // 仲裁段：SOF(1) + ID(11) + RRS(1) + IDE(1) + FDF(1) + res(1) + BRS(1)，需要动态填充
+  constexpr usize kArbitration = 17;
+  // 数据段：ESI(1) + DLC(4) + 数据，需要动态填充
+  const usize data = 5 + 8 * size;
+  // 填充计数(4) + CRC(17/21) + 固定填充位(6/7)
+  const usize crc = size <= 16 ? 4 + 17 + 6 : 4 + 21 + 7;
+  // CRC界定符(1) + ACK(1) + ACK界定符(1) + EOF(7) + 帧间隔(3)
+  constexpr usize kTail = 13;
+
+  const usize arbitration_stuffing = worst_case_stuffing ? (kArbitration - 1) / 4 : 0;
+  const usize data_stuffing = worst_case_stuffing ? (kArbitration + data - 1) / 4 - arbitration_stuffing : 0;
+  const usize nominal = kArbitration + arbitration_stuffing + kTail;
+  const usize fast = data + data_stuffing + crc;
+  if (brs) {
+    return {nominal, fast};
+  }
+  return {nominal + fast, 0};
+}
+
+/**
+ * @brief 总线上一路周期性报文，设备在构造时声明，用来在启动时估算总线负载
+ */
+struct CanTrafficDecl {
+  u16 id;
+  usize size;   ///< 数据长度(字节)
+  f32 rate_hz;  ///< 每秒多少帧
 };
 
+/**
+ * @brief CAN发送优先级，数值越大优先级越高
+ */
 enum class CanTxPriority {
   kLow,
   kNormal,
   kHigh,
 };
 
+/**
+ * @brief CAN控制器的错误状态，由发送/接收错误计数器(TEC/REC)决定
+ */
+enum class CanBusState {
+  kErrorActive,   ///< 正常
+  kErrorWarning,  ///< 有一个错误计数器超过了96
+  kErrorPassive,  ///< 有一个错误计数器超过了127，只能发隐性的错误帧
+  kBusOff,        ///< TEC超过了255，控制器离线，不能收发
+};
+
+/**
+ * @brief CAN控制器的错误计数
+ */
+struct CanErrorCounters {
+  CanBusState state;
+  u32 tx_error_count;   ///< 发送错误计数器(TEC)
+  u32 rx_error_count;   ///< 接收错误计数器(REC)
+  u32 error_frames;     ///< 收到的错误帧/错误中断的次数
+  u32 bus_off_count;    ///< 进入bus-off的次数
+  u32 restart_count;    ///< 从bus-off自动恢复的次数
+  u32 tx_flushed;       ///< 因为bus-off被清掉的发送队列里的报文数量
+};
+
+/**
+ * @brief CAN总线监视器，挂到CanInterface上之后，收发的每一帧都会通知它
+ * @note  回调可能在中断、接收线程或者调用Write/Enqueue的线程里执行，实现里不能阻塞，多个线程同时调用也要是安全的
+ */
+class CanMonitor {
+ public:
+  virtual ~CanMonitor() = default;
+
+  /**
+   * @brief 收到一帧报文
+   * @param msg   报文
+   * @param known 是否有设备注册了这个ID
+   */
+  virtual void OnRx(const CanMsg &msg, bool known) {}
+
+  /**
+   * @brief 接收队列满了，一帧报文没有交给设备就被丢弃了
+   */
+  virtual void OnRxDrop(const CanMsg &msg) {}
+
+  /**
+   * @brief 一帧报文已经交给了硬件或者内核
+   */
+  virtual void OnTx(const CanMsg &msg) {}
+
+  /**
+   * @brief 发送队列满了或者发送失败，一帧报文被丢弃了
+   */
+  virtual void OnTxDrop(const CanMsg &msg) {}
+
+  /**
+   * @brief 发送队列里的报文数量变化了
+   * @param depth 当前发送队列里的报文数量
+   */
+  virtual void OnTxQueueDepth(usize depth) {}
+
+  /**
+   * @brief 控制器的错误状态变化了，比如进入bus-off或者从bus-off恢复
+   * @param state 新的状态
+   */
+  virtual void OnBusStateChange(CanBusState state) {}
+};
+
 /**
  * @brief CAN接口类
  * @note  借助CanDeviceBase类使用观察者模式实现回调机制
  */
 class CanInterface {
   friend class device::CanDevice;
+  friend class CanTxScheduler;  // 调度器要把设备转注册到被包装的接口上
 
  public:
   virtual ~CanInterface() = default;
@@ -64,10 +265,31 @@ class CanInterface {
    * @brief 立即向总线上发送数据
    * @param id      数据帧ID
    * @param data    数据指针
-   * @param size    数据长度
+   * @param size    数据长度，超过8字节时以CAN FD帧发送，不能超过max_data_length()
    */
   virtual void Write(u16 id, const u8 *data, usize size) = 0;
 
+  /**
+   * @brief 向总线上发送数据，同时把这帧报文当作从总线上收到的，交给这个接口上注册的设备和监视器的OnRx
+   * @note  普通的Write()发出去的报文，挂在同一个接口上的设备是收不到的；CanGateway把另一条总线上的报文转发过来时，
+   *        本机挂在这个接口上的设备也要收到，所以用这个函数。设备回调和正常接收时在同一个上下文里调用
+   * @note  默认实现是Write()之后在调用者的线程里用DispatchLoopback()做软件投递；
+   *        能做得更好的接口(比如SocketCan借内核回环、STM32和接收中断共用一条路径)会重写这个函数
+   * @param id      数据帧ID
+   * @param data    数据指针
+   * @param size    数据长度，超过8字节时以CAN FD帧发送，不能超过max_data_length()
+   */
+  virtual void WriteLoopback(u16 id, const u8 *data, usize size) {
+    this->Write(id, data, size);
+    CanMsg msg{};
+    msg.rx_std_id = id;
+    msg.dlc = static_cast<u32>(size);
+    msg.fd = size > 8;
+    std::copy_n(data, size, msg.data.begin());
+    msg.timestamp_us = core::time::NowUs();
+    this->DispatchLoopback(msg);
+  }
+
   /***
    * @brief 从消息队列里取出一条消息发送
    */
@@ -77,7 +299,7 @@ class CanInterface {
    * @brief 向消息队列里加入一条消息
    * @param id        数据帧ID
    * @param data      数据指针
-   * @param size      数据长度
+   * @param size      数据长度，超过8字节时以CAN FD帧发送，不能超过max_data_length()
    * @param priority  消息的优先级
    */
   virtual void Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority /*=CanTxPriority::kNormal*/) = 0;
@@ -99,12 +321,186 @@ class CanInterface {
    */
   virtual void Stop() = 0;
 
+  /**
+   * @return 一帧报文最多能发送多少字节，支持CAN FD的接口返回64，设备可以据此把多条命令打包进同一帧
+   */
+  [[nodiscard]] virtual usize max_data_length() const { return 8; }
+
+  /**
+   * @return 控制器的错误状态和错误计数，不支持的接口全部返回0
+   * @note   进入bus-off时，软件发送队列里还没发出去的报文会被全部丢弃(计入tx_flushed并通知OnTxDrop)，
+   *         因为排队的大多是周期性的控制帧，恢复之后再发过期的指令比不发更危险；恢复后从新写入的报文开始发送
+   */
+  [[nodiscard]] virtual CanErrorCounters error_counters() const { return {}; }
+
+  /**
+   * @brief  挂上一个总线监视器
+   * @note   最多同时挂kMaxMonitors个；监视器的生命周期要比这个接口长，或者在销毁前先DetachMonitor
+   * @param  monitor 监视器
+   * @return 监视器已经挂满时返回false
+   */
+  bool AttachMonitor(CanMonitor &monitor) {
+    for (auto &slot : this->monitors_) {
+      CanMonitor *expected = nullptr;
+      if (slot.compare_exchange_strong(expected, &monitor, std::memory_order_acq_rel)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief 取下一个总线监视器
+   * @note  会等正在执行中的回调结束才返回，返回之后监视器不会再收到回调，可以放心析构；
+   *        所以不能在这个接口的监视器回调里调用，否则会一直等自己
+   */
+  void DetachMonitor(CanMonitor &monitor) {
+    for (usize i = 0; i < kMaxMonitors; ++i) {
+      CanMonitor *expected = &monitor;
+      if (!this->monitors_[i].compare_exchange_strong(expected, nullptr, std::memory_order_seq_cst)) {
+        continue;
+      }
+      while (this->monitor_users_[i].load(std::memory_order_seq_cst) != 0) {
+#if defined(LIBRM_PLATFORM_LINUX)
+        std::this_thread::yield();
+#endif
+      }
+    }
+  }
+
+  static constexpr usize kMaxMonitors = 4;
+
+  /**
+   * @brief 接收快速路径，返回true表示这帧报文已经处理完了
+   */
+  using RxFastPath = bool (*)(void *context, const CanMsg &msg);
+
+  /**
+   * @brief 设置接收快速路径，收到报文时先交给它，它没处理的报文才按ID查设备表、调用设备的虚函数
+   * @note  给device::CanDeviceSet用的，要在Begin()之前设置；一个接口只能有一条快速路径，已经设置过时抛出异常
+   */
+  virtual void SetRxFastPath(RxFastPath fast_path, void *context) {
+    if (this->rx_fast_path_ != nullptr) {
+      Throw(std::runtime_error("CAN rx fast path is already set"));
+      return;
+    }
+    this->rx_fast_path_ = fast_path;
+    this->rx_fast_path_context_ = context;
+  }
+
+  /**
+   * @brief 取消接收快速路径
+   * @param context 设置时传入的context，和当前快速路径的不一样时什么也不做，防止把别人设置的快速路径取消掉
+   */
+  virtual void ClearRxFastPath(const void *context) {
+    if (this->rx_fast_path_context_ != context) {
+      return;
+    }
+    this->rx_fast_path_ = nullptr;
+    this->rx_fast_path_context_ = nullptr;
+  }
+
+  /**
+   * @brief 声明这条总线上的一路周期性报文(收发都算)，CanBusPlanner会根据声明的报文估算总线负载
+   * @note  设备类会在构造时按典型的频率声明自己的报文；同一个ID再次声明时覆盖原来的声明，
+   *        所以实际频率和默认值不一样时，可以在构造设备之后用这个函数改掉
+   * @note  包装其他接口的类(比如CanTxScheduler)要重写这个函数和declared_traffic()，把声明转给被包装的接口
+   * @param id      标准帧ID
+   * @param size    数据长度(字节)
+   * @param rate_hz 每秒多少帧，0表示这个ID不计入负载
+   */
+  virtual void DeclareTraffic(u16 id, usize size, f32 rate_hz) {
+    for (auto &traffic : this->declared_traffic_) {
+      if (traffic.id == id) {
+        traffic.size = size;
+        traffic.rate_hz = rate_hz;
+        return;
+      }
+    }
+    this->declared_traffic_.push_back({id, size, rate_hz});
+  }
+
+  /**
+   * @return 这条总线上声明过的所有周期性报文
+   */
+  [[nodiscard]] virtual const std::vector<CanTrafficDecl> &declared_traffic() const { return this->declared_traffic_; }
+
  protected:
   /**
    * @brief 注册CAN设备
    * @param device 设备对象
    */
   virtual void RegisterDevice(device::CanDevice &device, u32 rx_stdid) = 0;
+
+  /**
+   * @brief WriteLoopback()默认实现里的软件投递，把报文交给接收快速路径和监视器
+   * @note  基类没有按ID的设备表，有自己设备表的接口应该重写这个函数，像收到报文一样查表调用设备的RxCallback()
+   */
+  virtual void DispatchLoopback(const CanMsg &msg) {
+    const bool known = this->TryRxFastPath(msg);
+    this->ReportRx(msg, known);
+  }
+
+  /**
+   * @brief 把事件转发给所有挂着的监视器，没有监视器时只有几次原子读的开销
+   * @note  调用回调期间给这个槽位的monitor_users_加一，DetachMonitor()借此等待回调结束；
+   *        加一之后要重新读一次槽位，和DetachMonitor()先清槽位再读计数配对，两边都用seq_cst
+   */
+  template <typename Fn>
+  void NotifyMonitors(Fn &&fn) const {
+    for (usize i = 0; i < kMaxMonitors; ++i) {
+      if (this->monitors_[i].load(std::memory_order_relaxed) == nullptr) {
+        continue;
+      }
+      this->monitor_users_[i].fetch_add(1, std::memory_order_seq_cst);
+      if (CanMonitor *monitor = this->monitors_[i].load(std::memory_order_seq_cst)) {
+        fn(*monitor);
+      }
+      this->monitor_users_[i].fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  [[nodiscard]] bool has_monitors() const {
+    for (const auto &slot : this->monitors_) {
+      if (slot.load(std::memory_order_relaxed) != nullptr) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @return 快速路径处理了这帧报文时返回true
+   */
+  bool TryRxFastPath(const CanMsg &msg) const {
+    return this->rx_fast_path_ != nullptr && this->rx_fast_path_(this->rx_fast_path_context_, msg);
+  }
+
+  void ReportRx(const CanMsg &msg, bool known) const {
+    this->NotifyMonitors([&](CanMonitor &monitor) { monitor.OnRx(msg, known); });
+  }
+  void ReportRxDrop(const CanMsg &msg) const {
+    this->NotifyMonitors([&](CanMonitor &monitor) { monitor.OnRxDrop(msg); });
+  }
+  void ReportTx(const CanMsg &msg) const {
+    this->NotifyMonitors([&](CanMonitor &monitor) { monitor.OnTx(msg); });
+  }
+  void ReportTxDrop(const CanMsg &msg) const {
+    this->NotifyMonitors([&](CanMonitor &monitor) { monitor.OnTxDrop(msg); });
+  }
+  void ReportTxQueueDepth(usize depth) const {
+    this->NotifyMonitors([&](CanMonitor &monitor) { monitor.OnTxQueueDepth(depth); });
+  }
+  void ReportBusState(CanBusState state) const {
+    this->NotifyMonitors([&](CanMonitor &monitor) { monitor.OnBusStateChange(state); });
+  }
+
+ private:
+  std::array<std::atomic<CanMonitor *>, kMaxMonitors> monitors_{};
+  mutable std::array<std::atomic<u32>, kMaxMonitors> monitor_users_{};  // 每个槽位正在执行的回调数量
+  std::vector<CanTrafficDecl> declared_traffic_{};
+  RxFastPath rx_fast_path_{nullptr};
+  void *rx_fast_path_context_{nullptr};
 };
 
 }  // namespace rm::hal
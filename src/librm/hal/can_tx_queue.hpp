@@ -0,0 +1,163 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/can_tx_queue.hpp
+ * @brief 按优先级划分的定长CAN发送队列
+ */
+
+#ifndef LIBRM_HAL_CAN_TX_QUEUE_HPP
+#define LIBRM_HAL_CAN_TX_QUEUE_HPP
+
+#include <array>
+
+#include "librm/core/typedefs.h"
+#include "librm/hal/can_interface.h"
+
+namespace rm::hal {
+
+/**
+ * @brief 发送队列满了的时候丢弃哪一帧
+ */
+enum class CanTxDropPolicy {
+  kDropNewest,       ///< 丢弃新来的报文，已经在排队的报文不受影响
+  kDropOldest,       ///< 丢弃同一优先级里最早入队的报文，给新报文腾位置
+  kDropOldestPerId,  ///< 同一优先级里已经有同一ID的报文在排队时，直接用新数据覆盖它(保留原来的排队位置)；
+                     ///< 否则队列满时按kDropOldest处理。适合电机控制这种只关心最新值的报文
+};
+
+/**
+ * @brief  按优先级划分的定长CAN发送队列
+ * @note   每个优先级各有一个容量为kCapacity的环形缓冲区，所有存储空间都在对象内部，入队出队不会分配内存
+ * @note   出队时严格按照 高->普通->低 的顺序，只有高优先级队列空了才会发送低优先级的报文
+ * @note   这个类本身不是线程安全的，由持有它的CAN外设类负责加锁或者关中断
+ * @tparam kCapacity 每个优先级队列的容量
+ */
+template <usize kCapacity>
+class CanTxQueue {
+ public:
+  explicit CanTxQueue(CanTxDropPolicy policy = CanTxDropPolicy::kDropNewest) : policy_(policy) {}
+
+  /**
+   * @brief  把一条报文加入对应优先级的队尾
+   * @param  msg       报文
+   * @param  priority  优先级
+   * @param  dropped   可选，有报文被丢弃时把被丢弃的那一帧(可能是msg本身，也可能是被挤掉的旧报文)写到这里
+   * @return 没有丢弃任何报文时返回true；否则返回false，并计入这个优先级的丢弃计数
+   */
+  bool Push(const CanMsg &msg, CanTxPriority priority, CanMsg *dropped = nullptr) {
+    Ring &ring = this->rings_[Index(priority)];
+    if (this->policy_ == CanTxDropPolicy::kDropOldestPerId) {
+      for (usize i = 0; i < ring.count; ++i) {
+        CanMsg &queued = ring.buffer[(ring.head + i) % kCapacity];
+        if (queued.rx_std_id == msg.rx_std_id) {
+          if (dropped != nullptr) {
+            *dropped = queued;
+          }
+          queued = msg;
+          ++this->dropped_[Index(priority)];
+          return false;
+        }
+      }
+    }
+    if (ring.count == kCapacity) {
+      ++this->dropped_[Index(priority)];
+      if (this->policy_ == CanTxDropPolicy::kDropNewest) {
+        if (dropped != nullptr) {
+          *dropped = msg;
+        }
+        return false;
+      }
+      if (dropped != nullptr) {
+        *dropped = ring.buffer[ring.head];
+      }
+      ring.buffer[ring.head] = msg;
+      ring.head = (ring.head + 1) % kCapacity;
+      return false;
+    }
+    ring.buffer[(ring.head + ring.count) % kCapacity] = msg;
+    ++ring.count;
+    return true;
+  }
+
+  /**
+   * @brief  按优先级从高到低取出一条报文
+   * @param  msg 取出的报文
+   * @return 所有队列都为空时返回false
+   */
+  bool Pop(CanMsg &msg) {
+    for (usize i = kNumPriorities; i-- > 0;) {
+      Ring &ring = this->rings_[i];
+      if (ring.count == 0) {
+        continue;
+      }
+      msg = ring.buffer[ring.head];
+      ring.head = (ring.head + 1) % kCapacity;
+      --ring.count;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief 清空所有队列
+   */
+  void Clear() {
+    for (auto &ring : this->rings_) {
+      ring.head = 0;
+      ring.count = 0;
+    }
+  }
+
+  [[nodiscard]] usize size() const {
+    usize total = 0;
+    for (const auto &ring : this->rings_) {
+      total += ring.count;
+    }
+    return total;
+  }
+  [[nodiscard]] usize size(CanTxPriority priority) const { return this->rings_[Index(priority)].count; }
+  [[nodiscard]] bool empty() const { return this->size() == 0; }
+  [[nodiscard]] usize dropped(CanTxPriority priority) const { return this->dropped_[Index(priority)]; }
+  [[nodiscard]] static constexpr usize capacity() { return kCapacity; }
+
+  void set_drop_policy(CanTxDropPolicy policy) { this->policy_ = policy; }
+  [[nodiscard]] CanTxDropPolicy drop_policy() const { return this->policy_; }
+
+ private:
+  struct Ring {
+    std::array<CanMsg, kCapacity> buffer{};
+    usize head{0};
+    usize count{0};
+  };
+
+  static constexpr usize kNumPriorities = 3;
+  static constexpr usize Index(CanTxPriority priority) { return static_cast<usize>(priority); }
+
+  std::array<Ring, kNumPriorities> rings_{};  // 下标为CanTxPriority的值，越大优先级越高
+  std::array<usize, kNumPriorities> dropped_{};
+  CanTxDropPolicy policy_;
+};
+
+}  // namespace rm::hal
+
+#endif  // LIBRM_HAL_CAN_TX_QUEUE_HPP
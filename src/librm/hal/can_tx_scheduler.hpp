@@ -0,0 +1,233 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/can_tx_scheduler.hpp
+ * @brief 时间触发的CAN发送调度器
+ */
+
+#ifndef LIBRM_HAL_CAN_TX_SCHEDULER_HPP
+#define LIBRM_HAL_CAN_TX_SCHEDULER_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "librm/core/time.hpp"
+#include "librm/core/typedefs.h"
+#include "librm/hal/can_device_table.hpp"
+#include "librm/hal/can_interface.h"
+
+namespace rm::hal {
+
+/**
+ * @brief  时间触发的CAN发送调度器
+ * @note   DjiMotor<>::SendCommand()、DmMotor::SetPosition()这些函数被调用时会立刻发送报文，
+ *         不同的控制任务各自调用时，报文会挤在一起发出，还会和电机的反馈撞在一起，总线负载一阵一阵的。
+ *         调度器包装一个CAN接口，为每个控制报文ID分配一个周期性的发送时隙：
+ *         设备调用Write()时只是把最新的数据暂存起来，等到这个ID的时隙到了，再由Poll()统一发出去。
+ *         这样总线负载是均匀的，从调用SendCommand()到报文上总线的延迟不会超过一个周期
+ * @note   没有分配时隙的ID，以及Enqueue()的报文，仍然直接交给被包装的CAN接口
+ * @note   同一个时隙里如果暂存了好几次，只会发出最后一次的数据
+ * @note   用法：
+ *         @code
+ *         rm::hal::CanTxScheduler scheduler{can1};
+ *         rm::device::M3508 motor{scheduler, 1};   // 设备构造在调度器上，而不是直接构造在can1上
+ *         scheduler.AddSlot(0x200, 1000, 0);       // 0x200每1ms发一次，在周期开始时发
+ *         scheduler.AddSlot(0x1ff, 1000, 500);     // 0x1ff错开半个周期
+ *         // 在定时器中断或者一个循环里，以比时隙间隔更短的周期调用
+ *         scheduler.Poll();
+ *         @endcode
+ * @note   每个ID只能有一个写者(一般就是调用SendCommand的那个控制任务)，Poll()可以在另一个线程或者中断里调用
+ */
+class CanTxScheduler final : public CanInterface {
+ public:
+  /**
+   * @param can 被包装的CAN接口
+   */
+  explicit CanTxScheduler(CanInterface &can) : can_(&can) {}
+
+  // 禁止拷贝构造
+  CanTxScheduler(const CanTxScheduler &) = delete;
+  CanTxScheduler &operator=(const CanTxScheduler &) = delete;
+
+  /**
+   * @brief  为一个ID分配周期性的发送时隙，要在开始Poll()之前调用
+   * @param  id         报文ID
+   * @param  period_us  发送周期(us)
+   * @param  offset_us  在周期内的偏移(us)，用来把不同的报文组错开
+   * @return ID已经有时隙或者参数不对时返回false
+   */
+  bool AddSlot(u16 id, u32 period_us, u32 offset_us = 0) {
+    if (period_us == 0 || offset_us >= period_us || this->index_.Find(id) != nullptr) {
+      return false;
+    }
+    auto slot = std::make_unique<Slot>();
+    slot->id = id;
+    slot->period_us = period_us;
+    slot->offset_us = offset_us;
+    if (!this->index_.Insert(id, slot.get())) {
+      return false;
+    }
+    // 按偏移排序，同一次Poll()里到期的报文按时间表的顺序发出
+    auto position = std::upper_bound(this->slots_.begin(), this->slots_.end(), offset_us,
+                                     [](u32 offset, const auto &other) { return offset < other->offset_us; });
+    this->slots_.insert(position, std::move(slot));
+    return true;
+  }
+
+  /**
+   * @brief 把到期的时隙里暂存的报文发出去
+   * @param now_us 当前时间(us)
+   */
+  void Poll(u64 now_us) {
+    if (!this->started_) {
+      // 第一次调用时对齐时间表的起点
+      for (auto &slot : this->slots_) {
+        slot->next_due_us = now_us + slot->offset_us;
+      }
+      this->started_ = true;
+    }
+    for (auto &slot : this->slots_) {
+      if (now_us < slot->next_due_us) {
+        continue;
+      }
+      if (slot->staged.exchange(false, std::memory_order_acq_rel)) {
+        CanMsg msg;
+        if (!slot->Load(msg)) {
+          // 正好在写，下一次Poll()时再试
+          slot->staged.store(true, std::memory_order_relaxed);
+          continue;
+        }
+        this->can_->Write(slot->id, msg.data.data(), msg.dlc);
+      } else {
+        slot->idle_count.fetch_add(1, std::memory_order_relaxed);
+      }
+      // 错过了好几个周期的话直接跳到下一个周期，不补发
+      slot->next_due_us += (now_us - slot->next_due_us) / slot->period_us * slot->period_us + slot->period_us;
+    }
+  }
+
+  /**
+   * @brief 用core::time::NowUs()作为当前时间调用Poll(u64)
+   */
+  void Poll() { this->Poll(core::time::NowUs()); }
+
+  /**
+   * @brief 分配了时隙的ID只暂存数据，等时隙到了再发；其他ID直接发送
+   */
+  void Write(u16 id, const u8 *data, usize size) override {
+    Slot *slot = this->index_.Find(id);
+    if (slot == nullptr) {
+      this->can_->Write(id, data, size);
+      return;
+    }
+    slot->Store(data, std::min(size, kCanMaxDataLength));
+  }
+
+  /**
+   * @brief 转发过来的报文不占用时隙，直接交给被包装的接口
+   */
+  void WriteLoopback(u16 id, const u8 *data, usize size) override { this->can_->WriteLoopback(id, data, size); }
+
+  void Write() override { this->can_->Write(); }
+
+  void Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) override {
+    this->can_->Enqueue(id, data, size, priority);
+  }
+
+  void SetFilter(u16 id, u16 mask) override { this->can_->SetFilter(id, mask); }
+
+  void Begin() override { this->can_->Begin(); }
+
+  void Stop() override { this->can_->Stop(); }
+
+  [[nodiscard]] usize max_data_length() const override { return this->can_->max_data_length(); }
+  [[nodiscard]] CanErrorCounters error_counters() const override { return this->can_->error_counters(); }
+
+  void DeclareTraffic(u16 id, usize size, f32 rate_hz) override { this->can_->DeclareTraffic(id, size, rate_hz); }
+  void SetRxFastPath(RxFastPath fast_path, void *context) override { this->can_->SetRxFastPath(fast_path, context); }
+  void ClearRxFastPath(const void *context) override { this->can_->ClearRxFastPath(context); }
+  [[nodiscard]] const std::vector<CanTrafficDecl> &declared_traffic() const override {
+    return this->can_->declared_traffic();
+  }
+
+  /**
+   * @return 一个ID的时隙到了但是没有暂存数据、什么也没发的次数，可以用来发现控制任务跟不上发送周期
+   */
+  [[nodiscard]] u32 idle_count(u16 id) const {
+    const Slot *slot = this->index_.Find(id);
+    return slot == nullptr ? 0 : slot->idle_count.load(std::memory_order_relaxed);
+  }
+
+ private:
+  /**
+   * @brief 一个ID的发送时隙，暂存的数据用seqlock保护，写者和Poll()之间不需要锁
+   */
+  struct Slot {
+    u16 id;
+    u32 period_us;
+    u32 offset_us;
+    u64 next_due_us{0};
+    std::atomic<u32> idle_count{0};
+    std::atomic<u32> sequence{0};  // 奇数表示正在写
+    std::atomic<bool> staged{false};
+    std::array<u8, kCanMaxDataLength> data{};
+    usize size{0};
+
+    void Store(const u8 *src, usize n) {
+      const u32 seq = this->sequence.load(std::memory_order_relaxed);
+      this->sequence.store(seq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      std::copy_n(src, n, this->data.begin());
+      this->size = n;
+      this->sequence.store(seq + 2, std::memory_order_release);
+      this->staged.store(true, std::memory_order_release);
+    }
+
+    bool Load(CanMsg &msg) const {
+      const u32 seq = this->sequence.load(std::memory_order_acquire);
+      if (seq & 1) {
+        return false;
+      }
+      msg.dlc = this->size;
+      std::copy_n(this->data.begin(), msg.dlc, msg.data.begin());
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return this->sequence.load(std::memory_order_relaxed) == seq;
+    }
+  };
+
+  void RegisterDevice(device::CanDevice &device, u32 rx_stdid) override {
+    this->can_->RegisterDevice(device, rx_stdid);
+  }
+
+  CanInterface *can_;
+  std::vector<std::unique_ptr<Slot>> slots_{};
+  CanDeviceTable<Slot> index_{};
+  bool started_{false};
+};
+
+}  // namespace rm::hal
+
+#endif  // LIBRM_HAL_CAN_TX_SCHEDULER_HPP
@@ -0,0 +1,453 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/can_log.cc
+ * @brief CAN报文的录制和回放，兼容candump的log格式
+ */
+
+#include "can_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <linux/can.h>
+
+#include "librm/core/time.hpp"
+
+namespace rm::hal::linux_ {
+
+namespace {
+
+/**
+ * @brief 二进制格式的文件头，后面跟着u32的版本号和u32的保留字段
+ * @note  每条记录是 u64时间戳(us) + u32 ID + u8数据长度 + u8标志位 + 数据，都按小端(本机)字节序存储
+ */
+constexpr char kBinaryMagic[8] = {'R', 'M', 'C', 'A', 'N', 'L', 'O', 'G'};
+constexpr u32 kBinaryVersion = 1;
+
+enum BinaryFlags : u8 {
+  kFlagFd = 1 << 0,
+  kFlagBrs = 1 << 1,
+  kFlagTx = 1 << 2,
+};
+
+/**
+ * @brief 把一个十六进制字符转成数值，不是十六进制字符时返回-1
+ */
+int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * @brief  解析一行candump log，格式是"(秒.微秒) 接口名 ID#数据"，CAN FD帧是"ID##标志位数据"
+ * @return 格式不对或者是远程帧时返回false
+ */
+bool ParseCandumpLine(const std::string &line, CanLogEntry &entry) {
+  unsigned long long sec, usec;
+  int frame_offset = 0;
+  if (std::sscanf(line.c_str(), " (%llu.%llu) %*s %n", &sec, &usec, &frame_offset) != 2 || frame_offset == 0) {
+    return false;
+  }
+  const char *p = line.c_str() + frame_offset;
+
+  u32 id = 0;
+  for (; *p != '#'; ++p) {
+    const int value = HexValue(*p);
+    if (value < 0) {
+      return false;
+    }
+    id = (id << 4) | value;
+  }
+  ++p;
+
+  CanMsg &msg = entry.msg;
+  msg = CanMsg{};
+  msg.rx_std_id = id;
+  msg.timestamp_us = sec * 1000000ull + usec;
+  entry.tx = false;
+  if (*p == 'R') {
+    return false;  // 远程帧，设备用不到
+  }
+  if (*p == '#') {
+    const int flags = HexValue(p[1]);
+    if (flags < 0) {
+      return false;
+    }
+    msg.fd = true;
+    msg.brs = flags & CANFD_BRS;
+    p += 2;
+  }
+  usize size = 0;
+  for (; HexValue(p[0]) >= 0 && HexValue(p[1]) >= 0; p += 2) {
+    if (size == msg.data.size()) {
+      return false;
+    }
+    msg.data[size++] = HexValue(p[0]) << 4 | HexValue(p[1]);
+  }
+  msg.dlc = size;
+  return true;
+}
+
+}  // namespace
+
+/**
+ * @param path 录制文件路径，candump格式和二进制格式都可以
+ */
+CanLogReader::CanLogReader(const std::string &path) : file_(path, std::ios::binary) {
+  if (!this->file_) {
+    throw std::runtime_error("Failed to open CAN log: " + path);
+  }
+  char magic[sizeof(kBinaryMagic)]{};
+  this->file_.read(magic, sizeof(magic));
+  if (this->file_.gcount() == sizeof(magic) && std::memcmp(magic, kBinaryMagic, sizeof(magic)) == 0) {
+    u32 header[2];
+    this->file_.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (header[0] != kBinaryVersion) {
+      throw std::runtime_error("Unsupported CAN log version: " + path);
+    }
+    this->format_ = CanLogFormat::kBinary;
+  } else {
+    this->file_.clear();
+    this->file_.seekg(0);
+    this->format_ = CanLogFormat::kCandump;
+  }
+}
+
+/**
+ * @brief  读取下一条记录，candump格式里解析不了的行会被跳过
+ * @param  entry 读出的记录
+ * @return 文件读完时返回false
+ */
+bool CanLogReader::Next(CanLogEntry &entry) {
+  if (this->format_ == CanLogFormat::kCandump) {
+    while (std::getline(this->file_, this->line_)) {
+      if (ParseCandumpLine(this->line_, entry)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  u64 timestamp_us;
+  u32 id;
+  u8 size_and_flags[2];
+  this->file_.read(reinterpret_cast<char *>(&timestamp_us), sizeof(timestamp_us));
+  this->file_.read(reinterpret_cast<char *>(&id), sizeof(id));
+  this->file_.read(reinterpret_cast<char *>(size_and_flags), sizeof(size_and_flags));
+  if (!this->file_ || size_and_flags[0] > kCanMaxDataLength) {
+    return false;
+  }
+  entry.msg = CanMsg{};
+  this->file_.read(reinterpret_cast<char *>(entry.msg.data.data()), size_and_flags[0]);
+  if (!this->file_) {
+    return false;
+  }
+  entry.msg.rx_std_id = id;
+  entry.msg.dlc = size_and_flags[0];
+  entry.msg.fd = size_and_flags[1] & kFlagFd;
+  entry.msg.brs = size_and_flags[1] & kFlagBrs;
+  entry.msg.timestamp_us = timestamp_us;
+  entry.tx = size_and_flags[1] & kFlagTx;
+  return true;
+}
+
+/**
+ * @param path            录制文件路径，已经存在的文件会被覆盖
+ * @param format          录制文件的格式
+ * @param interface_name  candump格式里记录的接口名，回放时可以用canplayer的"can0=vcan0"重新映射
+ * @param record_tx       是否录制本机发出的报文
+ */
+CanRecorder::CanRecorder(const std::string &path, CanLogFormat format, std::string interface_name, bool record_tx)
+    : file_(path, std::ios::binary | std::ios::trunc),
+      format_(format),
+      interface_name_(std::move(interface_name)),
+      record_tx_(record_tx) {
+  if (!this->file_) {
+    throw std::runtime_error("Failed to create CAN log: " + path);
+  }
+  if (this->format_ == CanLogFormat::kBinary) {
+    const u32 header[2] = {kBinaryVersion, 0};
+    this->file_.write(kBinaryMagic, sizeof(kBinaryMagic));
+    this->file_.write(reinterpret_cast<const char *>(header), sizeof(header));
+  }
+  this->pending_.reserve(1024);
+  this->writer_thread_ = std::thread(&CanRecorder::WriterThread, this);
+}
+
+/**
+ * @note 析构前要先从CAN接口上DetachMonitor(它会等正在执行的回调结束)，析构时会把缓冲区里剩下的报文写完
+ */
+CanRecorder::~CanRecorder() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->running_ = false;
+  }
+  this->cv_.notify_one();
+  this->writer_thread_.join();
+  this->file_.flush();
+}
+
+void CanRecorder::OnRx(const CanMsg &msg, bool known) { this->Push(msg, false); }
+
+void CanRecorder::OnTx(const CanMsg &msg) {
+  if (this->record_tx_) {
+    this->Push(msg, true);
+  }
+}
+
+/**
+ * @brief 等待缓冲区里的报文全部写进文件
+ */
+void CanRecorder::Flush() {
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  this->flushed_cv_.wait(lock, [this] { return this->pending_.empty() && !this->writing_; });
+  this->file_.flush();
+}
+
+void CanRecorder::Push(const CanMsg &msg, bool tx) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (this->pending_.size() >= CanRecorder::kMaxPending) {
+      this->dropped_count_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    this->pending_.push_back({msg, tx});
+    // 发送的报文没有时间戳，用交给硬件的时间代替
+    if (this->pending_.back().msg.timestamp_us == 0) {
+      this->pending_.back().msg.timestamp_us = core::time::NowUs();
+    }
+  }
+  this->cv_.notify_one();
+}
+
+/**
+ * @brief 写入线程，每次把缓冲区整个换出来再慢慢写，写文件的时候不持有锁
+ */
+void CanRecorder::WriterThread() {
+  std::vector<CanLogEntry> batch;
+  batch.reserve(1024);
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(this->mutex_);
+      this->writing_ = false;
+      this->flushed_cv_.notify_all();
+      this->cv_.wait(lock, [this] { return !this->running_ || !this->pending_.empty(); });
+      if (this->pending_.empty()) {
+        return;  // 缓冲区已经空了，并且收到了退出信号
+      }
+      std::swap(batch, this->pending_);
+      this->writing_ = true;
+    }
+    for (const auto &entry : batch) {
+      this->WriteEntry(entry);
+    }
+    this->recorded_count_.fetch_add(batch.size(), std::memory_order_relaxed);
+    batch.clear();
+  }
+}
+
+void CanRecorder::WriteEntry(const CanLogEntry &entry) {
+  const CanMsg &msg = entry.msg;
+  const usize size = std::min<usize>(msg.dlc, msg.data.size());
+
+  if (this->format_ == CanLogFormat::kBinary) {
+    const u8 flags = (msg.fd ? kFlagFd : 0) | (msg.brs ? kFlagBrs : 0) | (entry.tx ? kFlagTx : 0);
+    const u8 size_and_flags[2] = {static_cast<u8>(size), flags};
+    this->file_.write(reinterpret_cast<const char *>(&msg.timestamp_us), sizeof(msg.timestamp_us));
+    this->file_.write(reinterpret_cast<const char *>(&msg.rx_std_id), sizeof(msg.rx_std_id));
+    this->file_.write(reinterpret_cast<const char *>(size_and_flags), sizeof(size_and_flags));
+    this->file_.write(reinterpret_cast<const char *>(msg.data.data()), size);
+    return;
+  }
+
+  // (时间戳) 接口名 ID#数据，和candump -L的输出一致
+  char line[64 + 2 * kCanMaxDataLength];
+  int length = std::snprintf(line, sizeof(line), "(%" PRIu64 ".%06" PRIu64 ") %s %03" PRIX32 "#",
+                             msg.timestamp_us / 1000000, msg.timestamp_us % 1000000, this->interface_name_.c_str(),
+                             msg.rx_std_id);
+  if (length < 0 || static_cast<usize>(length) >= sizeof(line) - 2 * kCanMaxDataLength - 3) {
+    return;  // 接口名太长
+  }
+  if (msg.fd) {
+    length += std::snprintf(line + length, sizeof(line) - length, "#%X", msg.brs ? CANFD_BRS : 0);
+  }
+  static constexpr char kHex[] = "0123456789ABCDEF";
+  for (usize i = 0; i < size; ++i) {
+    line[length++] = kHex[msg.data[i] >> 4];
+    line[length++] = kHex[msg.data[i] & 0xf];
+  }
+  line[length++] = '\n';
+  this->file_.write(line, length);
+}
+
+/**
+ * @param path 录制文件路径，candump格式和二进制格式都可以
+ * @param mode 回放方式
+ */
+CanReplayer::CanReplayer(const std::string &path, CanReplayMode mode) : mode_(mode) {
+  CanLogReader reader{path};
+  CanLogEntry entry;
+  while (reader.Next(entry)) {
+    if (!entry.tx) {
+      this->frames_.push_back(entry.msg);
+    }
+  }
+}
+
+CanReplayer::~CanReplayer() { this->Stop(); }
+
+/**
+ * @brief 回放时设备发出的报文不会真的发到哪里去，只通知监视器
+ */
+void CanReplayer::Write(u16 id, const u8 *data, usize size) {
+  if (!this->has_monitors()) {
+    return;
+  }
+  CanMsg msg{};
+  msg.rx_std_id = id;
+  msg.dlc = std::min(size, kCanMaxDataLength);
+  msg.fd = size > 8;
+  std::copy_n(data, msg.dlc, msg.data.begin());
+  this->ReportTx(msg);
+}
+
+void CanReplayer::Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) { this->Write(id, data, size); }
+
+/**
+ * @brief 通知监视器之后，像回放的报文一样交给设备
+ * @note  在调用者的线程里投递，后台回放时要注意和回放线程的并发
+ */
+void CanReplayer::WriteLoopback(u16 id, const u8 *data, usize size) {
+  CanMsg msg{};
+  msg.rx_std_id = id;
+  msg.dlc = std::min(size, kCanMaxDataLength);
+  msg.fd = size > 8;
+  msg.timestamp_us = core::time::NowUs();
+  std::copy_n(data, msg.dlc, msg.data.begin());
+  this->ReportTx(msg);
+  this->Dispatch(msg);
+}
+
+/**
+ * @brief 在后台线程里回放整个录制文件，回放完之后finished()返回true
+ */
+void CanReplayer::Begin() {
+  if (this->replay_thread_.joinable()) {
+    return;
+  }
+  this->running_ = true;
+  this->finished_ = false;
+  this->replay_thread_ = std::thread([this] {
+    this->Replay();
+    this->finished_.store(true, std::memory_order_release);
+  });
+}
+
+/**
+ * @brief 停止后台回放，实时回放正在等待下一帧时也会立刻返回
+ */
+void CanReplayer::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->running_ = false;
+  }
+  this->cv_.notify_all();
+  if (this->replay_thread_.joinable()) {
+    this->replay_thread_.join();
+  }
+}
+
+/**
+ * @brief  在调用者的线程里回放整个录制文件，把每一帧交给注册了这个ID的设备
+ * @note   没有调用Begin()时也可以直接调用，适合在基准测试里测量设备的解码开销
+ * @return 回放了多少帧
+ */
+usize CanReplayer::Replay() {
+  if (!this->replay_thread_.joinable()) {
+    this->running_ = true;
+  }
+  if (this->frames_.empty()) {
+    return 0;
+  }
+  const u64 first_timestamp_us = this->frames_.front().timestamp_us;
+  const auto start = std::chrono::steady_clock::now();
+  const u64 start_us = core::time::NowUs();
+
+  usize count = 0;
+  for (CanMsg msg : this->frames_) {
+    if (this->mode_ == CanReplayMode::kRealTime) {
+      const u64 offset_us = msg.timestamp_us - first_timestamp_us;
+      std::unique_lock<std::mutex> lock(this->mutex_);
+      this->cv_.wait_until(lock, start + std::chrono::microseconds(offset_us), [this] { return !this->running_; });
+      msg.timestamp_us = start_us + offset_us;
+    }
+    if (!this->running_) {
+      break;
+    }
+    this->Dispatch(msg);
+    ++count;
+    this->replayed_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return count;
+}
+
+/**
+ * @brief 把报文交给注册了这个ID的设备
+ */
+void CanReplayer::Dispatch(const CanMsg &msg) {
+  if (this->TryRxFastPath(msg)) {
+    this->ReportRx(msg, true);
+    return;
+  }
+  device::CanDevice *device = this->device_list_.Find(msg.rx_std_id);
+  this->ReportRx(msg, device != nullptr);
+  if (device != nullptr) {
+    device->Deliver(msg);
+  }
+}
+
+/**
+ * @brief 注册CAN设备
+ * @param device 设备对象
+ * @param rx_stdid 这个设备的rx消息标准帧id
+ */
+void CanReplayer::RegisterDevice(device::CanDevice &device, u32 rx_stdid) {
+  if (!this->device_list_.Insert(rx_stdid, &device)) {
+    throw std::runtime_error("Device already registered");
+  }
+}
+
+}  // namespace rm::hal::linux_
@@ -0,0 +1,204 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/can_log.h
+ * @brief CAN报文的录制和回放，兼容candump的log格式
+ */
+
+#ifndef LIBRM_HAL_LINUX_CAN_LOG_H
+#define LIBRM_HAL_LINUX_CAN_LOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "librm/core/typedefs.h"
+#include "librm/device/can_device.hpp"
+#include "librm/hal/can_device_table.hpp"
+#include "librm/hal/can_interface.h"
+
+namespace rm::hal::linux_ {
+
+/**
+ * @brief 录制文件的格式
+ */
+enum class CanLogFormat {
+  kCandump,  ///< candump -l的文本格式，"(1436509052.249713) can0 123#DEADBEEF"，可以直接用can-utils的canplayer回放
+  kBinary,   ///< 紧凑的二进制格式，文件小、读写快，适合长时间录制
+};
+
+/**
+ * @brief 录制文件里的一条记录
+ */
+struct CanLogEntry {
+  CanMsg msg;  ///< 报文，timestamp_us是录制时的时间戳
+  bool tx;     ///< 是否是本机发出的报文，candump格式不区分收发，读出来总是false
+};
+
+/**
+ * @brief 录制文件读取器，根据文件头自动识别格式
+ */
+class CanLogReader {
+ public:
+  explicit CanLogReader(const std::string &path);
+
+  bool Next(CanLogEntry &entry);
+
+  [[nodiscard]] CanLogFormat format() const { return this->format_; }
+
+ private:
+  std::ifstream file_;
+  CanLogFormat format_;
+  std::string line_{};
+};
+
+/**
+ * @brief CAN录制器，挂到任何一个CanInterface上，把收发的报文和时间戳写进文件
+ * @note  用法：
+ *        rm::hal::linux_::CanRecorder recorder{"motors.log", rm::hal::linux_::CanLogFormat::kCandump, "can0"};
+ *        can.AttachMonitor(recorder);
+ * @note  回调里只把报文放进缓冲区，由单独的写入线程落盘，不会拖慢接收线程；
+ *        写入线程跟不上时缓冲区最多积压kMaxPending帧，超出的部分丢弃并计数
+ */
+class CanRecorder final : public CanMonitor {
+ public:
+  CanRecorder(const std::string &path, CanLogFormat format, std::string interface_name = "can0",
+              bool record_tx = true);
+  ~CanRecorder() override;
+
+  // 禁止拷贝构造
+  CanRecorder(const CanRecorder &) = delete;
+  CanRecorder &operator=(const CanRecorder &) = delete;
+
+  void OnRx(const CanMsg &msg, bool known) override;
+  void OnTx(const CanMsg &msg) override;
+
+  void Flush();
+
+  /**
+   * @return 已经写进文件的报文数量
+   */
+  [[nodiscard]] usize recorded_count() const { return this->recorded_count_.load(std::memory_order_relaxed); }
+
+  /**
+   * @return 因为写入线程跟不上而丢弃的报文数量
+   */
+  [[nodiscard]] usize dropped_count() const { return this->dropped_count_.load(std::memory_order_relaxed); }
+
+  static constexpr usize kMaxPending = 65536;
+
+ private:
+  void Push(const CanMsg &msg, bool tx);
+  void WriterThread();
+  void WriteEntry(const CanLogEntry &entry);
+
+  std::ofstream file_;
+  CanLogFormat format_;
+  std::string interface_name_;
+  bool record_tx_;
+  std::thread writer_thread_{};
+  std::mutex mutex_{};
+  std::condition_variable cv_{};
+  std::condition_variable flushed_cv_{};
+  std::vector<CanLogEntry> pending_{};
+  bool writing_{false};
+  bool running_{true};
+  std::atomic<usize> recorded_count_{0};
+  std::atomic<usize> dropped_count_{0};
+};
+
+/**
+ * @brief 回放方式
+ */
+enum class CanReplayMode {
+  kRealTime,          ///< 按录制时的时间间隔回放，报文的时间戳换算成回放时的时间
+  kAsFastAsPossible,  ///< 不等待，尽快把所有报文交给设备，报文保留录制时的时间戳
+};
+
+/**
+ * @brief CAN回放器，把录制文件里收到的报文按顺序交给注册在它上面的CanDevice
+ * @note  用来给DjiMotor、DmMotor、SuperCap这些设备的解码逻辑提供可重复的负载，做基准测试和控制器的离线回归测试
+ * @note  录制文件在构造时一次性读进内存，回放时不会再有文件IO；录制文件里本机发出的报文不会回放
+ * @note  设备通过Write/Enqueue发出的报文直接丢弃，只通知挂在回放器上的监视器
+ * @note  用法：
+ *        rm::hal::linux_::CanReplayer replayer{"motors.log", rm::hal::linux_::CanReplayMode::kAsFastAsPossible};
+ *        rm::device::M3508 motor{replayer, 1};
+ *        replayer.Replay();  // 在当前线程里回放整个文件，或者调用Begin()在后台线程里回放
+ */
+class CanReplayer final : public CanInterface {
+ public:
+  explicit CanReplayer(const std::string &path, CanReplayMode mode = CanReplayMode::kRealTime);
+  ~CanReplayer() override;
+
+  // 禁止拷贝构造
+  CanReplayer(const CanReplayer &) = delete;
+  CanReplayer &operator=(const CanReplayer &) = delete;
+
+  void Write(u16 id, const u8 *data, usize size) override;
+  void WriteLoopback(u16 id, const u8 *data, usize size) override;
+  void Write() override {}
+  void Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) override;
+  void SetFilter(u16 id, u16 mask) override {}
+  void Begin() override;
+  void Stop() override;
+  [[nodiscard]] usize max_data_length() const override { return kCanMaxDataLength; }
+
+  usize Replay();
+
+  /**
+   * @return 录制文件里要回放的报文数量
+   */
+  [[nodiscard]] usize size() const { return this->frames_.size(); }
+
+  /**
+   * @return 已经回放的报文数量
+   */
+  [[nodiscard]] usize replayed_count() const { return this->replayed_count_.load(std::memory_order_relaxed); }
+
+  /**
+   * @return 后台回放是否已经结束
+   */
+  [[nodiscard]] bool finished() const { return this->finished_.load(std::memory_order_acquire); }
+
+ private:
+  void RegisterDevice(device::CanDevice &device, u32 rx_stdid) override;
+  void Dispatch(const CanMsg &msg);
+
+  CanReplayMode mode_;
+  std::vector<CanMsg> frames_{};
+  CanDeviceTable<device::CanDevice> device_list_{};
+  std::thread replay_thread_{};
+  std::mutex mutex_{};
+  std::condition_variable cv_{};
+  std::atomic<bool> running_{false};
+  std::atomic<bool> finished_{false};
+  std::atomic<usize> replayed_count_{0};
+};
+
+}  // namespace rm::hal::linux_
+
+#endif  // LIBRM_HAL_LINUX_CAN_LOG_H
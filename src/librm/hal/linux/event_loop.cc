@@ -0,0 +1,241 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/event_loop.cc
+ * @brief 基于epoll的事件循环，让多个CAN、串口共用少量线程收发数据
+ */
+
+#include "event_loop.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace rm::hal::linux_ {
+
+/**
+ * @param num_threads 事件循环的线程数，一般一个线程就足够处理好几路CAN和串口
+ */
+EventLoop::EventLoop(usize num_threads) : num_threads_(std::max<usize>(num_threads, 1)) {
+  this->epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  this->wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->epoll_fd_ < 0 || this->wakeup_fd_ < 0) {
+    throw std::runtime_error("Failed to create event loop");
+  }
+  struct ::epoll_event event {};
+  event.events = EPOLLIN;
+  event.data.u64 = EventLoop::EventKey(this->wakeup_fd_, 0);
+  epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, this->wakeup_fd_, &event);
+}
+
+EventLoop::~EventLoop() {
+  this->Stop();
+  close(this->wakeup_fd_);
+  close(this->epoll_fd_);
+}
+
+/**
+ * @brief 启动事件循环的线程
+ */
+void EventLoop::Begin() {
+  if (this->running_.exchange(true)) {
+    return;
+  }
+  for (usize i = 0; i < this->num_threads_; ++i) {
+    this->threads_.emplace_back(&EventLoop::Run, this);
+  }
+}
+
+/**
+ * @brief 设置事件循环线程的调度优先级、CPU亲和性等属性，需要在Begin()之前调用
+ * @param attributes 线程属性，所有线程都使用同一套属性
+ */
+void EventLoop::SetThreadAttributes(const ThreadAttributes &attributes) { this->thread_attributes_ = attributes; }
+
+/**
+ * @brief 停止事件循环，等待所有线程退出
+ * @note  不能在事件循环的回调里调用
+ */
+void EventLoop::Stop() {
+  if (!this->running_.exchange(false)) {
+    return;
+  }
+  eventfd_write(this->wakeup_fd_, 1);
+  for (auto &thread : this->threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+  this->threads_.clear();
+}
+
+/**
+ * @brief 注册一个文件描述符
+ * @param fd      文件描述符，应该是非阻塞的
+ * @param events  关心的事件，比如EPOLLIN
+ * @param handler 文件描述符就绪时在事件循环线程里调用的回调函数，回调里不要阻塞
+ */
+void EventLoop::Add(int fd, u32 events, Handler handler) {
+  auto entry = std::make_shared<Entry>();
+  entry->fd = fd;
+  // 多线程时用EPOLLONESHOT，保证同一个fd的回调不会在两个线程里同时执行，回调执行完后再重新启用
+  entry->events = events | (this->num_threads_ > 1 ? EPOLLONESHOT : 0);
+  entry->handler = std::move(handler);
+  {
+    std::lock_guard<std::mutex> lock(this->entries_mutex_);
+    if (static_cast<usize>(fd) >= this->entries_.size()) {
+      this->entries_.resize(fd + 1);
+    }
+    if (this->entries_[fd] != nullptr) {
+      throw std::runtime_error("File descriptor already registered");
+    }
+    entry->generation = this->next_generation_++;
+    if (this->next_generation_ == 0) {
+      this->next_generation_ = 1;
+    }
+    this->entries_[fd] = entry;
+  }
+  struct ::epoll_event event {};
+  event.events = entry->events;
+  event.data.u64 = EventLoop::EventKey(fd, entry->generation);
+  if (epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+    std::lock_guard<std::mutex> lock(this->entries_mutex_);
+    this->entries_[fd] = nullptr;
+    throw std::runtime_error("Failed to add file descriptor to event loop");
+  }
+}
+
+/**
+ * @brief 注销一个文件描述符
+ * @param fd 文件描述符
+ * @note  会等待这个fd正在执行的回调结束后再返回，返回之后回调不会再被调用，可以安全地关闭fd了；
+ *        可以在这个fd自己的回调里调用，但多线程时不要在两个回调里互相Remove()对方的fd，会死锁
+ */
+void EventLoop::Remove(int fd) {
+  std::shared_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(this->entries_mutex_);
+    if (fd < 0 || static_cast<usize>(fd) >= this->entries_.size() || this->entries_[fd] == nullptr) {
+      return;
+    }
+    entry = std::move(this->entries_[fd]);
+  }
+  // 在entry->mutex里设置removed并从epoll里删掉，已经从epoll_wait取出事件、还没拿到锁的线程不会再调用回调，
+  // 也不会在删掉之后再用EPOLL_CTL_MOD把它加回去
+  std::lock_guard<std::recursive_mutex> lock(entry->mutex);
+  entry->removed = true;
+  epoll_ctl(this->epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+/**
+ * @brief 把一个任务交给事件循环线程执行
+ * @param task 任务
+ */
+void EventLoop::Post(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(this->tasks_mutex_);
+    this->tasks_.push_back(std::move(task));
+  }
+  eventfd_write(this->wakeup_fd_, 1);
+}
+
+/**
+ * @return 是否在事件循环的线程里
+ */
+bool EventLoop::in_loop_thread() const {
+  const auto id = std::this_thread::get_id();
+  for (const auto &thread : this->threads_) {
+    if (thread.get_id() == id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief 事件循环线程
+ */
+void EventLoop::Run() {
+  if (!this->thread_attributes_.empty()) {
+    ApplyThreadAttributes(this->thread_attributes_, "event-loop");
+  }
+  struct ::epoll_event events[EventLoop::kMaxEvents];
+  while (this->running_) {
+    const int count = epoll_wait(this->epoll_fd_, events, EventLoop::kMaxEvents, -1);
+    for (int i = 0; i < count; ++i) {
+      const u64 key = events[i].data.u64;
+      const int fd = static_cast<int>(key & 0xffffffff);
+      const u32 generation = key >> 32;
+      if (generation == 0) {
+        this->RunPostedTasks();
+        continue;
+      }
+      std::shared_ptr<Entry> entry;
+      {
+        std::lock_guard<std::mutex> lock(this->entries_mutex_);
+        if (static_cast<usize>(fd) < this->entries_.size()) {
+          entry = this->entries_[fd];
+        }
+      }
+      if (entry == nullptr || entry->generation != generation) {
+        continue;  // 已经被Remove()了，或者fd被复用、是之前那次注册留下的事件
+      }
+      std::lock_guard<std::recursive_mutex> lock(entry->mutex);
+      if (entry->removed) {
+        continue;  // 取出事件之后、拿到锁之前被Remove()了
+      }
+      entry->handler(events[i].events);
+      if ((entry->events & EPOLLONESHOT) && !entry->removed) {
+        struct ::epoll_event event {};
+        event.events = entry->events;
+        event.data.u64 = key;
+        epoll_ctl(this->epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+      }
+    }
+  }
+}
+
+/**
+ * @brief 执行Post()投递过来的任务
+ * @note  wakeup_fd_没有用EPOLLONESHOT，多线程时可能有好几个线程同时被唤醒，谁先抢到任务谁执行
+ */
+void EventLoop::RunPostedTasks() {
+  eventfd_t value;
+  eventfd_read(this->wakeup_fd_, &value);
+  if (!this->running_) {
+    eventfd_write(this->wakeup_fd_, 1);  // 退出时把其他线程也唤醒
+    return;
+  }
+  std::vector<std::function<void()>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(this->tasks_mutex_);
+    tasks.swap(this->tasks_);
+  }
+  for (auto &task : tasks) {
+    task();
+  }
+}
+
+}  // namespace rm::hal::linux_
@@ -0,0 +1,129 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/event_loop.h
+ * @brief 基于epoll的事件循环，让多个CAN、串口共用少量线程收发数据
+ */
+
+#ifndef LIBRM_HAL_LINUX_EVENT_LOOP_H
+#define LIBRM_HAL_LINUX_EVENT_LOOP_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+
+#include "librm/core/typedefs.h"
+#include "librm/hal/linux/realtime.h"
+
+namespace rm::hal::linux_ {
+
+/**
+ * @brief 事件循环
+ * @note  每个SocketCan、Serial默认都会创建自己的接收线程和线程池，总线和串口一多线程数就会爆炸。
+ *        把它们都注册到同一个EventLoop上之后，所有文件描述符都由这里的一个或几个线程用epoll统一等待和处理
+ * @note  同一个文件描述符的回调不会被同时调用，不同文件描述符的回调在多线程模式下可能会并行调用
+ * @note  用法：
+ *        rm::hal::linux_::EventLoop loop;
+ *        rm::hal::linux_::SocketCan can0{"can0", loop};
+ *        rm::hal::linux_::SocketCan can1{"can1", loop};
+ *        loop.Begin();
+ *        can0.Begin();
+ *        can1.Begin();
+ */
+class EventLoop {
+ public:
+  /**
+   * @brief 文件描述符就绪时的回调函数，参数是epoll返回的事件
+   */
+  using Handler = std::function<void(u32 events)>;
+
+  explicit EventLoop(usize num_threads = 1);
+  ~EventLoop();
+
+  // 禁止拷贝构造
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  void Begin();
+  void Stop();
+  void Add(int fd, u32 events, Handler handler);
+  void Remove(int fd);
+  void Post(std::function<void()> task);
+  void SetThreadAttributes(const ThreadAttributes &attributes);
+
+  /**
+   * @return 是否在事件循环的线程里
+   */
+  [[nodiscard]] bool in_loop_thread() const;
+
+  /**
+   * @return 事件循环的所有线程
+   */
+  [[nodiscard]] std::vector<std::thread> &threads() { return this->threads_; }
+
+ private:
+  /**
+   * @brief 一个注册过的文件描述符
+   * @note  调用回调时持有mutex，Remove()借此等待正在执行的回调结束；mutex是递归的，回调里可以Remove()自己
+   * @note  Remove()在mutex里设置removed，Run()拿到mutex之后先检查它，已经注销的回调不会再被调用
+   */
+  struct Entry {
+    int fd;
+    u32 generation;  // 注册的序号，和fd一起放进epoll事件里，fd被关闭后复用时用它区分新旧注册
+    u32 events;
+    Handler handler;
+    std::recursive_mutex mutex;
+    bool removed{false};
+  };
+
+  static u64 EventKey(int fd, u32 generation) { return static_cast<u64>(generation) << 32 | static_cast<u32>(fd); }
+
+  void Run();
+  void RunPostedTasks();
+
+  int epoll_fd_{-1};
+  int wakeup_fd_{-1};  // eventfd，用于Post()和Stop()唤醒epoll_wait
+  usize num_threads_;
+  ThreadAttributes thread_attributes_{};
+  std::vector<std::thread> threads_{};
+  std::atomic<bool> running_{false};
+  std::mutex entries_mutex_{};
+  std::vector<std::shared_ptr<Entry>> entries_{};  // 以fd为下标
+  u32 next_generation_{1};                          // 0留给wakeup_fd_
+  std::mutex tasks_mutex_{};
+  std::vector<std::function<void()>> tasks_{};
+
+  /**
+   * @brief 每次epoll_wait最多取出多少个事件
+   */
+  static constexpr int kMaxEvents = 32;
+};
+
+}  // namespace rm::hal::linux_
+
+#endif  // LIBRM_HAL_LINUX_EVENT_LOOP_H
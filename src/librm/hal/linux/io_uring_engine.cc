@@ -0,0 +1,346 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/io_uring_engine.cc
+ * @brief 基于io_uring的接收引擎，用multishot接收和内核管理的缓冲区环批量收取CAN和串口数据
+ */
+
+#if defined(LIBRM_USE_IO_URING)
+
+#include "io_uring_engine.h"
+
+#include <cerrno>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+namespace rm::hal::linux_ {
+
+/**
+ * @param queue_depth io_uring提交队列的深度
+ */
+IoUringEngine::IoUringEngine(u32 queue_depth) {
+  const int result = io_uring_queue_init(queue_depth, &this->ring_, 0);
+  if (result < 0) {
+    throw std::runtime_error("Failed to create io_uring");
+  }
+}
+
+IoUringEngine::~IoUringEngine() {
+  this->Stop();
+  for (usize group = 0; group < IoUringEngine::kMaxSources; ++group) {
+    if (this->sources_[group] != nullptr) {
+      this->Release(group);
+    }
+  }
+  io_uring_queue_exit(&this->ring_);
+}
+
+/**
+ * @brief 启动引擎线程
+ */
+void IoUringEngine::Begin() {
+  if (this->running_.exchange(true)) {
+    return;
+  }
+  this->thread_ = std::thread(&IoUringEngine::Run, this);
+}
+
+/**
+ * @brief 设置引擎线程的调度优先级、CPU亲和性等属性，需要在Begin()之前调用
+ * @param attributes 线程属性
+ */
+void IoUringEngine::SetThreadAttributes(const ThreadAttributes &attributes) { this->thread_attributes_ = attributes; }
+
+/**
+ * @brief 停止引擎线程
+ * @note  不能在接收回调里调用
+ */
+void IoUringEngine::Stop() {
+  if (!this->running_.exchange(false)) {
+    return;
+  }
+  {
+    // 提交一个空请求，把阻塞在io_uring_wait_cqe里的引擎线程唤醒
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    struct ::io_uring_sqe *sqe = io_uring_get_sqe(&this->ring_);
+    if (sqe != nullptr) {
+      io_uring_prep_nop(sqe);
+      io_uring_sqe_set_data64(sqe, IoUringEngine::kWakeupUserData);
+      io_uring_submit(&this->ring_);
+    }
+  }
+  if (this->thread_.joinable()) {
+    this->thread_.join();
+  }
+}
+
+/**
+ * @brief 在一个文件描述符上开始接收
+ * @param fd           文件描述符
+ * @param buffer_size  每块接收缓冲区的大小，CAN套接字每次接收一帧，用sizeof(canfd_frame)即可
+ * @param buffer_count 缓冲区数量，会向上取整到2的幂；回调处理不过来、缓冲区全部被占用时，新到的数据会被内核暂存在套接字里
+ * @param handler      收到数据时在引擎线程里调用的回调函数，回调里不要阻塞
+ */
+void IoUringEngine::AddRecv(int fd, usize buffer_size, usize buffer_count, RecvHandler handler) {
+  u32 count = 1;
+  while (count < buffer_count) {
+    count <<= 1;
+  }
+  struct ::stat fd_stat {};
+  fstat(fd, &fd_stat);
+
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  u16 group = 0;
+  for (; group < IoUringEngine::kMaxSources; ++group) {
+    if (this->sources_[group] != nullptr && this->sources_[group]->fd == fd) {
+      throw std::runtime_error("File descriptor already registered");
+    }
+  }
+  for (group = 0; group < IoUringEngine::kMaxSources && this->sources_[group] != nullptr; ++group) {
+  }
+  if (group == IoUringEngine::kMaxSources) {
+    throw std::runtime_error("Too many io_uring sources");
+  }
+
+  auto source = std::make_unique<Source>();
+  source->fd = fd;
+  source->socket = S_ISSOCK(fd_stat.st_mode);
+  source->buffer_size = buffer_size;
+  source->buffer_count = count;
+  source->buffers.resize(buffer_size * count);
+  source->handler = std::move(handler);
+  source->armed = false;
+  source->removing = false;
+
+  // 把所有缓冲区交给内核，之后每次接收内核会自己挑一块空闲的用
+  int result = 0;
+  source->buffer_ring = io_uring_setup_buf_ring(&this->ring_, count, group, 0, &result);
+  if (source->buffer_ring == nullptr) {
+    throw std::runtime_error("Failed to register io_uring buffer ring");
+  }
+  const int mask = io_uring_buf_ring_mask(count);
+  for (u32 i = 0; i < count; ++i) {
+    io_uring_buf_ring_add(source->buffer_ring, source->buffers.data() + i * buffer_size, buffer_size, i, mask, i);
+  }
+  io_uring_buf_ring_advance(source->buffer_ring, count);
+
+  this->sources_[group] = std::move(source);
+  if (!this->Arm(group)) {
+    this->Release(group);
+    throw std::runtime_error("io_uring submission queue is full");
+  }
+  io_uring_submit(&this->ring_);
+}
+
+/**
+ * @brief 停止在一个文件描述符上接收
+ * @param fd 文件描述符
+ * @note  在引擎线程之外调用时，会等到这个fd的接收请求全部结束后再返回，返回之后就可以安全地关闭fd了
+ */
+void IoUringEngine::Remove(int fd) {
+  std::unique_lock<std::mutex> lock(this->mutex_);
+  u16 group = 0;
+  while (group < IoUringEngine::kMaxSources &&
+         (this->sources_[group] == nullptr || this->sources_[group]->fd != fd)) {
+    ++group;
+  }
+  if (group == IoUringEngine::kMaxSources || this->sources_[group]->removing) {
+    return;
+  }
+  Source *source = this->sources_[group].get();
+  source->removing = true;
+  if (!source->armed || !this->running_) {
+    this->Release(group);  // 没有进行中的请求，可以直接释放
+    return;
+  }
+  struct ::io_uring_sqe *sqe = io_uring_get_sqe(&this->ring_);
+  if (sqe != nullptr) {
+    // 非socket的fd上同时挂着POLLIN和read两个请求，要全部取消
+    io_uring_prep_cancel_fd(sqe, fd, IORING_ASYNC_CANCEL_ALL);
+    io_uring_sqe_set_data64(sqe, IoUringEngine::kWakeupUserData);
+    io_uring_submit(&this->ring_);
+  }
+  if (std::this_thread::get_id() != this->thread_.get_id()) {
+    this->removed_cv_.wait(lock, [this, group] { return this->sources_[group] == nullptr || !this->running_; });
+  }
+}
+
+/**
+ * @brief 引擎线程，等待完成事件并批量处理
+ */
+void IoUringEngine::Run() {
+  if (!this->thread_attributes_.empty()) {
+    ApplyThreadAttributes(this->thread_attributes_, "io-uring");
+  }
+  struct ::io_uring_cqe *cqes[IoUringEngine::kMaxCompletions];
+  while (this->running_) {
+    bool rearm_pending;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      rearm_pending = this->rearm_pending_;
+    }
+    struct ::io_uring_cqe *cqe;
+    int result;
+    if (rearm_pending) {
+      // 有请求等着重新提交，不能一直睡下去
+      struct ::__kernel_timespec timeout {};
+      timeout.tv_nsec = kRearmRetryIntervalNs;
+      result = io_uring_wait_cqe_timeout(&this->ring_, &cqe, &timeout);
+      this->RearmPending();
+    } else {
+      result = io_uring_wait_cqe(&this->ring_, &cqe);
+    }
+    if (result < 0) {
+      continue;  // 被信号打断或者超时
+    }
+    const unsigned count = io_uring_peek_batch_cqe(&this->ring_, cqes, IoUringEngine::kMaxCompletions);
+    bool resubmit = false;
+    for (unsigned i = 0; i < count; ++i) {
+      resubmit |= this->HandleCompletion(cqes[i]);
+    }
+    io_uring_cq_advance(&this->ring_, count);
+    if (resubmit) {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      io_uring_submit(&this->ring_);
+    }
+  }
+}
+
+/**
+ * @brief  处理一个完成事件
+ * @return 是否有新的请求需要提交
+ */
+bool IoUringEngine::HandleCompletion(const struct ::io_uring_cqe *cqe) {
+  const u64 group = io_uring_cqe_get_data64(cqe);
+  if (group >= IoUringEngine::kMaxSources) {
+    return false;  // 空请求、取消请求或者read前面的POLLIN
+  }
+  Source *source;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    source = this->sources_[group].get();
+  }
+  if (source == nullptr) {
+    return false;
+  }
+
+  if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+    const u16 buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    u8 *buffer = source->buffers.data() + buffer_id * source->buffer_size;
+    source->handler(buffer, cqe->res);
+    // 回调处理完之后把缓冲区还给内核
+    io_uring_buf_ring_add(source->buffer_ring, buffer, source->buffer_size, buffer_id,
+                          io_uring_buf_ring_mask(source->buffer_count), 0);
+    io_uring_buf_ring_advance(source->buffer_ring, 1);
+  } else if (cqe->res == -ENOBUFS) {
+    this->rx_overflow_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  if (cqe->flags & IORING_CQE_F_MORE) {
+    return false;  // multishot请求还在继续
+  }
+  // 请求结束了：被取消或者出错就释放，否则重新提交
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  source->armed = false;
+  // -EAGAIN只会出现在非socket的fd上(POLLIN之后数据又被别人读走了)，重新提交时还是会先等POLLIN，不会空转
+  const bool recoverable = cqe->res >= 0 || cqe->res == -ENOBUFS || cqe->res == -EINTR || cqe->res == -EAGAIN;
+  if (source->removing || !recoverable) {
+    if (source->removing) {
+      this->Release(group);
+    }
+    return false;
+  }
+  if (!this->Arm(group)) {
+    this->rearm_pending_ = true;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief 重新提交之前因为提交队列满了没能提交的接收请求
+ */
+void IoUringEngine::RearmPending() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (!this->rearm_pending_) {
+    return;
+  }
+  this->rearm_pending_ = false;
+  for (u16 group = 0; group < IoUringEngine::kMaxSources; ++group) {
+    Source *source = this->sources_[group].get();
+    if (source != nullptr && !source->armed && !source->removing && !this->Arm(group)) {
+      this->rearm_pending_ = true;
+    }
+  }
+  io_uring_submit(&this->ring_);
+}
+
+/**
+ * @brief  在一个文件描述符上提交接收请求，调用者需要持有mutex_，并在之后调用io_uring_submit
+ * @return 提交队列满了、先提交已有的请求之后还是取不到位置时返回false
+ */
+bool IoUringEngine::Arm(u16 group) {
+  Source *source = this->sources_[group].get();
+  // 非socket的fd要两个提交项：一个POLLIN加上链在它后面的read
+  const unsigned needed = source->socket ? 1 : 2;
+  if (io_uring_sq_space_left(&this->ring_) < needed) {
+    io_uring_submit(&this->ring_);
+    if (io_uring_sq_space_left(&this->ring_) < needed) {
+      return false;
+    }
+  }
+  struct ::io_uring_sqe *sqe = io_uring_get_sqe(&this->ring_);
+  if (source->socket) {
+    io_uring_prep_recv_multishot(sqe, source->fd, nullptr, 0, 0);
+  } else {
+    // 串口这类fd是非阻塞打开的，直接read会在没数据时立刻返回-EAGAIN，
+    // 所以先等POLLIN，有数据了再执行链接在后面的read
+    io_uring_prep_poll_add(sqe, source->fd, POLLIN);
+    sqe->flags |= IOSQE_IO_LINK;
+    io_uring_sqe_set_data64(sqe, IoUringEngine::kPollUserData);
+    sqe = io_uring_get_sqe(&this->ring_);
+    io_uring_prep_read(sqe, source->fd, nullptr, source->buffer_size, 0);
+  }
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = group;
+  io_uring_sqe_set_data64(sqe, group);
+  source->armed = true;
+  return true;
+}
+
+/**
+ * @brief 注销缓冲区环并释放一个文件描述符的所有资源，调用者需要持有mutex_
+ */
+void IoUringEngine::Release(u16 group) {
+  Source *source = this->sources_[group].get();
+  io_uring_free_buf_ring(&this->ring_, source->buffer_ring, source->buffer_count, group);
+  this->sources_[group].reset();
+  this->removed_cv_.notify_all();
+}
+
+}  // namespace rm::hal::linux_
+
+#endif
@@ -0,0 +1,161 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/io_uring_engine.h
+ * @brief 基于io_uring的接收引擎，用multishot接收和内核管理的缓冲区环批量收取CAN和串口数据
+ */
+
+#ifndef LIBRM_HAL_LINUX_IO_URING_ENGINE_H
+#define LIBRM_HAL_LINUX_IO_URING_ENGINE_H
+
+#if defined(LIBRM_USE_IO_URING)
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <liburing.h>
+
+#include "librm/core/typedefs.h"
+#include "librm/hal/linux/realtime.h"
+
+namespace rm::hal::linux_ {
+
+/**
+ * @brief io_uring接收引擎
+ * @note  和每个文件描述符一个阻塞接收线程的模型不同，这里所有注册的文件描述符共用一个线程和一个io_uring：
+ *        套接字上提交一次multishot recv之后，内核每收到一帧就从预先提供的缓冲区环里挑一块写进去并产生一个完成事件，
+ *        不需要再为每一帧调用一次recv；完成事件由引擎线程一次批量取出处理
+ * @note  串口不是套接字，不能用multishot recv，用POLLIN加链接在后面的带缓冲区选择的read代替，每次完成后重新提交；
+ *        一批完成事件里所有需要重新提交的请求最后合并成一次io_uring_submit
+ * @note  需要Linux 6.0以上的内核和liburing 2.4以上，CMake找到liburing时才会编译
+ * @note  用法：
+ *        rm::hal::linux_::IoUringEngine io_uring;
+ *        rm::hal::linux_::SocketCan can0{"can0", io_uring};
+ *        io_uring.Begin();
+ *        can0.Begin();
+ */
+class IoUringEngine {
+ public:
+  /**
+   * @brief 收到数据时的回调函数，参数是数据和长度；data只在回调期间有效
+   */
+  using RecvHandler = std::function<void(const u8 *data, usize size)>;
+
+  explicit IoUringEngine(u32 queue_depth = kDefaultQueueDepth);
+  ~IoUringEngine();
+
+  // 禁止拷贝构造
+  IoUringEngine(const IoUringEngine &) = delete;
+  IoUringEngine &operator=(const IoUringEngine &) = delete;
+
+  void Begin();
+  void Stop();
+  void AddRecv(int fd, usize buffer_size, usize buffer_count, RecvHandler handler);
+  void Remove(int fd);
+  void SetThreadAttributes(const ThreadAttributes &attributes);
+
+  /**
+   * @return 因为缓冲区环被用完(回调处理得太慢)而没能接收的次数
+   */
+  [[nodiscard]] usize rx_overflow_count() const { return this->rx_overflow_count_.load(std::memory_order_relaxed); }
+
+  /**
+   * @return 引擎线程
+   */
+  [[nodiscard]] std::thread &thread() { return this->thread_; }
+
+ private:
+  /**
+   * @brief 一个注册过的文件描述符，以及它专用的缓冲区环
+   */
+  struct Source {
+    int fd;
+    bool socket;  // 套接字用multishot recv，其他文件描述符用POLLIN加链接的read
+    usize buffer_size;
+    u32 buffer_count;
+    std::vector<u8> buffers;
+    struct ::io_uring_buf_ring *buffer_ring;
+    RecvHandler handler;
+    bool armed;     // 是否有还没结束的接收请求
+    bool removing;  // 是否已经调用了Remove()
+  };
+
+  void Run();
+  bool HandleCompletion(const struct ::io_uring_cqe *cqe);
+  bool Arm(u16 group);
+  void RearmPending();
+  void Release(u16 group);
+
+  struct ::io_uring ring_ {};
+  ThreadAttributes thread_attributes_{};
+  std::thread thread_{};
+  std::atomic<bool> running_{false};
+  std::atomic<usize> rx_overflow_count_{0};
+
+  /**
+   * @brief 最多同时注册多少个文件描述符
+   */
+  static constexpr usize kMaxSources = 32;
+
+  std::mutex mutex_{};  // 保护提交队列和sources_，完成队列只有引擎线程会访问
+  std::condition_variable removed_cv_{};
+  std::array<std::unique_ptr<Source>, kMaxSources> sources_{};  // 下标就是缓冲区组ID，也是请求的user_data
+  bool rearm_pending_{false};  // 有接收请求因为提交队列满了没能重新提交，引擎线程会定时重试
+
+  /**
+   * @brief io_uring提交队列的默认深度
+   */
+  static constexpr u32 kDefaultQueueDepth = 64;
+
+  /**
+   * @brief 每次最多批量取出多少个完成事件
+   */
+  static constexpr unsigned kMaxCompletions = 64;
+
+  /**
+   * @brief Stop()用来唤醒引擎线程的空请求的user_data
+   */
+  static constexpr u64 kWakeupUserData = ~0ull;
+
+  /**
+   * @brief 非socket的fd在read之前先提交的POLLIN请求的user_data，它的完成事件直接忽略
+   */
+  static constexpr u64 kPollUserData = ~0ull - 1;
+
+  /**
+   * @brief 有接收请求没能重新提交时，引擎线程隔多久重试一次(ns)
+   */
+  static constexpr long long kRearmRetryIntervalNs = 1'000'000;
+};
+
+}  // namespace rm::hal::linux_
+
+#endif
+
+#endif  // LIBRM_HAL_LINUX_IO_URING_ENGINE_H
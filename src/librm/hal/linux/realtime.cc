@@ -0,0 +1,163 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/realtime.cc
+ * @brief 线程实时性配置：SCHED_FIFO优先级、CPU亲和性、锁定内存、预先映射栈
+ */
+
+#include "realtime.h"
+
+#include <alloca.h>
+#include <cstdio>
+#include <mutex>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+std::mutex report_mutex;
+std::vector<rm::hal::linux_::ThreadAttributesResult> thread_results;
+bool memory_lock_requested = false;
+bool memory_locked = false;
+
+/**
+ * @brief 给一个线程设置调度策略、亲和性和名字，并把结果记录下来
+ */
+rm::hal::linux_::ThreadAttributesResult Apply(pthread_t thread, const rm::hal::linux_::ThreadAttributes &attributes,
+                                              const std::string &name) {
+  rm::hal::linux_::ThreadAttributesResult result{name, attributes, false, false, 0};
+  pthread_setname_np(thread, name.substr(0, 15).c_str());  // 线程名最长15个字符
+  if (attributes.priority > 0) {
+    struct ::sched_param param {};
+    param.sched_priority = attributes.priority;
+    result.priority_granted = pthread_setschedparam(thread, SCHED_FIFO, &param) == 0;
+  }
+  if (!attributes.cpus.empty()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : attributes.cpus) {
+      CPU_SET(cpu, &cpu_set);
+    }
+    result.affinity_granted = pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set) == 0;
+  }
+  return result;
+}
+
+void Record(const rm::hal::linux_::ThreadAttributesResult &result) {
+  std::lock_guard<std::mutex> lock(report_mutex);
+  thread_results.push_back(result);
+}
+
+}  // namespace
+
+namespace rm::hal::linux_ {
+
+/**
+ * @brief  给调用者所在的线程设置属性，在线程函数的开头调用
+ * @param  attributes 线程属性
+ * @param  name       线程名，用于top -H等工具和RealtimeReport()
+ * @return 实际生效的情况
+ */
+ThreadAttributesResult ApplyThreadAttributes(const ThreadAttributes &attributes, const std::string &name) {
+  ThreadAttributesResult result = Apply(pthread_self(), attributes, name);
+  if (attributes.prefault_stack_size > 0) {
+    PrefaultStack(attributes.prefault_stack_size);
+    result.prefaulted_stack = attributes.prefault_stack_size;
+  }
+  Record(result);
+  return result;
+}
+
+/**
+ * @brief  给另一个已经启动的线程设置属性
+ * @param  thread     线程
+ * @param  attributes 线程属性，prefault_stack_size只能由线程自己完成，这里会被忽略
+ * @param  name       线程名
+ * @return 实际生效的情况
+ */
+ThreadAttributesResult ApplyThreadAttributes(std::thread &thread, const ThreadAttributes &attributes,
+                                             const std::string &name) {
+  ThreadAttributesResult result = Apply(thread.native_handle(), attributes, name);
+  Record(result);
+  return result;
+}
+
+/**
+ * @brief  锁定进程现在和将来的所有内存，避免实时线程因为缺页或者换页被阻塞
+ * @return 是否成功，需要root权限或者足够大的RLIMIT_MEMLOCK
+ */
+bool LockMemory() {
+  const bool locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+  std::lock_guard<std::mutex> lock(report_mutex);
+  memory_lock_requested = true;
+  memory_locked = locked;
+  return locked;
+}
+
+/**
+ * @brief 在当前线程的栈上预先写一遍size字节，让内核提前把这些页映射好
+ * @param size 字节数，不要超过线程栈的大小(默认8MB)
+ */
+void PrefaultStack(usize size) {
+  const usize page_size = sysconf(_SC_PAGESIZE);
+  volatile u8 *stack = static_cast<volatile u8 *>(alloca(size));
+  for (usize i = 0; i < size; i += page_size) {
+    stack[i] = 0;
+  }
+}
+
+/**
+ * @return 所有设置过属性的线程实际生效的情况，每个线程一行
+ */
+std::string RealtimeReport() {
+  std::lock_guard<std::mutex> lock(report_mutex);
+  std::string report = "[librm] realtime report\n";
+  char line[256];
+  if (memory_lock_requested) {
+    std::snprintf(line, sizeof(line), "  mlockall: %s\n", memory_locked ? "granted" : "DENIED");
+    report += line;
+  }
+  for (const auto &result : thread_results) {
+    std::string cpus;
+    for (int cpu : result.requested.cpus) {
+      cpus += (cpus.empty() ? "" : ",") + std::to_string(cpu);
+    }
+    std::snprintf(line, sizeof(line), "  %-15s SCHED_FIFO %2d: %-7s  cpus [%s]: %-7s  stack prefault %zu bytes\n",
+                  result.name.c_str(), result.requested.priority,
+                  result.requested.priority == 0 ? "-" : (result.priority_granted ? "granted" : "DENIED"),
+                  cpus.c_str(), result.requested.cpus.empty() ? "-" : (result.affinity_granted ? "granted" : "DENIED"),
+                  result.prefaulted_stack);
+    report += line;
+  }
+  return report;
+}
+
+/**
+ * @brief 把RealtimeReport()打印到标准错误输出，一般在所有线程都启动之后调用一次
+ */
+void PrintRealtimeReport() { std::fputs(RealtimeReport().c_str(), stderr); }
+
+}  // namespace rm::hal::linux_
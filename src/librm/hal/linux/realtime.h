@@ -0,0 +1,85 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/realtime.h
+ * @brief 线程实时性配置：SCHED_FIFO优先级、CPU亲和性、锁定内存、预先映射栈
+ */
+
+#ifndef LIBRM_HAL_LINUX_REALTIME_H
+#define LIBRM_HAL_LINUX_REALTIME_H
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "librm/core/typedefs.h"
+
+namespace rm::hal::linux_ {
+
+/**
+ * @brief 线程属性
+ * @note  SCHED_FIFO需要root权限或者CAP_SYS_NICE，否则会设置失败，失败的项目会记录在RealtimeReport()里
+ * @note  用法：
+ *        rm::hal::linux_::LockMemory();
+ *        rm::hal::linux_::ThreadAttributes can_attr{.priority = 80, .cpus = {3}};
+ *        can0.SetThreadAttributes(can_attr);
+ *        can0.Begin();
+ *        std::thread control([] {
+ *          rm::hal::linux_::ApplyThreadAttributes({.priority = 70, .cpus = {2}}, "control");
+ *          ...
+ *        });
+ *        rm::hal::linux_::PrintRealtimeReport();
+ */
+struct ThreadAttributes {
+  int priority{0};                ///< SCHED_FIFO优先级(1~99)，0表示保持默认的CFS调度
+  std::vector<int> cpus{};        ///< 允许线程运行的CPU核心，为空时不限制
+  usize prefault_stack_size{0};   ///< 预先写一遍的栈空间大小(字节)，配合LockMemory()避免运行时缺页，0表示不预先映射
+
+  /**
+   * @return 是否设置了任何属性
+   */
+  [[nodiscard]] bool empty() const { return priority == 0 && cpus.empty() && prefault_stack_size == 0; }
+};
+
+/**
+ * @brief 一个线程的属性实际生效的情况
+ */
+struct ThreadAttributesResult {
+  std::string name;
+  ThreadAttributes requested;
+  bool priority_granted;  ///< SCHED_FIFO优先级是否设置成功
+  bool affinity_granted;  ///< CPU亲和性是否设置成功
+  usize prefaulted_stack;  ///< 实际预先映射的栈空间大小(字节)
+};
+
+ThreadAttributesResult ApplyThreadAttributes(const ThreadAttributes &attributes, const std::string &name);
+ThreadAttributesResult ApplyThreadAttributes(std::thread &thread, const ThreadAttributes &attributes,
+                                             const std::string &name);
+bool LockMemory();
+void PrefaultStack(usize size);
+std::string RealtimeReport();
+void PrintRealtimeReport();
+
+}  // namespace rm::hal::linux_
+
+#endif  // LIBRM_HAL_LINUX_REALTIME_H
@@ -27,8 +27,12 @@
 
 #include "serial.h"
 
+#include <algorithm>
 #include <functional>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 namespace rm::hal::linux_ {
 
 Serial::Serial(const char *dev, usize baud, usize rx_buffer_size, std::chrono::milliseconds timeout)
@@ -41,9 +45,89 @@ Serial::Serial(const char *dev, usize baud, usize rx_buffer_size, std::chrono::m
   }
 }
 
-Serial::~Serial() { this->serial_.close(); }
+/**
+ * @param dev            串口设备名
+ * @param baud           波特率
+ * @param rx_buffer_size 接收缓冲区大小
+ * @param event_loop     负责接收的事件循环，多个SocketCan、Serial可以共用同一个
+ * @param write_timeout  发送超时时间
+ * @note  这种模式下不会创建任何线程，接收回调在事件循环的线程里调用，回调里不要阻塞
+ */
+Serial::Serial(const char *dev, usize baud, usize rx_buffer_size, EventLoop &event_loop,
+               std::chrono::milliseconds write_timeout)
+    : dev_(dev),
+      serial_(dev, baud, serial::Timeout::simpleTimeout(write_timeout.count())),
+      rx_buf_{std::vector<u8>(rx_buffer_size), std::vector<u8>(rx_buffer_size)},
+      event_loop_(&event_loop) {
+  if (!this->serial_.isOpen()) {
+    throw std::runtime_error("Failed to open serial port");
+  }
+  this->OpenRxFd(dev);
+}
+
+#if defined(LIBRM_USE_IO_URING)
+/**
+ * @param dev            串口设备名
+ * @param baud           波特率
+ * @param rx_buffer_size 接收缓冲区大小
+ * @param io_uring       负责接收的io_uring引擎，多个SocketCan、Serial可以共用同一个
+ * @param write_timeout  发送超时时间
+ * @note  这种模式下不会创建任何线程，接收回调在引擎线程里调用，回调里不要阻塞
+ */
+Serial::Serial(const char *dev, usize baud, usize rx_buffer_size, IoUringEngine &io_uring,
+               std::chrono::milliseconds write_timeout)
+    : dev_(dev),
+      serial_(dev, baud, serial::Timeout::simpleTimeout(write_timeout.count())),
+      rx_buf_{std::vector<u8>(rx_buffer_size), std::vector<u8>(rx_buffer_size)},
+      io_uring_(&io_uring) {
+  if (!this->serial_.isOpen()) {
+    throw std::runtime_error("Failed to open serial port");
+  }
+  this->OpenRxFd(dev);
+}
+#endif
 
-void Serial::Begin() { this->thread_pool_->enqueue(std::bind(&Serial::RecvThread, this)); }
+/**
+ * @brief 另外打开一个专门用来接收的文件描述符
+ * @note  serial::Serial没有暴露它的文件描述符，这里再以非阻塞方式打开一次同一个设备，
+ *        波特率等termios配置是跟着设备走的，serial_已经配置好了；io_uring模式下引擎会先等POLLIN再read，不会因为非阻塞空转
+ */
+void Serial::OpenRxFd(const char *dev) {
+  this->rx_fd_ = open(dev, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (this->rx_fd_ < 0) {
+    throw std::runtime_error("Failed to open serial port");
+  }
+}
+
+Serial::~Serial() {
+  if (this->event_loop_ != nullptr) {
+    this->event_loop_->Remove(this->rx_fd_);
+  }
+#if defined(LIBRM_USE_IO_URING)
+  if (this->io_uring_ != nullptr) {
+    this->io_uring_->Remove(this->rx_fd_);
+  }
+#endif
+  if (this->rx_fd_ >= 0) {
+    close(this->rx_fd_);
+  }
+  this->serial_.close();
+}
+
+void Serial::Begin() {
+  if (this->event_loop_ != nullptr) {
+    this->event_loop_->Add(this->rx_fd_, EPOLLIN, [this](u32) { this->OnReadable(); });
+    return;
+  }
+#if defined(LIBRM_USE_IO_URING)
+  if (this->io_uring_ != nullptr) {
+    this->io_uring_->AddRecv(this->rx_fd_, this->rx_buf_[0].size(), Serial::kIoUringBufferCount,
+                             [this](const u8 *data, usize size) { this->DeliverRx(data, size); });
+    return;
+  }
+#endif
+  this->thread_pool_->enqueue(std::bind(&Serial::RecvThread, this));
+}
 
 void Serial::Write(const u8 *data, usize size) {
   this->serial_.write(data, size);
@@ -54,7 +138,17 @@ void Serial::AttachRxCallback(SerialRxCallbackFunction &callback) { this->rx_cal
 
 [[nodiscard]] const std::vector<u8> &Serial::rx_buffer() const { return this->rx_buf_[this->buffer_selector_]; }
 
+/**
+ * @brief 设置接收线程的调度优先级、CPU亲和性等属性，需要在Begin()之前调用
+ * @param attributes 线程属性
+ * @note  使用EventLoop或者IoUringEngine时Serial没有自己的线程，应该设置它们的线程属性
+ */
+void Serial::SetThreadAttributes(const ThreadAttributes &attributes) { this->thread_attributes_ = attributes; }
+
 void Serial::RecvThread() {
+  if (!this->thread_attributes_.empty()) {
+    ApplyThreadAttributes(this->thread_attributes_, this->dev_.substr(this->dev_.rfind('/') + 1) + "-rx");
+  }
   for (;;) {
     auto bytes_read =
         this->serial_.read(this->rx_buf_[this->buffer_selector_], this->rx_buf_[this->buffer_selector_].size());
@@ -73,4 +167,32 @@ void Serial::RecvThread() {
   }
 }
 
-}  // namespace rm::hal::linux_
\ No newline at end of file
+/**
+ * @brief 串口可读时由事件循环调用，读出所有已经到达的数据，在事件循环线程里直接调用接收回调
+ */
+void Serial::OnReadable() {
+  const ssize_t bytes_read =
+      read(this->rx_fd_, this->rx_buf_[this->buffer_selector_].data(), this->rx_buf_[this->buffer_selector_].size());
+  if (bytes_read <= 0) {
+    return;
+  }
+  this->buffer_selector_ = !this->buffer_selector_;  // 切换缓冲区
+  if (this->rx_callback_ != nullptr) {
+    (*this->rx_callback_)(this->rx_buf_[!this->buffer_selector_], bytes_read);
+  }
+}
+
+/**
+ * @brief 把io_uring收到的数据拷贝进双缓冲，然后在引擎线程里直接调用接收回调
+ */
+void Serial::DeliverRx(const u8 *data, usize size) {
+  std::vector<u8> &buffer = this->rx_buf_[this->buffer_selector_];
+  size = std::min(size, buffer.size());
+  std::copy(data, data + size, buffer.begin());
+  this->buffer_selector_ = !this->buffer_selector_;  // 切换缓冲区
+  if (this->rx_callback_ != nullptr) {
+    (*this->rx_callback_)(buffer, size);
+  }
+}
+
+}  // namespace rm::hal::linux_
@@ -36,6 +36,9 @@
 
 #include "librm/hal/serial_interface.h"
 #include "librm/core/thread_pool.hpp"
+#include "librm/hal/linux/event_loop.h"
+#include "librm/hal/linux/io_uring_engine.h"
+#include "librm/hal/linux/realtime.h"
 
 namespace rm::hal::linux_ {
 
@@ -43,27 +46,50 @@ class Serial : public hal::SerialInterface {
  public:
   Serial() = delete;
   Serial(const char *dev, usize baud, usize rx_buffer_size, std::chrono::milliseconds timeout);
+  Serial(const char *dev, usize baud, usize rx_buffer_size, EventLoop &event_loop,
+         std::chrono::milliseconds write_timeout = std::chrono::milliseconds(100));
+#if defined(LIBRM_USE_IO_URING)
+  Serial(const char *dev, usize baud, usize rx_buffer_size, IoUringEngine &io_uring,
+         std::chrono::milliseconds write_timeout = std::chrono::milliseconds(100));
+#endif
   ~Serial() override;
 
   void Begin() override;
   void Write(const u8 *data, usize size) override;
   void AttachRxCallback(SerialRxCallbackFunction &callback) override;
   [[nodiscard]] const std::vector<u8> &rx_buffer() const override;
+  void SetThreadAttributes(const ThreadAttributes &attributes);
 
  private:
   void RecvThread();
+  void OnReadable();
+  void OpenRxFd(const char *dev);
+  void DeliverRx(const u8 *data, usize size);
 
   SerialRxCallbackFunction *rx_callback_{nullptr};
   serial::Serial serial_{};
   std::string dev_{};
 
   std::unique_ptr<core::ThreadPool> thread_pool_{};  // 线程池，用于异步调用回调函数和创建轮询线程
+  ThreadAttributes thread_attributes_{};  // 接收线程的属性
   std::mutex callback_mutex_{};  // 回调函数由用户编写，并不能保证线程安全，因此调用时需要加锁
 
   // 双缓冲，防止在回调函数中读取数据时被覆盖
   std::vector<u8> rx_buf_[2];
   bool buffer_selector_{false};
 
+  // 以下成员只在使用EventLoop或IoUringEngine时有效
+  EventLoop *event_loop_{nullptr};
+#if defined(LIBRM_USE_IO_URING)
+  IoUringEngine *io_uring_{nullptr};
+
+  /**
+   * @brief 使用IoUringEngine时给内核提供的接收缓冲区数量
+   */
+  static constexpr usize kIoUringBufferCount = 8;
+#endif
+  int rx_fd_{-1};  // 另外以非阻塞方式打开的同一个串口设备，注册到事件循环或io_uring上
+
   /**
    * @brief 最大线程数
    * @note  用于创建线程池
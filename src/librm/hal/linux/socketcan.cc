@@ -23,26 +23,270 @@
 /**
  * @file  librm/hal/linux/socketcan.cc
  * @brief SocketCAN类库
- * @todo  实现tx消息队列
  */
 
 #include "socketcan.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
+#include <ctime>
 
-#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <linux/can/error.h>
+#include <linux/can/netlink.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "librm/core/time.hpp"
+
+namespace {
+
+/**
+ * @param frame 收到的帧，经典CAN帧和CAN FD帧的内存布局前16字节是兼容的，所以统一用canfd_frame接收
+ * @param size  recvmmsg返回的帧大小，CANFD_MTU说明是CAN FD帧
+ * @param timestamp_us 接收时间戳(us)
+ * @param msg   转换结果
+ */
+void FrameToMsg(const struct ::canfd_frame &frame, rm::usize size, rm::u64 timestamp_us, rm::hal::CanMsg &msg) {
+  msg.rx_std_id = frame.can_id;
+  msg.timestamp_us = timestamp_us;
+  msg.dlc = frame.len;
+  msg.fd = size == CANFD_MTU;
+  msg.brs = msg.fd && (frame.flags & CANFD_BRS);
+  std::copy(frame.data, frame.data + frame.len, msg.data.begin());
+}
+
+/**
+ * @brief  从recvmmsg收到的控制消息里取出内核给这一帧打的接收时间戳
+ * @return 时间戳(us)，CLOCK_REALTIME，要减去RealtimeOffsetUs()才能和NowUs()比较；控制消息里没有时间戳时返回0
+ */
+rm::u64 ReadTimestamp(const struct ::msghdr &hdr) {
+  for (struct ::cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(const_cast<struct ::msghdr *>(&hdr), cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET) {
+      continue;
+    }
+    if (cmsg->cmsg_type == SO_TIMESTAMPING) {
+      // ts[0]是软件时间戳，ts[2]是网卡的硬件时间戳，硬件时间戳用的不是系统时钟，这里只用软件时间戳
+      struct ::scm_timestamping timestamping;
+      std::memcpy(&timestamping, CMSG_DATA(cmsg), sizeof(timestamping));
+      return static_cast<rm::u64>(timestamping.ts[0].tv_sec) * 1000000 + timestamping.ts[0].tv_nsec / 1000;
+    }
+    if (cmsg->cmsg_type == SO_TIMESTAMP) {
+      struct ::timeval tv;
+      std::memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+      return static_cast<rm::u64>(tv.tv_sec) * 1000000 + tv.tv_usec;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief  内核给报文打的软件时间戳是CLOCK_REALTIME，NowUs()是CLOCK_MONOTONIC，用两个时钟当前的差值来换算
+ * @return CLOCK_REALTIME - CLOCK_MONOTONIC(us)
+ * @note   系统时间被NTP或者手动调整时差值会变，所以每次收报文都重新取
+ */
+rm::u64 RealtimeOffsetUs() {
+  struct ::timespec realtime, monotonic;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  clock_gettime(CLOCK_MONOTONIC, &monotonic);
+  return (static_cast<rm::u64>(realtime.tv_sec) * 1000000 + realtime.tv_nsec / 1000) -
+         (static_cast<rm::u64>(monotonic.tv_sec) * 1000000 + monotonic.tv_nsec / 1000);
+}
+
+/**
+ * @return 要交给内核的帧大小，经典CAN帧是CAN_MTU，CAN FD帧是CANFD_MTU
+ */
+rm::usize MsgToFrame(const rm::hal::CanMsg &msg, struct ::canfd_frame &frame) {
+  frame.can_id = msg.rx_std_id;
+  frame.len = msg.dlc;
+  frame.flags = msg.brs ? CANFD_BRS : 0;
+  std::copy(msg.data.begin(), msg.data.begin() + msg.dlc, frame.data);
+  return msg.fd ? CANFD_MTU : CAN_MTU;
+}
+
+/**
+ * @brief  通过rtnetlink让内核重启一个处于bus-off的CAN网卡，相当于ip link set canX type can restart
+ * @param  ifindex  网卡编号
+ * @param  wait_ack 是否等内核回复，等待最多阻塞100ms；不等时只要请求发出去了就返回true，不会阻塞
+ * @return 内核确认重启成功时返回true；没有CAP_NET_ADMIN权限或者网卡不在bus-off状态时返回false
+ */
+bool RestartCanDevice(int ifindex, bool wait_ack = true) {
+  struct {
+    struct ::nlmsghdr header;
+    struct ::ifinfomsg info;
+    char attributes[64];
+  } request{};
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct ::ifinfomsg));
+  request.header.nlmsg_type = RTM_NEWLINK;
+  request.header.nlmsg_flags = NLM_F_REQUEST | (wait_ack ? NLM_F_ACK : 0);
+  request.info.ifi_family = AF_UNSPEC;
+  request.info.ifi_index = ifindex;
+
+  auto add_attribute = [&request](rm::u16 type, const void *data, rm::usize size) {
+    auto *attribute = reinterpret_cast<struct ::rtattr *>(reinterpret_cast<char *>(&request) +
+                                                          NLMSG_ALIGN(request.header.nlmsg_len));
+    attribute->rta_type = type;
+    attribute->rta_len = RTA_LENGTH(size);
+    if (size > 0) {
+      std::memcpy(RTA_DATA(attribute), data, size);
+    }
+    request.header.nlmsg_len = NLMSG_ALIGN(request.header.nlmsg_len) + RTA_ALIGN(attribute->rta_len);
+    return attribute;
+  };
+  auto end_nested = [&request](struct ::rtattr *attribute) {
+    attribute->rta_len = reinterpret_cast<char *>(&request) + request.header.nlmsg_len -
+                         reinterpret_cast<char *>(attribute);
+  };
+  // IFLA_LINKINFO { IFLA_INFO_KIND = "can", IFLA_INFO_DATA { IFLA_CAN_RESTART = 1 } }
+  const rm::u32 restart = 1;
+  struct ::rtattr *link_info = add_attribute(IFLA_LINKINFO, nullptr, 0);
+  add_attribute(IFLA_INFO_KIND, "can", 3);
+  struct ::rtattr *info_data = add_attribute(IFLA_INFO_DATA, nullptr, 0);
+  add_attribute(IFLA_CAN_RESTART, &restart, sizeof(restart));
+  end_nested(info_data);
+  end_nested(link_info);
+
+  const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    return false;
+  }
+  struct ::timeval timeout {
+    0, 100000
+  };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  struct ::sockaddr_nl kernel {};
+  kernel.nl_family = AF_NETLINK;
+  bool ok = sendto(fd, &request, request.header.nlmsg_len, 0, reinterpret_cast<struct ::sockaddr *>(&kernel),
+                   sizeof(kernel)) >= 0;
+  if (ok && wait_ack) {
+    char reply[256];
+    const ssize_t size = recv(fd, reply, sizeof(reply), 0);
+    const auto *header = reinterpret_cast<const struct ::nlmsghdr *>(reply);
+    ok = size >= static_cast<ssize_t>(NLMSG_LENGTH(sizeof(struct ::nlmsgerr))) && header->nlmsg_type == NLMSG_ERROR &&
+         reinterpret_cast<const struct ::nlmsgerr *>(NLMSG_DATA(header))->error == 0;
+  }
+  close(fd);
+  return ok;
+}
+
+}  // namespace
 
 namespace rm::hal::linux_ {
 
 /**
- * @param dev CAN设备名，使用ifconfig -a查看
+ * @param size    最多一次收发多少帧
+ * @param control 是否给每一帧分配控制消息缓冲区，接收时用来取时间戳
+ */
+SocketCan::MmsgBuffer::MmsgBuffer(usize size, bool control)
+    : frames(size), iov(size), headers(size), controls(control ? size : 0) {
+  for (usize i = 0; i < size; ++i) {
+    this->iov[i].iov_base = &this->frames[i];
+    this->iov[i].iov_len = sizeof(struct ::canfd_frame);
+    this->headers[i] = {};
+    this->headers[i].msg_hdr.msg_iov = &this->iov[i];
+    this->headers[i].msg_hdr.msg_iovlen = 1;
+  }
+  this->ResetControls();
+}
+
+/**
+ * @brief 恢复每个控制消息缓冲区的长度，内核每次接收都会把msg_controllen改成实际写入的长度，所以每次接收前都要调用
  */
-SocketCan::SocketCan(const char *dev) : dev_(dev) {
-  // 创建线程池
-  this->thread_pool_ = std::make_unique<core::ThreadPool>(SocketCan::kMaxThreads);
+void SocketCan::MmsgBuffer::ResetControls() {
+  for (usize i = 0; i < this->controls.size(); ++i) {
+    this->headers[i].msg_hdr.msg_control = this->controls[i].buffer;
+    this->headers[i].msg_hdr.msg_controllen = sizeof(this->controls[i].buffer);
+  }
 }
 
-SocketCan::~SocketCan() { this->Stop(); }
+/**
+ * @param dev           CAN设备名，使用ifconfig -a查看
+ * @param rx_mode       接收分发模式
+ * @param rx_queue_size kDispatcher模式下分发队列的长度
+ * @param io_batch_size 批量收发时每次系统调用最多处理的报文数量，为1时每帧一次系统调用
+ */
+SocketCan::SocketCan(const char *dev, SocketCanRxMode rx_mode, usize rx_queue_size, usize io_batch_size)
+    : dev_(dev), rx_mode_(rx_mode), io_batch_size_(std::max<usize>(io_batch_size, 1)) {
+  if (this->io_batch_size_ > 1) {
+    this->tx_batch_.reserve(this->io_batch_size_);
+    this->tx_batch_buffer_ = std::make_unique<MmsgBuffer>(this->io_batch_size_);
+  }
+  switch (rx_mode) {
+    case SocketCanRxMode::kThreadPool:
+      // 创建线程池
+      this->thread_pool_ = std::make_unique<core::ThreadPool>(SocketCan::kMaxThreads);
+      break;
+    case SocketCanRxMode::kDispatcher:
+      // 预先分配好分发队列，之后收发报文都不会再分配内存
+      this->rx_queue_ = std::make_unique<core::SpscQueue<CanMsg>>(rx_queue_size);
+      sem_init(&this->rx_queue_sem_, 0, 0);
+      break;
+    case SocketCanRxMode::kInline:
+    case SocketCanRxMode::kEventLoop:
+#if defined(LIBRM_USE_IO_URING)
+    case SocketCanRxMode::kIoUring:
+#endif
+      break;
+  }
+}
+
+/**
+ * @param dev           CAN设备名，使用ifconfig -a查看
+ * @param event_loop    负责收发的事件循环，多个SocketCan、Serial可以共用同一个
+ * @param io_batch_size 批量收发时每次系统调用最多处理的报文数量，为1时每帧一次系统调用
+ * @note  这种模式下SocketCan不会创建收发线程，设备回调在事件循环的线程里调用，回调里不要阻塞；
+ *        只有一个平时休眠的bus-off恢复线程
+ */
+SocketCan::SocketCan(const char *dev, EventLoop &event_loop, usize io_batch_size)
+    : SocketCan(dev, SocketCanRxMode::kEventLoop, 0, io_batch_size) {
+  this->event_loop_ = &event_loop;
+  this->loop_rx_buffer_ = std::make_unique<MmsgBuffer>(this->io_batch_size_, true);
+  this->loop_tx_buffer_ = std::make_unique<MmsgBuffer>(this->io_batch_size_);
+  this->loop_tx_pending_.resize(this->io_batch_size_);
+  // 在构造时就创建好，Begin()之前Enqueue的报文也能通知到事件循环
+  this->tx_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  this->tx_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  this->tx_batch_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (this->tx_event_fd_ < 0 || this->tx_timer_fd_ < 0 || this->tx_batch_timer_fd_ < 0) {
+    throw std::runtime_error(this->dev_ + " failed to create event fds");
+  }
+}
+
+#if defined(LIBRM_USE_IO_URING)
+/**
+ * @param dev           CAN设备名，使用ifconfig -a查看
+ * @param io_uring      负责接收的io_uring引擎，多个SocketCan、Serial可以共用同一个
+ * @param io_batch_size 发送线程每次系统调用最多发送的报文数量
+ * @note  这种模式下接收不需要单独的线程，也没有每帧一次的系统调用；发送仍然由发送线程负责
+ * @note  recv拿不到内核的时间戳，报文的时间戳是引擎线程处理完成事件时的时间
+ */
+SocketCan::SocketCan(const char *dev, IoUringEngine &io_uring, usize io_batch_size)
+    : SocketCan(dev, SocketCanRxMode::kIoUring, 0, io_batch_size) {
+  this->io_uring_ = &io_uring;
+}
+#endif
+
+SocketCan::~SocketCan() {
+  this->Stop();
+  if (this->rx_mode_ == SocketCanRxMode::kDispatcher) {
+    sem_destroy(&this->rx_queue_sem_);
+  }
+  if (this->tx_event_fd_ >= 0) {
+    close(this->tx_event_fd_);
+  }
+  if (this->tx_timer_fd_ >= 0) {
+    close(this->tx_timer_fd_);
+  }
+  if (this->tx_batch_timer_fd_ >= 0) {
+    close(this->tx_batch_timer_fd_);
+  }
+}
 
 /**
  * @brief 初始化SocketCan
@@ -65,109 +309,854 @@ void SocketCan::Begin() {
   this->addr_.can_family = AF_CAN;
   this->addr_.can_ifindex = this->interface_request_.ifr_ifindex;
 
-  // 配置过滤器，接收所有数据帧
-  this->SetFilter(0, 0);
+  // 如果网卡的MTU是CANFD_MTU，说明它支持CAN FD，打开CAN_RAW_FD_FRAMES以收发CAN FD帧
+  this->fd_enabled_ = false;
+  if (ioctl(this->socket_fd_, SIOCGIFMTU, &this->interface_request_) == 0 &&
+      this->interface_request_.ifr_mtu == CANFD_MTU) {
+    const int enable_fd = 1;
+    this->fd_enabled_ =
+        setsockopt(this->socket_fd_, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable_fd, sizeof(enable_fd)) == 0;
+  }
+
+  // 配置过滤器，只接收注册过的设备的报文；没有注册设备时接收所有数据帧
+  this->ApplyFilters();
+
+  // 接收所有种类的错误帧，用来跟踪控制器的错误状态；错误帧不受上面的ID过滤器影响
+  const can_err_mask_t error_mask = CAN_ERR_MASK;
+  setsockopt(this->socket_fd_, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &error_mask, sizeof(error_mask));
+
+  // 设置接收超时，让接收线程能定期检查是否需要退出
+  struct ::timeval recv_timeout {
+    0, SocketCan::kRecvTimeoutMs * 1000
+  };
+  setsockopt(this->socket_fd_, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout));
+
+  // 让内核给每一帧打上接收时间戳，优先用SO_TIMESTAMPING，老内核不支持时退回SO_TIMESTAMP
+  const int timestamping = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+  if (setsockopt(this->socket_fd_, SOL_SOCKET, SO_TIMESTAMPING, &timestamping, sizeof(timestamping)) != 0) {
+    const int enable_timestamp = 1;
+    setsockopt(this->socket_fd_, SOL_SOCKET, SO_TIMESTAMP, &enable_timestamp, sizeof(enable_timestamp));
+  }
 
   // 将套接字与can设备绑定
   bind(this->socket_fd_, (struct sockaddr *)&this->addr_, sizeof(this->addr_));
 
-  // 启动接收线程
-  this->thread_pool_->enqueue([this]() { this->RecvThread(); });
+  // WriteLoopback()用的第二个套接字：从它发出的报文会被内核回环给socket_fd_(CAN_RAW_LOOPBACK默认开启)，
+  // 这样本机的设备就在正常的接收路径上收到这一帧；它自己用空过滤器什么都不收
+  this->loopback_fd_ = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+  if (this->loopback_fd_ >= 0) {
+    setsockopt(this->loopback_fd_, SOL_CAN_RAW, CAN_RAW_FILTER, nullptr, 0);
+    if (this->fd_enabled_) {
+      const int enable_fd = 1;
+      setsockopt(this->loopback_fd_, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable_fd, sizeof(enable_fd));
+    }
+    bind(this->loopback_fd_, (struct sockaddr *)&this->addr_, sizeof(this->addr_));
+  }
+
+  this->running_ = true;
+  // 共享EventLoop/IoUringEngine的模式承诺不创建线程，bus-off恢复改为在接收路径上发一个不等回复的重启请求
+  if (!this->uses_shared_loop()) {
+    this->restart_thread_ = std::thread(&SocketCan::RestartThread, this);
+  }
+
+  // kEventLoop模式下把套接字、eventfd和timerfd注册到事件循环上，不创建线程
+  if (this->rx_mode_ == SocketCanRxMode::kEventLoop) {
+    if (this->event_loop_ == nullptr) {
+      throw std::runtime_error("kEventLoop mode requires an EventLoop, use SocketCan(dev, event_loop) instead");
+    }
+    fcntl(this->socket_fd_, F_SETFL, fcntl(this->socket_fd_, F_GETFL, 0) | O_NONBLOCK);
+    this->event_loop_->Add(this->socket_fd_, EPOLLIN,
+                           [this](u32) { this->ReceiveFrames(*this->loop_rx_buffer_, MSG_DONTWAIT); });
+    this->event_loop_->Add(this->tx_event_fd_, EPOLLIN, [this](u32) {
+      eventfd_t value;
+      eventfd_read(this->tx_event_fd_, &value);
+      this->tx_event_pending_ = false;
+      this->DrainTxQueue();
+    });
+    this->event_loop_->Add(this->tx_timer_fd_, EPOLLIN, [this](u32) {
+      u64 expirations;
+      if (read(this->tx_timer_fd_, &expirations, sizeof(expirations)) < 0) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(this->loop_tx_mutex_);
+        this->loop_tx_backoff_armed_ = false;
+      }
+      this->DrainTxQueue();
+    });
+    this->event_loop_->Add(this->tx_batch_timer_fd_, EPOLLIN, [this](u32) {
+      u64 expirations;
+      if (read(this->tx_batch_timer_fd_, &expirations, sizeof(expirations)) >= 0) {
+        this->Flush();
+      }
+    });
+    return;
+  }
+
+  // 启动发送线程和接收线程，kDispatcher模式下还要启动分发线程
+  this->send_thread_ = std::thread(&SocketCan::SendThread, this);
+  switch (this->rx_mode_) {
+    case SocketCanRxMode::kThreadPool:
+      this->recv_task_ = this->thread_pool_->enqueue([this]() { this->RecvThread(); });
+      break;
+    case SocketCanRxMode::kDispatcher:
+      this->dispatch_thread_ = std::thread(&SocketCan::DispatchThread, this);
+      this->recv_thread_ = std::thread(&SocketCan::RecvThread, this);
+      break;
+    case SocketCanRxMode::kInline:
+      this->recv_thread_ = std::thread(&SocketCan::RecvThread, this);
+      break;
+    case SocketCanRxMode::kEventLoop:
+      break;
+#if defined(LIBRM_USE_IO_URING)
+    case SocketCanRxMode::kIoUring:
+      if (this->io_uring_ == nullptr) {
+        throw std::runtime_error("kIoUring mode requires an IoUringEngine, use SocketCan(dev, io_uring) instead");
+      }
+      this->io_uring_->AddRecv(this->socket_fd_, sizeof(struct ::canfd_frame), SocketCan::kIoUringBufferCount,
+                               [this](const u8 *data, usize size) {
+                                 struct ::canfd_frame frame;
+                                 std::memcpy(&frame, data, std::min(size, sizeof(frame)));
+                                 if (frame.can_id & CAN_ERR_FLAG) {
+                                   this->HandleErrorFrame(frame);
+                                   return;
+                                 }
+                                 CanMsg msg;
+                                 FrameToMsg(frame, size, core::time::NowUs(), msg);
+                                 this->rx_frames_.fetch_add(1, std::memory_order_relaxed);
+                                 if (this->has_monitors()) {
+                                   this->ReportRx(msg, this->device_list_.Find(msg.rx_std_id) != nullptr);
+                                 }
+                                 this->Dispatch(msg, false);
+                               });
+      break;
+#endif
+  }
 }
 
 /**
+ * @brief 手动设置过滤器，调用之后不再根据注册的设备自动生成过滤器
  * @param id   过滤器ID
  * @param mask 过滤器掩码
  */
 void SocketCan::SetFilter(u16 id, u16 mask) {
-  this->filter_.can_id = id;
-  this->filter_.can_mask = mask;
-  setsockopt(this->socket_fd_, SOL_CAN_RAW, CAN_RAW_FILTER, &this->filter_, sizeof(this->filter_));
+  this->user_filter_ = true;
+  this->filters_.assign(1, {id, mask});
+  if (this->socket_fd_ >= 0) {
+    setsockopt(this->socket_fd_, SOL_CAN_RAW, CAN_RAW_FILTER, this->filters_.data(),
+               this->filters_.size() * sizeof(struct ::can_filter));
+  }
+}
+
+/**
+ * @brief 根据所有注册过的设备ID生成内核过滤器并安装到套接字上
+ * @note  不相关的报文(比如其他模块之间的通信)会直接在内核里被丢弃，不会被拷贝到用户态
+ */
+void SocketCan::ApplyFilters() {
+  if (!this->user_filter_) {
+    this->filters_.clear();
+    if (this->device_list_.empty()) {
+      this->filters_.push_back({0, 0});  // 没有注册任何设备，接收所有数据帧
+    } else {
+      std::vector<u32> ids;
+      ids.reserve(this->device_list_.size());
+      this->device_list_.ForEach([&ids](u32 id, AsyncCanDevice *) { ids.push_back(id); });
+      for (const auto &filter : BuildCanFilters(ids, SocketCan::kMaxKernelFilters)) {
+        // 掩码里带上EFF和RTR标志位，只接收标准数据帧
+        this->filters_.push_back({filter.id, filter.mask | CAN_EFF_FLAG | CAN_RTR_FLAG});
+      }
+    }
+  }
+  if (this->socket_fd_ >= 0) {
+    setsockopt(this->socket_fd_, SOL_CAN_RAW, CAN_RAW_FILTER, this->filters_.data(),
+               this->filters_.size() * sizeof(struct ::can_filter));
+  }
+}
+
+/**
+ * @brief 设置CAN FD帧的数据段是否切换到更高的位速率(BRS)
+ * @param enable 是否启用，默认启用
+ * @note  数据段位速率由网卡配置决定，比如ip link set can0 type can bitrate 1000000 dbitrate 5000000 fd on
+ */
+void SocketCan::SetBitRateSwitch(bool enable) { this->bit_rate_switch_ = enable; }
+
+/**
+ * @brief 设置SocketCan自己的接收、分发、发送线程的调度优先级、CPU亲和性等属性，需要在Begin()之前调用
+ * @param attributes 线程属性
+ * @note  kEventLoop和kIoUring模式下SocketCan没有自己的线程，应该设置EventLoop或者IoUringEngine的线程属性
+ * @note  kThreadPool模式下只对接收线程生效，线程池里调用设备回调的线程保持默认属性
+ */
+void SocketCan::SetThreadAttributes(const ThreadAttributes &attributes) { this->thread_attributes_ = attributes; }
+
+/**
+ * @return 一帧报文最多能发送多少字节，网卡支持CAN FD时是64，否则是8
+ * @note   调用Begin()之后才能确定网卡是否支持CAN FD
+ */
+usize SocketCan::max_data_length() const { return this->fd_enabled_ ? kCanMaxDataLength : 8; }
+
+/**
+ * @brief 把要发送的数据打包成一帧报文，超过8字节的数据会被补0到CAN FD支持的长度
+ */
+CanMsg SocketCan::MakeMsg(u16 id, const u8 *data, usize size) const {
+  if (size > this->max_data_length()) {
+    throw std::runtime_error("Data is too long for a CAN frame!");
+  }
+  CanMsg msg;
+  msg.rx_std_id = id;
+  msg.fd = size > 8;
+  msg.brs = msg.fd && this->bit_rate_switch_;
+  msg.dlc = msg.fd ? CanFdPaddedLength(size) : size;
+  msg.timestamp_us = 0;
+  std::copy(data, data + size, msg.data.begin());
+  std::fill(msg.data.begin() + size, msg.data.begin() + msg.dlc, 0);
+  return msg;
 }
 
 /**
  * @brief 立刻向总线上发送数据
  * @param id   数据帧ID
  * @param data 数据指针
- * @param size 数据长度/DLC
+ * @param size 数据长度，超过8字节时以CAN FD帧发送
+ * @note  这个函数不会阻塞，如果内核的发送队列已满，报文会被放进高优先级发送队列，由发送线程稍后重试
+ * @note  批量收发模式下报文会先暂存起来，凑满一批、调用Flush()或者暂存超过kBatchFlushDelayUs之后才会发出
  */
 void SocketCan::Write(u16 id, const u8 *data, usize size) {
-  struct ::can_frame frame;
-  frame.can_id = id;
-  frame.can_dlc = size;
-  std::copy(data, data + size, frame.data);
-  while (write(this->socket_fd_, &frame, sizeof(frame)) == -1) {
-    // 如果写入失败，就一直重试
+  const CanMsg msg = this->MakeMsg(id, data, size);
+
+  if (this->io_batch_size_ > 1) {
+    bool batch_full;
+    bool first;
+    {
+      std::lock_guard<std::mutex> lock(this->tx_batch_mutex_);
+      first = this->tx_batch_.empty();
+      this->tx_batch_.push_back(msg);
+      batch_full = this->tx_batch_.size() >= this->io_batch_size_;
+      if (first && !batch_full) {
+        this->ArmBatchFlush();
+      }
+    }
+    if (batch_full) {
+      this->Flush();
+    }
+    return;
+  }
+
+  static thread_local MmsgBuffer buffer{1};
+  if (this->SendFrames(buffer, &msg, 1) != 1) {
+    this->Requeue(msg);
+  }
+}
+
+/**
+ * @brief 暂存了第一帧报文时调用，让发送线程或者事件循环在kBatchFlushDelayUs之后发出暂存的报文；调用者要持有tx_batch_mutex_
+ */
+void SocketCan::ArmBatchFlush() {
+  const i64 now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now().time_since_epoch())
+                         .count();
+  this->tx_batch_deadline_ns_.store(now_ns + SocketCan::kBatchFlushDelayUs * 1000, std::memory_order_relaxed);
+  if (this->event_loop_ != nullptr) {
+    const struct ::itimerspec timeout {
+      {0, 0}, {0, SocketCan::kBatchFlushDelayUs * 1000}
+    };
+    timerfd_settime(this->tx_batch_timer_fd_, 0, &timeout, nullptr);
+    return;
+  }
+  {
+    // 发送线程在tx_queue_mutex_下检查截止时间，先拿一下锁，保证它要么看到了新的截止时间，要么已经在等待通知
+    std::lock_guard<std::mutex> lock(this->tx_queue_mutex_);
   }
+  this->tx_queue_cv_.notify_one();
 }
 
+/**
+ * @brief 用一次sendmmsg发出所有暂存的报文
+ * @note  只在批量收发模式下有用，比如在调用DjiMotor<>::SendCommand()之后调用一次，把这一轮的控制报文一起发出去
+ * @note  内核发送队列满而没能发出的报文会被放进高优先级发送队列，由发送线程稍后重试
+ */
+void SocketCan::Flush() {
+  if (this->io_batch_size_ <= 1) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(this->tx_batch_mutex_);
+  this->tx_batch_deadline_ns_.store(0, std::memory_order_relaxed);
+  if (this->tx_batch_.empty()) {
+    return;
+  }
+  const int sent = this->SendFrames(*this->tx_batch_buffer_, this->tx_batch_.data(), this->tx_batch_.size());
+  for (usize i = std::max(sent, 0); i < this->tx_batch_.size(); ++i) {
+    this->Requeue(this->tx_batch_[i]);
+  }
+  this->tx_batch_.clear();
+}
+
+/**
+ * @return 收发统计
+ */
+SocketCanIoStats SocketCan::io_stats() const {
+  return {
+      this->rx_frames_.load(std::memory_order_relaxed),
+      this->rx_syscalls_.load(std::memory_order_relaxed),
+      this->tx_frames_.load(std::memory_order_relaxed),
+      this->tx_syscalls_.load(std::memory_order_relaxed),
+  };
+}
+
+/**
+ * @brief 发送报文，同时让这个接口上的设备收到它
+ * @note  报文从另一个套接字发出，由内核回环给接收用的套接字，所以设备回调在正常的接收线程/事件循环里调用，
+ *        和其他报文的顺序、并发规则完全一样；网卡要开启回环(CAN网卡默认开启)
+ * @note  这个函数不会阻塞，内核发送队列满时报文直接丢弃，计入tx_error_count()并通知OnTxDrop
+ */
+void SocketCan::WriteLoopback(u16 id, const u8 *data, usize size) {
+  const CanMsg msg = this->MakeMsg(id, data, size);
+  struct ::canfd_frame frame {};
+  const usize frame_size = MsgToFrame(msg, frame);
+  if (this->loopback_fd_ < 0 || send(this->loopback_fd_, &frame, frame_size, MSG_DONTWAIT) < 0) {
+    this->tx_error_count_.fetch_add(1, std::memory_order_relaxed);
+    this->ReportTxDrop(msg);
+    return;
+  }
+  this->tx_frames_.fetch_add(1, std::memory_order_relaxed);
+  this->tx_syscalls_.fetch_add(1, std::memory_order_relaxed);
+  this->ReportTx(msg);
+}
+
+/**
+ * @brief 从消息队列里取出一条消息，在调用者的线程里立刻发送
+ * @note  发送线程会自动清空消息队列，一般不需要手动调用这个函数
+ */
 void SocketCan::Write() {
-  // TODO: tx消息队列
+  CanMsg msg;
+  usize depth;
+  {
+    std::lock_guard<std::mutex> lock(this->tx_queue_mutex_);
+    if (!this->tx_queue_.Pop(msg)) {
+      return;
+    }
+    depth = this->tx_queue_.size();
+  }
+  this->ReportTxQueueDepth(depth);
+  static thread_local MmsgBuffer buffer{1};
+  if (this->SendFrames(buffer, &msg, 1) != 1) {
+    this->Requeue(msg);
+  }
 }
 
+/**
+ * @brief 向消息队列里加入一条消息，由发送线程按优先级发送
+ * @param id        数据帧ID
+ * @param data      数据指针
+ * @param size      数据长度
+ * @param priority  消息的优先级
+ */
 void SocketCan::Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) {
-  // TODO: tx消息队列
+  const CanMsg msg = this->MakeMsg(id, data, size);
+  usize depth;
+  {
+    std::lock_guard<std::mutex> lock(this->tx_queue_mutex_);
+    if (!this->tx_queue_.Push(msg, priority)) {
+      this->ReportTxDrop(msg);  // 队列满，丢弃这一帧
+      return;
+    }
+    depth = this->tx_queue_.size();
+  }
+  this->ReportTxQueueDepth(depth);
+  this->NotifyTx();
+}
+
+/**
+ * @brief 把没能立刻发出的报文放进高优先级发送队列，由发送线程稍后重试
+ */
+void SocketCan::Requeue(const CanMsg &msg) {
+  usize depth;
+  {
+    std::lock_guard<std::mutex> lock(this->tx_queue_mutex_);
+    if (!this->tx_queue_.Push(msg, CanTxPriority::kHigh)) {
+      this->ReportTxDrop(msg);  // 队列满，丢弃这一帧
+      return;
+    }
+    depth = this->tx_queue_.size();
+  }
+  this->ReportTxQueueDepth(depth);
+  this->NotifyTx();
+}
+
+/**
+ * @brief 通知发送线程或事件循环，发送队列里有新报文了
+ */
+void SocketCan::NotifyTx() {
+  if (this->event_loop_ == nullptr) {
+    this->tx_queue_cv_.notify_one();
+    return;
+  }
+  // 事件循环还没处理上一次通知时，不用重复写eventfd
+  if (!this->tx_event_pending_.exchange(true)) {
+    eventfd_write(this->tx_event_fd_, 1);
+  }
+}
+
+/**
+ * @param  priority 优先级
+ * @return 这个优先级的发送队列满而被丢弃的报文数量
+ */
+usize SocketCan::tx_drop_count(CanTxPriority priority) {
+  std::lock_guard<std::mutex> lock(this->tx_queue_mutex_);
+  return this->tx_queue_.dropped(priority);
 }
 
 /**
  * @brief 停止CAN外设
  */
 void SocketCan::Stop() {
-  close(this->socket_fd_);  // 关闭套接字
+  // 通知接收线程和分发线程退出，并等待它们结束
+  this->running_ = false;
+  this->tx_queue_cv_.notify_all();
+  if (this->rx_mode_ == SocketCanRxMode::kDispatcher) {
+    sem_post(&this->rx_queue_sem_);
+  }
+  if (this->recv_thread_.joinable()) {
+    this->recv_thread_.join();
+  }
+  if (this->recv_task_.valid()) {
+    this->recv_task_.wait();  // recvmmsg最多阻塞kRecvTimeoutMs就会返回检查running_
+    this->recv_task_ = {};
+  }
+  if (this->dispatch_thread_.joinable()) {
+    this->dispatch_thread_.join();
+  }
+  if (this->send_thread_.joinable()) {
+    this->send_thread_.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->restart_mutex_);
+  }
+  this->restart_cv_.notify_all();
+  if (this->restart_thread_.joinable()) {
+    this->restart_thread_.join();  // 正在进行的重启最多阻塞100ms
+  }
+  // 从事件循环上注销，Remove()返回后就不会再有回调了
+  if (this->event_loop_ != nullptr && this->socket_fd_ >= 0) {
+    this->event_loop_->Remove(this->socket_fd_);
+    this->event_loop_->Remove(this->tx_event_fd_);
+    this->event_loop_->Remove(this->tx_timer_fd_);
+    this->event_loop_->Remove(this->tx_batch_timer_fd_);
+  }
+#if defined(LIBRM_USE_IO_URING)
+  if (this->io_uring_ != nullptr && this->socket_fd_ >= 0) {
+    this->io_uring_->Remove(this->socket_fd_);
+  }
+#endif
+  if (this->socket_fd_ >= 0) {
+    close(this->socket_fd_);  // 关闭套接字
+    this->socket_fd_ = -1;
+  }
+  if (this->loopback_fd_ >= 0) {
+    close(this->loopback_fd_);
+    this->loopback_fd_ = -1;
+  }
 }
 
 /**
  * @brief 接收线程，轮询接收报文并分发给对应ID的设备
+ * @note  每次用recvmmsg最多收io_batch_size_帧，至少收到一帧就会返回
  */
 void SocketCan::RecvThread() {
-  struct ::can_frame frame;
+  if (!this->thread_attributes_.empty()) {
+    ApplyThreadAttributes(this->thread_attributes_, this->dev_ + "-rx");
+  }
+  MmsgBuffer buffer{this->io_batch_size_, true};
+  while (this->running_) {
+    this->ReceiveFrames(buffer, MSG_WAITFORONE);
+  }
+}
+
+/**
+ * @brief  用一次recvmmsg接收若干帧报文，并按照接收分发模式交给设备
+ * @param  buffer 接收缓冲区
+ * @param  flags  recvmmsg的flags，接收线程里用MSG_WAITFORONE，事件循环里用MSG_DONTWAIT
+ * @return 收到的报文数量
+ */
+int SocketCan::ReceiveFrames(MmsgBuffer &buffer, int flags) {
+  CanMsg msg;
+  buffer.ResetControls();
+  const int received = recvmmsg(this->socket_fd_, buffer.headers.data(), buffer.headers.size(), flags, nullptr);
+  if (received <= 0) {
+    return 0;
+  }
+  this->rx_syscalls_.fetch_add(1, std::memory_order_relaxed);
+  this->rx_frames_.fetch_add(received, std::memory_order_relaxed);
+
+  const u64 realtime_offset_us = RealtimeOffsetUs();
+  for (int i = 0; i < received; ++i) {
+    if (buffer.frames[i].can_id & CAN_ERR_FLAG) {
+      this->HandleErrorFrame(buffer.frames[i]);
+      continue;
+    }
+    u64 timestamp_us = ReadTimestamp(buffer.headers[i].msg_hdr);
+    if (timestamp_us > realtime_offset_us) {
+      timestamp_us -= realtime_offset_us;
+    } else {
+      timestamp_us = core::time::NowUs();  // 内核没有给时间戳，退而求其次用收到的时间
+    }
+    FrameToMsg(buffer.frames[i], buffer.headers[i].msg_len, timestamp_us, msg);
+    if (this->has_monitors()) {
+      this->ReportRx(msg, this->device_list_.Find(msg.rx_std_id) != nullptr);
+    }
+    switch (this->rx_mode_) {
+      case SocketCanRxMode::kThreadPool:
+        // 异步调用Dispatch处理后续逻辑；之后立刻返回再次接收，防止漏收或延迟
+        this->thread_pool_->enqueue([this, msg]() { this->Dispatch(msg, true); });
+        break;
+      case SocketCanRxMode::kDispatcher:
+        // 写入分发队列后唤醒分发线程；队列满说明分发线程处理不过来，只能丢弃这一帧
+        if (this->rx_queue_->Push(msg)) {
+          sem_post(&this->rx_queue_sem_);
+        } else {
+          this->rx_overflow_count_.fetch_add(1, std::memory_order_relaxed);
+          this->ReportRxDrop(msg);
+        }
+        break;
+      default:
+        this->Dispatch(msg, false);
+        break;
+    }
+  }
+  return received;
+}
+
+/**
+ * @brief 处理内核发来的错误帧，跟踪控制器的错误状态；进入bus-off时清空发送队列，并且按设置自动重启控制器
+ * @note  错误帧的格式见linux/can/error.h
+ * @note  在接收路径上调用，不能阻塞；重启控制器交给恢复线程去做
+ */
+void SocketCan::HandleErrorFrame(const struct ::canfd_frame &frame) {
+  const canid_t error_class = frame.can_id & CAN_ERR_MASK;
+  this->error_frames_.fetch_add(1, std::memory_order_relaxed);
+#if defined(CAN_ERR_CNT)
+  if (error_class & CAN_ERR_CNT) {
+    this->bus_tx_error_count_.store(frame.data[6], std::memory_order_relaxed);
+    this->bus_rx_error_count_.store(frame.data[7], std::memory_order_relaxed);
+  }
+#endif
+
+  const CanBusState previous = this->bus_state_.load(std::memory_order_relaxed);
+  CanBusState state = previous;
+  if (error_class & CAN_ERR_BUSOFF) {
+    state = CanBusState::kBusOff;
+  } else if (error_class & CAN_ERR_RESTARTED) {
+    state = CanBusState::kErrorActive;
+    this->restart_count_.fetch_add(1, std::memory_order_relaxed);
+  } else if (error_class & CAN_ERR_CRTL) {
+    const u8 controller = frame.data[1];
+    if (controller & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE)) {
+      state = CanBusState::kErrorPassive;
+    } else if (controller & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING)) {
+      state = CanBusState::kErrorWarning;
+    }
+#if defined(CAN_ERR_CRTL_ACTIVE)
+    else if (controller & CAN_ERR_CRTL_ACTIVE) {
+      state = CanBusState::kErrorActive;
+    }
+#endif
+  }
+  if (state == previous) {
+    return;
+  }
+  this->bus_state_.store(state, std::memory_order_relaxed);
+  this->ReportBusState(state);
+  if (state == CanBusState::kBusOff) {
+    this->bus_off_count_.fetch_add(1, std::memory_order_relaxed);
+    this->FlushTxQueue();
+    if (this->auto_restart_ && this->uses_shared_loop()) {
+      RestartCanDevice(this->addr_.can_ifindex, false);
+    } else if (this->auto_restart_) {
+      {
+        std::lock_guard<std::mutex> lock(this->restart_mutex_);
+        this->restart_pending_ = true;
+      }
+      this->restart_cv_.notify_one();
+    }
+  }
+}
+
+/**
+ * @brief 丢弃发送队列和批量发送缓冲区里还没发出去的报文
+ */
+void SocketCan::FlushTxQueue() {
+  CanMsg msg;
+  {
+    std::lock_guard<std::mutex> lock(this->tx_queue_mutex_);
+    while (this->tx_queue_.Pop(msg)) {
+      this->tx_flushed_.fetch_add(1, std::memory_order_relaxed);
+      this->ReportTxDrop(msg);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->tx_batch_mutex_);
+    for (const auto &batched : this->tx_batch_) {
+      this->tx_flushed_.fetch_add(1, std::memory_order_relaxed);
+      this->ReportTxDrop(batched);
+    }
+    this->tx_batch_.clear();
+  }
+  this->ReportTxQueueDepth(0);
+}
+
+/**
+ * @brief 设置进入bus-off时是否自动重启控制器，默认开启
+ * @note  重启要通过rtnetlink完成，需要CAP_NET_ADMIN权限；没有权限时可以用
+ *        ip link set canX type can restart-ms 10 让内核自己定时重启，两种方式可以同时使用
+ */
+void SocketCan::SetAutoRestart(bool enable) { this->auto_restart_ = enable; }
+
+/**
+ * @brief  让内核立刻重启处于bus-off状态的控制器，相当于ip link set canX type can restart
+ * @return 重启成功时返回true；没有权限或者控制器不在bus-off状态时返回false
+ */
+bool SocketCan::Restart() { return RestartCanDevice(this->addr_.can_ifindex); }
+
+/**
+ * @return 控制器的错误状态和错误计数
+ * @note   TEC/REC只有内核在错误帧里带上计数时(CAN_ERR_CNT，较新的内核)才会更新，是最后一次错误帧时的值
+ */
+CanErrorCounters SocketCan::error_counters() const {
+  return {
+      this->bus_state_.load(std::memory_order_relaxed),
+      this->bus_tx_error_count_.load(std::memory_order_relaxed),
+      this->bus_rx_error_count_.load(std::memory_order_relaxed),
+      this->error_frames_.load(std::memory_order_relaxed),
+      this->bus_off_count_.load(std::memory_order_relaxed),
+      this->restart_count_.load(std::memory_order_relaxed),
+      this->tx_flushed_.load(std::memory_order_relaxed),
+  };
+}
+
+/**
+ * @brief 分发线程，按到达顺序从分发队列里取出报文并调用设备的回调函数
+ * @note  只在kDispatcher模式下运行，所有回调都在这一个线程里调用，所以不需要给设备加锁
+ */
+void SocketCan::DispatchThread() {
+  if (!this->thread_attributes_.empty()) {
+    ApplyThreadAttributes(this->thread_attributes_, this->dev_ + "-dispatch");
+  }
+  CanMsg msg;
   for (;;) {
-    if (read(this->socket_fd_, &frame, sizeof(frame)) <= 0) {
+    sem_wait(&this->rx_queue_sem_);
+    if (!this->rx_queue_->Pop(msg)) {
+      if (!this->running_) {
+        return;  // 队列已经空了，并且收到了退出信号
+      }
       continue;
     }
-    // 如果接收成功，就异步调用RxCallbackCallWorker处理后续逻辑；之后立刻返回再次接收，防止漏收或延迟
-    this->thread_pool_->enqueue(
-        [this, frame]() { this->RxCallbackCallWorker(std::move(std::make_unique<struct can_frame>(frame))); });
+    this->Dispatch(msg, false);
+  }
+}
+
+/**
+ * @brief bus-off恢复线程，等待HandleErrorFrame()的重启请求并调用Restart()
+ * @note  Restart()要等内核通过netlink回复，最多阻塞100ms，放在这里做不会卡住接收线程；
+ *        kEventLoop和kIoUring模式下不创建这个线程，见HandleErrorFrame()
+ */
+void SocketCan::RestartThread() {
+  std::unique_lock<std::mutex> lock(this->restart_mutex_);
+  for (;;) {
+    this->restart_cv_.wait(lock, [this] { return !this->running_ || this->restart_pending_; });
+    if (!this->running_) {
+      return;
+    }
+    this->restart_pending_ = false;
+    lock.unlock();
+    this->Restart();
+    lock.lock();
   }
 }
 
 /**
  * @brief 发送线程，循环按优先级发送消息队列里的报文
+ * @note  每次最多取出io_batch_size_帧，用一次sendmmsg发送
+ * @note  内核发送队列满(ENOBUFS)时，用poll按指数退避等待后重试没发出去的报文，而不是忙等
+ * @note  批量收发模式下，Write()暂存的报文超过kBatchFlushDelayUs还没发出时，也由发送线程调用Flush()发出
  */
 void SocketCan::SendThread() {
-  // TODO: tx消息队列
+  if (!this->thread_attributes_.empty()) {
+    ApplyThreadAttributes(this->thread_attributes_, this->dev_ + "-tx");
+  }
+  MmsgBuffer buffer{this->io_batch_size_};
+  std::vector<CanMsg> pending(this->io_batch_size_);
+  for (;;) {
+    usize count = 0;
+    usize depth;
+    {
+      std::unique_lock<std::mutex> lock(this->tx_queue_mutex_);
+      for (;;) {
+        if (!this->running_) {
+          return;
+        }
+        if (!this->tx_queue_.empty()) {
+          break;
+        }
+        const i64 deadline_ns = this->tx_batch_deadline_ns_.load(std::memory_order_relaxed);
+        if (deadline_ns == 0) {
+          this->tx_queue_cv_.wait(lock);
+          continue;
+        }
+        const std::chrono::steady_clock::time_point deadline{std::chrono::nanoseconds(deadline_ns)};
+        if (std::chrono::steady_clock::now() < deadline) {
+          this->tx_queue_cv_.wait_until(lock, deadline);
+          continue;
+        }
+        // Flush()会拿tx_batch_mutex_再拿tx_queue_mutex_，这里要先放掉锁
+        lock.unlock();
+        this->Flush();
+        lock.lock();
+      }
+      while (count < pending.size() && this->tx_queue_.Pop(pending[count])) {
+        ++count;
+      }
+      depth = this->tx_queue_.size();
+    }
+    this->ReportTxQueueDepth(depth);
+
+    usize sent = 0;
+    long backoff_us = SocketCan::kTxBackoffMinUs;
+    while (sent < count) {
+      const int result = this->SendFrames(buffer, pending.data() + sent, count - sent);
+      if (result > 0) {
+        sent += result;
+        backoff_us = SocketCan::kTxBackoffMinUs;
+        continue;
+      }
+      if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+        this->ReportTxDrop(pending[sent]);
+        ++sent;  // 其他错误重试也没用，丢弃这一帧
+        this->tx_error_count_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      if (!this->running_) {
+        return;
+      }
+      const struct ::timespec timeout {
+        0, backoff_us * 1000
+      };
+      ppoll(nullptr, 0, &timeout, nullptr);
+      backoff_us = std::min(backoff_us * 2, SocketCan::kTxBackoffMaxUs);
+    }
+  }
 }
 
 /**
- * @brief worker线程，异步调用设备的Rx回调函数
- * @note  调用者为RecvThread
+ * @brief 事件循环模式下的发送逻辑，和SendThread做的事情一样，但是不会阻塞
+ * @note  内核发送队列满时用timerfd按指数退避定时，到时间后事件循环再调用这个函数接着发
  */
-void SocketCan::RxCallbackCallWorker(std::unique_ptr<struct ::can_frame> msg) {
-  // 根据报文ID找到对应的设备，如果找到了的话就调用它的rx回调函数
-  auto receipient_device = this->device_list_.find(msg->can_id);
-  if (receipient_device != this->device_list_.end()) {
-    // 封包
-    CanMsg msg_packet;
-    msg_packet.rx_std_id = msg->can_id;
-    msg_packet.dlc = msg->can_dlc;
-    std::copy(msg->data, msg->data + msg->can_dlc, msg_packet.data.begin());
+void SocketCan::DrainTxQueue() {
+  std::lock_guard<std::mutex> lock(this->loop_tx_mutex_);
+  if (this->loop_tx_backoff_armed_) {
+    return;  // 正在退避，等定时器到期再发
+  }
+  for (;;) {
+    if (this->loop_tx_sent_ == this->loop_tx_count_) {
+      // 上一批已经发完了，从发送队列里再取一批
+      this->loop_tx_sent_ = this->loop_tx_count_ = 0;
+      usize depth;
+      {
+        std::lock_guard<std::mutex> queue_lock(this->tx_queue_mutex_);
+        while (this->loop_tx_count_ < this->loop_tx_pending_.size() &&
+               this->tx_queue_.Pop(this->loop_tx_pending_[this->loop_tx_count_])) {
+          ++this->loop_tx_count_;
+        }
+        depth = this->tx_queue_.size();
+      }
+      this->ReportTxQueueDepth(depth);
+      if (this->loop_tx_count_ == 0) {
+        return;
+      }
+    }
+    const int result = this->SendFrames(*this->loop_tx_buffer_, this->loop_tx_pending_.data() + this->loop_tx_sent_,
+                                        this->loop_tx_count_ - this->loop_tx_sent_);
+    if (result > 0) {
+      this->loop_tx_sent_ += result;
+      this->loop_tx_backoff_us_ = SocketCan::kTxBackoffMinUs;
+      continue;
+    }
+    if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+      this->ReportTxDrop(this->loop_tx_pending_[this->loop_tx_sent_]);
+      ++this->loop_tx_sent_;  // 其他错误重试也没用，丢弃这一帧
+      this->tx_error_count_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    const struct ::itimerspec timeout {
+      {0, 0}, {0, this->loop_tx_backoff_us_ * 1000}
+    };
+    timerfd_settime(this->tx_timer_fd_, 0, &timeout, nullptr);
+    this->loop_tx_backoff_armed_ = true;
+    this->loop_tx_backoff_us_ = std::min(this->loop_tx_backoff_us_ * 2, SocketCan::kTxBackoffMaxUs);
+    return;
+  }
+}
 
-    // 给这个设备加锁，然后调用它的回调函数
-    {
-      std::lock_guard<std::mutex> lock(receipient_device->second->mutex);
-      receipient_device->second->dev->RxCallback(&msg_packet);
+/**
+ * @brief  尝试用一次sendmmsg把若干帧报文交给内核发送，不会阻塞
+ * @param  buffer 发送缓冲区，容量不能小于count
+ * @param  msgs   要发送的报文
+ * @param  count  报文数量
+ * @return 成功发出的报文数量，一帧都没发出时返回-1，失败原因见errno
+ */
+int SocketCan::SendFrames(MmsgBuffer &buffer, const CanMsg *msgs, usize count) {
+  for (usize i = 0; i < count; ++i) {
+    buffer.iov[i].iov_len = MsgToFrame(msgs[i], buffer.frames[i]);
+  }
+  const int sent = sendmmsg(this->socket_fd_, buffer.headers.data(), count, MSG_DONTWAIT);
+  this->tx_syscalls_.fetch_add(1, std::memory_order_relaxed);
+  if (sent > 0) {
+    this->tx_frames_.fetch_add(sent, std::memory_order_relaxed);
+    if (this->has_monitors()) {
+      for (int i = 0; i < sent; ++i) {
+        this->ReportTx(msgs[i]);
+      }
     }
   }
+  return sent;
+}
+
+/**
+ * @brief 根据报文ID找到对应的设备，调用它的Rx回调函数
+ * @param msg  收到的报文
+ * @param lock 是否需要给设备加锁，只有多个线程会同时调用回调的kThreadPool模式才需要
+ * @note  快速路径不加锁，所以kThreadPool模式下不走快速路径
+ */
+void SocketCan::Dispatch(const CanMsg &msg, bool lock) {
+  if (!lock && this->TryRxFastPath(msg)) {
+    return;
+  }
+  AsyncCanDevice *receipient_device = this->device_list_.Find(msg.rx_std_id);
+  if (receipient_device == nullptr) {
+    return;
+  }
+  if (lock) {
+    std::lock_guard<std::mutex> guard(receipient_device->mutex);
+    receipient_device->dev->Deliver(msg);
+  } else {
+    receipient_device->dev->Deliver(msg);
+  }
 }
 
 /**
  * @brief 注册CAN设备
  * @param device 设备对象
  * @param rx_stdid 这个设备的rx消息标准帧id
+ * @note  必须在Begin()之前注册：接收线程查设备表时不加锁，而且设备是在CanDevice的构造函数里注册的，
+ *        这时派生类还没构造完，收到报文就会调用到没构造好的对象
  */
 void SocketCan::RegisterDevice(device::CanDevice &device, u32 rx_stdid) {
-  // TODO: 冲突检查，如果已经有这个ID的设备了就抛出异常
-  this->device_list_[rx_stdid] = new AsyncCanDevice(device);
+  if (this->running_) {
+    throw std::runtime_error(this->dev_ + ": devices must be registered before Begin()");
+  }
+  auto async_device = std::make_unique<AsyncCanDevice>(device);
+  if (!this->device_list_.Insert(rx_stdid, async_device.get())) {
+    throw std::runtime_error("Device already registered");
+  }
+  this->async_devices_.push_back(std::move(async_device));
 }
 
 }  // namespace rm::hal::linux_
\ No newline at end of file
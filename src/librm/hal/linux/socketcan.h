@@ -23,17 +23,21 @@
 /**
  * @file  librm/hal/linux/socketcan.h
  * @brief SocketCAN类库
- * @todo  实现tx消息队列
  */
 
 #ifndef LIBRM_HAL_LINUX_SOCKETCAN_H
 #define LIBRM_HAL_LINUX_SOCKETCAN_H
 
 #include <string>
-#include <deque>
+#include <vector>
 #include <memory>
-#include <unordered_map>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <future>
+
+#include <semaphore.h>
 
 #include <fcntl.h>
 #include <linux/can.h>
@@ -45,7 +49,14 @@
 
 #include "librm/device/can_device.hpp"
 #include "librm/hal/can_interface.h"
+#include "librm/hal/can_tx_queue.hpp"
+#include "librm/hal/can_filter.hpp"
+#include "librm/hal/can_device_table.hpp"
 #include "librm/core/thread_pool.hpp"
+#include "librm/core/spsc_queue.hpp"
+#include "librm/hal/linux/event_loop.h"
+#include "librm/hal/linux/io_uring_engine.h"
+#include "librm/hal/linux/realtime.h"
 
 namespace rm::hal::linux_ {
 
@@ -59,9 +70,40 @@ struct AsyncCanDevice {
   device::CanDevice *dev;
 };
 
+/**
+ * @brief SocketCan的接收分发模式
+ */
+enum class SocketCanRxMode {
+  kThreadPool,  ///< 每收到一帧就投递到线程池里异步调用设备回调，不保证同一设备的报文按顺序处理
+  kDispatcher,  ///< 接收线程把报文写入预分配的无锁环形队列，由唯一的分发线程按到达顺序调用设备回调
+  kInline,      ///< 接收线程收到报文后直接调用设备回调，延迟最低，但回调耗时会阻塞接收
+  kEventLoop,   ///< 不创建任何线程，收发都由共享的EventLoop完成，设备回调在事件循环线程里调用；使用带EventLoop参数的构造函数时自动选择
+#if defined(LIBRM_USE_IO_URING)
+  kIoUring,  ///< 由共享的IoUringEngine用multishot recv批量接收，设备回调在引擎线程里调用；使用带IoUringEngine参数的构造函数时自动选择
+#endif
+};
+
+/**
+ * @brief SocketCan的收发统计，用来评估批量收发的效果
+ */
+struct SocketCanIoStats {
+  u64 rx_frames;    ///< 收到的报文数量
+  u64 rx_syscalls;  ///< 接收用的系统调用次数
+  u64 tx_frames;    ///< 发出的报文数量
+  u64 tx_syscalls;  ///< 发送用的系统调用次数
+
+  [[nodiscard]] f64 rx_frames_per_syscall() const { return rx_syscalls == 0 ? 0 : (f64)rx_frames / rx_syscalls; }
+  [[nodiscard]] f64 tx_frames_per_syscall() const { return tx_syscalls == 0 ? 0 : (f64)tx_frames / tx_syscalls; }
+};
+
 class SocketCan : public hal::CanInterface {
  public:
-  explicit SocketCan(const char *dev);
+  explicit SocketCan(const char *dev, SocketCanRxMode rx_mode = SocketCanRxMode::kThreadPool,
+                     usize rx_queue_size = kDefaultRxQueueSize, usize io_batch_size = 1);
+  SocketCan(const char *dev, EventLoop &event_loop, usize io_batch_size = 1);
+#if defined(LIBRM_USE_IO_URING)
+  SocketCan(const char *dev, IoUringEngine &io_uring, usize io_batch_size = 1);
+#endif
   SocketCan() = default;
   ~SocketCan() override;
 
@@ -71,44 +113,215 @@ class SocketCan : public hal::CanInterface {
 
   void SetFilter(u16 id, u16 mask) override;
   void Write(u16 id, const u8 *data, usize size) override;
+  void WriteLoopback(u16 id, const u8 *data, usize size) override;
   void Write() override;
   void Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) override;
   void Begin() override;
   void Stop() override;
+  void Flush();
+  void SetBitRateSwitch(bool enable);
+  void SetThreadAttributes(const ThreadAttributes &attributes);
+  [[nodiscard]] usize max_data_length() const override;
+
+  /**
+   * @return 收发统计
+   */
+  [[nodiscard]] SocketCanIoStats io_stats() const;
+
+  /**
+   * @return 分发队列满而被丢弃的报文数量，仅在kDispatcher模式下有意义
+   */
+  [[nodiscard]] usize rx_overflow_count() const { return this->rx_overflow_count_.load(std::memory_order_relaxed); }
+
+  /**
+   * @param  priority 优先级
+   * @return 这个优先级的发送队列满而被丢弃的报文数量
+   */
+  [[nodiscard]] usize tx_drop_count(CanTxPriority priority);
+
+  /**
+   * @return 因为除ENOBUFS以外的错误发送失败而被丢弃的报文数量
+   */
+  [[nodiscard]] usize tx_error_count() const { return this->tx_error_count_.load(std::memory_order_relaxed); }
+
+  [[nodiscard]] CanErrorCounters error_counters() const override;
+  void SetAutoRestart(bool enable);
+  bool Restart();
 
  private:
   void RecvThread();
   void SendThread();
-  void RxCallbackCallWorker(std::unique_ptr<struct ::can_frame> msg);
+  void DispatchThread();
+  void RestartThread();
+
+  /**
+   * @return 是否挂在共享的EventLoop或IoUringEngine上，这两种模式下SocketCan自己不创建任何线程
+   */
+  [[nodiscard]] bool uses_shared_loop() const {
+#if defined(LIBRM_USE_IO_URING)
+    if (this->rx_mode_ == SocketCanRxMode::kIoUring) {
+      return true;
+    }
+#endif
+    return this->rx_mode_ == SocketCanRxMode::kEventLoop;
+  }
+  void NotifyTx();
+  void DrainTxQueue();
+  void Dispatch(const CanMsg &msg, bool lock);
+  [[nodiscard]] CanMsg MakeMsg(u16 id, const u8 *data, usize size) const;
+  void Requeue(const CanMsg &msg);
+  void ArmBatchFlush();
   void RegisterDevice(device::CanDevice &device, u32 rx_stdid) override;
+  void ApplyFilters();
+  void HandleErrorFrame(const struct ::canfd_frame &frame);
+  void FlushTxQueue();
+
+  /**
+   * @brief recvmmsg/sendmmsg使用的缓冲区，构造时一次性分配好，之后收发都不会再分配内存
+   */
+  struct MmsgBuffer {
+    explicit MmsgBuffer(usize size, bool control = false);
+    MmsgBuffer(const MmsgBuffer &) = delete;
+    MmsgBuffer &operator=(const MmsgBuffer &) = delete;
+    void ResetControls();
+
+    /**
+     * @brief 一帧的控制消息缓冲区，装得下SO_TIMESTAMPING或SO_TIMESTAMP的时间戳
+     */
+    union Control {
+      char buffer[CMSG_SPACE(sizeof(struct ::timespec) * 3) + CMSG_SPACE(sizeof(struct ::timeval))];
+      struct ::cmsghdr align;
+    };
+
+    std::vector<struct ::canfd_frame> frames;
+    std::vector<struct ::iovec> iov;
+    std::vector<struct ::mmsghdr> headers;
+    std::vector<Control> controls;
+  };
+
+  int SendFrames(MmsgBuffer &buffer, const CanMsg *msgs, usize count);
+  int ReceiveFrames(MmsgBuffer &buffer, int flags);
 
-  int socket_fd_;
+  int socket_fd_{-1};
+  int loopback_fd_{-1};  // 只用来发送WriteLoopback()的报文，内核会把它回环给socket_fd_，自己什么都不收
   struct ::sockaddr_can addr_;
   struct ::ifreq interface_request_;
-  struct ::can_filter filter_;
-  struct ::can_frame tx_buf_;
+  std::vector<struct ::can_filter> filters_{};
+  bool user_filter_{false};  // 用户是否手动调用过SetFilter，如果调用过就不再自动生成过滤器
+  bool fd_enabled_{false};   // 网卡是否支持CAN FD，Begin()时检测
+  bool bit_rate_switch_{true};
   std::string dev_;
-  CanMsg rx_buffer_{};
-  std::unique_ptr<core::ThreadPool> thread_pool_{};  // 线程池，用于异步调用设备的回调函数
-  std::unordered_map<CanTxPriority, std::deque<std::shared_ptr<CanMsg>>> tx_queue_{
-      {CanTxPriority::kHigh, {}},
-      {CanTxPriority::kNormal, {}},
-      {CanTxPriority::kLow, {}},
-  };  // <priority, queue>
-  std::unordered_map<u16, AsyncCanDevice *> device_list_{};  // <rx_stdid, device+lock>
+  SocketCanRxMode rx_mode_{SocketCanRxMode::kThreadPool};
+  std::unique_ptr<core::ThreadPool> thread_pool_{};  // 线程池，用于异步调用设备的回调函数，仅kThreadPool模式下创建
+  std::unique_ptr<core::SpscQueue<CanMsg>> rx_queue_{};  // 接收线程->分发线程的报文队列，仅kDispatcher模式下创建
+  ::sem_t rx_queue_sem_{};                                // 队列里每有一条报文就post一次，分发线程在上面等待
+  std::thread recv_thread_{};
+  std::future<void> recv_task_{};  // kThreadPool模式下接收循环在线程池里运行，Stop()要等它结束才能关闭套接字
+  std::thread dispatch_thread_{};
+  std::thread send_thread_{};
+  std::thread restart_thread_{};  // bus-off恢复线程，重启控制器的netlink调用会阻塞，不能放在接收线程里做；共享循环的模式下不创建
+  std::mutex restart_mutex_{};
+  std::condition_variable restart_cv_{};
+  bool restart_pending_{false};  // 接收路径检测到bus-off后置位，由恢复线程调用Restart()
+  ThreadAttributes thread_attributes_{};  // 接收、分发、发送线程的属性
+  std::atomic<bool> running_{false};
+  std::atomic<usize> rx_overflow_count_{0};
+  std::atomic<usize> tx_error_count_{0};
+  std::atomic<u64> rx_frames_{0};
+  std::atomic<u64> rx_syscalls_{0};
+  std::atomic<u64> tx_frames_{0};
+  std::atomic<u64> tx_syscalls_{0};
+  bool auto_restart_{true};
+  std::atomic<CanBusState> bus_state_{CanBusState::kErrorActive};
+  std::atomic<u32> bus_tx_error_count_{0};  // 控制器的TEC，内核在错误帧里带上计数时才会更新
+  std::atomic<u32> bus_rx_error_count_{0};  // 控制器的REC
+  std::atomic<u32> error_frames_{0};
+  std::atomic<u32> bus_off_count_{0};
+  std::atomic<u32> restart_count_{0};
+  std::atomic<u32> tx_flushed_{0};
+  std::vector<std::unique_ptr<AsyncCanDevice>> async_devices_{};  // 所有设备的回调锁
+  CanDeviceTable<AsyncCanDevice> device_list_{};                   // <rx_stdid, device+lock>
 
   /**
-   * @brief 消息队列最大长度
-   * @note  在插入或发送消息的时候，如果检测到消息队列长度超过这个值，就会清空消息队列（待发送的消息都会被丢弃）
-   * @note  触发清空队列的动作意味着插入消息的速度大于发送消息的速度，应该减少发送消息的数量
+   * @brief 每个优先级的消息队列最大长度
+   * @note  队列满时新加入的消息会被丢弃并计数，这意味着插入消息的速度大于发送消息的速度，应该减少发送消息的数量
    */
   static constexpr usize kQueueMaxSize = 100;
 
+  /**
+   * @brief 自动生成的内核过滤器最大数量
+   * @note  内核对每一帧都会逐个检查过滤器，注册的ID多于这个数量时，会把相近的ID合并成带掩码的过滤器
+   */
+  static constexpr usize kMaxKernelFilters = 16;
+
+  CanTxQueue<kQueueMaxSize> tx_queue_{};
+  std::mutex tx_queue_mutex_{};
+  std::condition_variable tx_queue_cv_{};
+
+  /**
+   * @brief 批量收发时每次系统调用最多处理的报文数量，为1时不做批量处理
+   * @note  大于1时，Write(id, data, size)发送的报文会先暂存起来，直到调用Flush()、暂存的报文数量达到这个值
+   *        或者第一帧暂存了kBatchFlushDelayUs，再用一次sendmmsg全部发出
+   */
+  usize io_batch_size_{1};
+  std::vector<CanMsg> tx_batch_{};  // Write(id, data, size)暂存的报文
+  std::atomic<i64> tx_batch_deadline_ns_{0};  // 暂存的报文最晚什么时候要发出(steady_clock)，没有暂存的报文时为0
+  std::unique_ptr<MmsgBuffer> tx_batch_buffer_{};
+  std::mutex tx_batch_mutex_{};
+
+  // 以下成员只在kEventLoop模式下使用
+  EventLoop *event_loop_{nullptr};
+  int tx_event_fd_{-1};  // eventfd，发送队列里有新报文时通知事件循环
+  int tx_timer_fd_{-1};  // timerfd，内核发送队列满时用来定时重试
+  int tx_batch_timer_fd_{-1};  // timerfd，批量发送暂存的报文到时间了还没发出时用来触发Flush()
+  std::atomic<bool> tx_event_pending_{false};
+  std::unique_ptr<MmsgBuffer> loop_rx_buffer_{};
+  std::unique_ptr<MmsgBuffer> loop_tx_buffer_{};
+  std::vector<CanMsg> loop_tx_pending_{};  // 从发送队列里取出来、还没发完的报文
+  usize loop_tx_count_{0};
+  usize loop_tx_sent_{0};
+  long loop_tx_backoff_us_{kTxBackoffMinUs};
+  bool loop_tx_backoff_armed_{false};
+  std::mutex loop_tx_mutex_{};  // 多线程的事件循环里，eventfd和timerfd的回调可能同时调用DrainTxQueue
+
+#if defined(LIBRM_USE_IO_URING)
+  IoUringEngine *io_uring_{nullptr};  // 只在kIoUring模式下使用
+
+  /**
+   * @brief kIoUring模式下给内核提供的接收缓冲区数量，每块缓冲区装一帧
+   */
+  static constexpr usize kIoUringBufferCount = 256;
+#endif
+
   /**
    * @brief 最大线程数
    * @note  用于创建线程池
    */
   static constexpr usize kMaxThreads = 20;
+
+  /**
+   * @brief kDispatcher模式下分发队列的默认长度
+   */
+  static constexpr usize kDefaultRxQueueSize = 256;
+
+  /**
+   * @brief 接收超时时间(ms)
+   * @note  接收线程每隔这么久就会从阻塞的read里返回一次，检查是否需要退出
+   */
+  static constexpr int kRecvTimeoutMs = 100;
+
+  /**
+   * @brief 内核发送队列满(ENOBUFS)时的退避时间范围(us)
+   * @note  发送线程每次重试失败后退避时间翻倍，直到最大值
+   */
+  static constexpr long kTxBackoffMinUs = 100;
+  static constexpr long kTxBackoffMaxUs = 2000;
+
+  /**
+   * @brief 批量发送时报文最多暂存多久(us)
+   * @note  没人调用Flush()、暂存的报文又凑不满一批时，到时间后由发送线程或事件循环自动发出
+   */
+  static constexpr i64 kBatchFlushDelayUs = 500;
 };
 
 }  // namespace rm::hal::linux_
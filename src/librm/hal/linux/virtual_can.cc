@@ -0,0 +1,379 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/virtual_can.cc
+ * @brief 进程内的虚拟CAN总线，不需要硬件也不需要vcan内核模块
+ */
+
+#include "virtual_can.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+
+#include "librm/core/time.hpp"
+
+namespace rm::hal::linux_ {
+
+/**
+ * @param bitrate       仲裁段位速率(bps)
+ * @param data_bitrate  CAN FD帧开启BRS时数据段的位速率(bps)
+ */
+VirtualCanBus::VirtualCanBus(u32 bitrate, u32 data_bitrate) : bitrate_(bitrate), data_bitrate_(data_bitrate) {
+  if (bitrate == 0 || data_bitrate == 0) {
+    throw std::invalid_argument("Bitrate must not be zero");
+  }
+}
+
+VirtualCanBus::~VirtualCanBus() { this->Stop(); }
+
+/**
+ * @brief  计算一帧报文在总线上占用的时间，不计填充位
+ * @return 帧时间(us)，向上取整
+ */
+u64 VirtualCanBus::FrameTimeUs(const CanMsg &msg) const {
+  u64 time_ns;
+  if (msg.fd) {
+    // 开了BRS时只有数据段切换到高速率，其他部分仍然按仲裁段速率计算
+    const CanFdFrameBitCount bits = CanFdFrameBits(msg.dlc, msg.brs, false);
+    time_ns = bits.nominal * 1'000'000'000ull / this->bitrate_ + bits.data * 1'000'000'000ull / this->data_bitrate_;
+  } else {
+    time_ns = CanFrameBits(msg.dlc, false) * 1'000'000'000ull / this->bitrate_;
+  }
+  return (time_ns + 999) / 1000;
+}
+
+/**
+ * @brief  让总线发完下一帧报文，模拟时钟推进到这一帧结束的时刻
+ * @note   不能在设备的回调里调用
+ * @return 没有等待发送的报文时返回false
+ */
+bool VirtualCanBus::Step() { return this->Complete(std::numeric_limits<u64>::max()); }
+
+/**
+ * @brief  一直发送，直到总线上没有等待发送的报文
+ * @note   设备在回调里又发送报文的话会一直发下去，直到不再有新的报文
+ * @return 发送了多少帧
+ */
+usize VirtualCanBus::RunUntilIdle() {
+  usize count = 0;
+  while (this->Step()) {
+    ++count;
+  }
+  return count;
+}
+
+/**
+ * @brief 把模拟时钟推进到time_us，投递这期间发完的所有报文
+ * @note  在time_us时还没发完的报文留在总线上，下次推进时继续
+ */
+void VirtualCanBus::AdvanceTo(u64 time_us) {
+  while (this->Complete(time_us)) {
+  }
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->now_us_ = std::max(this->now_us_, time_us);
+}
+
+/**
+ * @brief 启动实时模式，由后台线程按墙上时间推进模拟时钟
+ */
+void VirtualCanBus::Begin() {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (this->running_) {
+    return;
+  }
+  this->real_time_offset_us_ = static_cast<i64>(this->now_us_) - static_cast<i64>(core::time::NowUs());
+  this->running_ = true;
+  this->real_time_thread_ = std::thread(&VirtualCanBus::RealTimeThread, this);
+}
+
+/**
+ * @brief 停止实时模式，之后可以继续用Step()等函数手动推进
+ */
+void VirtualCanBus::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->running_ = false;
+  }
+  this->cv_.notify_all();
+  if (this->real_time_thread_.joinable()) {
+    this->real_time_thread_.join();
+  }
+}
+
+u64 VirtualCanBus::now_us() const {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  if (this->running_) {
+    return std::max<u64>(this->now_us_, core::time::NowUs() + this->real_time_offset_us_);
+  }
+  return this->now_us_;
+}
+
+void VirtualCanBus::Attach(VirtualCan &endpoint) {
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->endpoints_.push_back(&endpoint);
+}
+
+/**
+ * @brief 从总线上摘下一个端点，它还没发出去的报文也一起丢弃
+ */
+void VirtualCanBus::Detach(VirtualCan &endpoint) {
+  std::lock_guard<std::mutex> deliver_lock(this->deliver_mutex_);
+  std::lock_guard<std::mutex> lock(this->mutex_);
+  this->endpoints_.erase(std::remove(this->endpoints_.begin(), this->endpoints_.end(), &endpoint),
+                         this->endpoints_.end());
+  this->pending_.erase(std::remove_if(this->pending_.begin(), this->pending_.end(),
+                                      [&endpoint](const PendingFrame &frame) { return frame.sender == &endpoint; }),
+                       this->pending_.end());
+  if (this->has_in_flight_ && this->in_flight_.sender == &endpoint) {
+    this->has_in_flight_ = false;
+  }
+}
+
+void VirtualCanBus::Submit(VirtualCan &sender, const CanMsg &msg, bool loopback) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (this->running_ && !this->has_in_flight_) {
+      // 实时模式下总线空闲了一段时间，新的报文从现在开始发送，而不是从上一帧结束的时刻
+      this->now_us_ = std::max<u64>(this->now_us_, core::time::NowUs() + this->real_time_offset_us_);
+    }
+    this->pending_.push_back({msg, &sender, this->sequence_++, loopback});
+  }
+  this->NotifySubmit();
+}
+
+void VirtualCanBus::NotifySubmit() { this->cv_.notify_one(); }
+
+/**
+ * @brief  总线空闲时，从所有等待发送的报文里选出ID最小的一帧开始发送，调用时要持有mutex_
+ * @return 没有等待发送的报文时返回false
+ */
+bool VirtualCanBus::Arbitrate() {
+  // 发送队列里的报文每个端点每次只拿一帧出来参与仲裁，和硬件发送邮箱空了之后再从队列里补充一样
+  for (VirtualCan *endpoint : this->endpoints_) {
+    const bool has_pending = std::any_of(this->pending_.begin(), this->pending_.end(),
+                                         [endpoint](const PendingFrame &frame) { return frame.sender == endpoint; });
+    CanMsg msg;
+    if (!has_pending && endpoint->tx_queue_.Pop(msg)) {
+      this->pending_.push_back({msg, endpoint, this->sequence_++});
+      endpoint->ReportTxQueueDepth(endpoint->tx_queue_.size());
+    }
+  }
+  if (this->pending_.empty()) {
+    return false;
+  }
+  auto winner = std::min_element(this->pending_.begin(), this->pending_.end(),
+                                 [](const PendingFrame &a, const PendingFrame &b) {
+                                   return a.msg.rx_std_id != b.msg.rx_std_id ? a.msg.rx_std_id < b.msg.rx_std_id
+                                                                             : a.sequence < b.sequence;
+                                 });
+  this->in_flight_ = *winner;
+  this->pending_.erase(winner);
+  this->in_flight_end_us_ = this->now_us_ + this->FrameTimeUs(this->in_flight_.msg);
+  this->has_in_flight_ = true;
+  return true;
+}
+
+/**
+ * @brief  如果正在发送的报文在limit_us之前能发完，就把它投递给其他端点
+ * @return 没有报文可以投递时返回false
+ */
+bool VirtualCanBus::Complete(u64 limit_us) {
+  std::lock_guard<std::mutex> deliver_lock(this->deliver_mutex_);
+  PendingFrame frame;
+  std::vector<VirtualCan *> receivers;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (!this->has_in_flight_ && !this->Arbitrate()) {
+      return false;
+    }
+    if (this->in_flight_end_us_ > limit_us) {
+      return false;
+    }
+    this->busy_us_.fetch_add(this->in_flight_end_us_ - this->now_us_, std::memory_order_relaxed);
+    this->now_us_ = this->in_flight_end_us_;
+    this->has_in_flight_ = false;
+    frame = this->in_flight_;
+    frame.msg.timestamp_us = this->now_us_;
+    receivers = this->endpoints_;
+  }
+  this->frame_count_.fetch_add(1, std::memory_order_relaxed);
+
+  // 回调里可能会再发送报文，所以投递时不持有mutex_
+  frame.sender->ReportTx(frame.msg);
+  for (VirtualCan *endpoint : receivers) {
+    if (endpoint != frame.sender || frame.loopback) {
+      endpoint->Deliver(frame.msg);
+    }
+  }
+  return true;
+}
+
+/**
+ * @return 有没有等待仲裁的报文，包括各个端点发送队列里的报文；调用时要持有mutex_
+ */
+bool VirtualCanBus::HasWaitingFrames() const {
+  return !this->pending_.empty() ||
+         std::any_of(this->endpoints_.begin(), this->endpoints_.end(),
+                     [](const VirtualCan *endpoint) { return !endpoint->tx_queue_.empty(); });
+}
+
+/**
+ * @brief 实时模式的后台线程，等到正在发送的报文按墙上时间发完之后再投递
+ * @note  Submit()和Enqueue()都是先在mutex_下放入报文再通知，这里在mutex_下检查pending_和发送队列，不会漏掉通知
+ */
+void VirtualCanBus::RealTimeThread() {
+  for (;;) {
+    this->AdvanceTo(core::time::NowUs() + this->real_time_offset_us_);
+
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    if (!this->running_) {
+      return;
+    }
+    if (this->has_in_flight_) {
+      const i64 wait_us = static_cast<i64>(this->in_flight_end_us_) -
+                          static_cast<i64>(core::time::NowUs() + this->real_time_offset_us_);
+      this->cv_.wait_for(lock, std::chrono::microseconds(std::max<i64>(wait_us, 0)));
+    } else {
+      this->cv_.wait(lock, [this] { return !this->running_ || this->has_in_flight_ || this->HasWaitingFrames(); });
+    }
+  }
+}
+
+/**
+ * @param bus 这个端点挂在哪条虚拟总线上
+ */
+VirtualCan::VirtualCan(VirtualCanBus &bus) : bus_(&bus) { this->bus_->Attach(*this); }
+
+VirtualCan::~VirtualCan() { this->bus_->Detach(*this); }
+
+/**
+ * @brief 把报文交给总线仲裁，不会阻塞
+ */
+void VirtualCan::Write(u16 id, const u8 *data, usize size) { this->bus_->Submit(*this, this->MakeMsg(id, data, size)); }
+
+/**
+ * @brief 把报文交给总线仲裁，发完之后和其他端点同时投递给自己
+ */
+void VirtualCan::WriteLoopback(u16 id, const u8 *data, usize size) {
+  this->bus_->Submit(*this, this->MakeMsg(id, data, size), true);
+}
+
+/**
+ * @brief 从发送队列里取出一条消息，立刻交给总线仲裁
+ */
+void VirtualCan::Write() {
+  CanMsg msg;
+  {
+    std::lock_guard<std::mutex> lock(this->bus_->mutex_);
+    if (!this->tx_queue_.Pop(msg)) {
+      return;
+    }
+  }
+  this->bus_->Submit(*this, msg);
+}
+
+/**
+ * @brief 向发送队列里加入一条消息，总线空闲时自动发送
+ */
+void VirtualCan::Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) {
+  const CanMsg msg = this->MakeMsg(id, data, size);
+  bool pushed;
+  usize depth;
+  {
+    std::lock_guard<std::mutex> lock(this->bus_->mutex_);
+    pushed = this->tx_queue_.Push(msg, priority);
+    depth = this->tx_queue_.size();
+  }
+  if (!pushed) {
+    this->ReportTxDrop(msg);
+    return;
+  }
+  this->ReportTxQueueDepth(depth);
+  this->bus_->NotifySubmit();
+}
+
+/**
+ * @brief 添加一个接收过滤器，(rx_id & mask) == (id & mask)的报文才会被接收
+ */
+void VirtualCan::SetFilter(u16 id, u16 mask) { this->filters_.push_back({id, mask}); }
+
+void VirtualCan::Begin() { this->started_ = true; }
+
+void VirtualCan::Stop() { this->started_ = false; }
+
+/**
+ * @brief 超过8字节的报文是否开启BRS，开启时数据段按总线的data_bitrate计算时间
+ */
+void VirtualCan::SetBitRateSwitch(bool enable) { this->bit_rate_switch_ = enable; }
+
+/**
+ * @brief 收到总线上的一帧报文，交给注册了这个ID的设备
+ */
+void VirtualCan::Deliver(const CanMsg &msg) {
+  if (!this->started_) {
+    return;
+  }
+  if (!this->filters_.empty() &&
+      std::none_of(this->filters_.begin(), this->filters_.end(), [&msg](const CanFilter &filter) {
+        return (msg.rx_std_id & filter.mask) == (filter.id & filter.mask);
+      })) {
+    return;
+  }
+  if (this->TryRxFastPath(msg)) {
+    this->ReportRx(msg, true);
+    return;
+  }
+  device::CanDevice *device = this->device_list_.Find(msg.rx_std_id);
+  this->ReportRx(msg, device != nullptr);
+  if (device != nullptr) {
+    device->Deliver(msg);
+  }
+}
+
+CanMsg VirtualCan::MakeMsg(u16 id, const u8 *data, usize size) const {
+  if (size > kCanMaxDataLength) {
+    throw std::runtime_error("Data is too long for a CAN frame!");
+  }
+  CanMsg msg{};
+  msg.rx_std_id = id;
+  msg.fd = size > 8;
+  msg.brs = msg.fd && this->bit_rate_switch_;
+  msg.dlc = msg.fd ? CanFdPaddedLength(size) : size;
+  std::copy_n(data, size, msg.data.begin());
+  return msg;
+}
+
+/**
+ * @brief 注册CAN设备
+ * @param device 设备对象
+ * @param rx_stdid 这个设备的rx消息标准帧id
+ */
+void VirtualCan::RegisterDevice(device::CanDevice &device, u32 rx_stdid) {
+  if (!this->device_list_.Insert(rx_stdid, &device)) {
+    throw std::runtime_error("Device already registered");
+  }
+}
+
+}  // namespace rm::hal::linux_
@@ -0,0 +1,184 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/linux/virtual_can.h
+ * @brief 进程内的虚拟CAN总线，不需要硬件也不需要vcan内核模块
+ */
+
+#ifndef LIBRM_HAL_LINUX_VIRTUAL_CAN_H
+#define LIBRM_HAL_LINUX_VIRTUAL_CAN_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "librm/core/typedefs.h"
+#include "librm/device/can_device.hpp"
+#include "librm/hal/can_device_table.hpp"
+#include "librm/hal/can_filter.hpp"
+#include "librm/hal/can_interface.h"
+#include "librm/hal/can_tx_queue.hpp"
+
+namespace rm::hal::linux_ {
+
+class VirtualCan;
+
+/**
+ * @brief 虚拟CAN总线
+ * @note  多个VirtualCan端点挂在同一条总线上，一个端点发出的报文会交给其他所有启动了的端点，发送者自己收不到
+ * @note  总线按位速率计算每一帧占用的时间，同一时刻有多帧等待发送时按ID仲裁，ID小的先发，ID相同的按提交顺序
+ * @note  有两种推进时间的方式：
+ *        1. 确定性步进(默认)：总线有自己的模拟时钟，只有调用Step()/RunUntilIdle()/AdvanceTo()时才会推进和投递报文，
+ *           所有回调都在调用者的线程里执行，每次运行的结果完全一样，适合测试和基准测试
+ *        2. 实时：调用Begin()之后由后台线程按墙上时间推进模拟时钟，适合跑例程
+ * @note  用法：
+ *        rm::hal::linux_::VirtualCanBus bus{1'000'000};
+ *        rm::hal::linux_::VirtualCan controller{bus}, motor_side{bus};
+ *        rm::device::M3508 motor{controller, 1};
+ *        controller.Begin();
+ *        motor_side.Begin();
+ *        motor_side.Write(0x201, feedback, 8);
+ *        bus.RunUntilIdle();  // motor收到反馈
+ */
+class VirtualCanBus {
+ public:
+  explicit VirtualCanBus(u32 bitrate = 1'000'000, u32 data_bitrate = 5'000'000);
+  ~VirtualCanBus();
+
+  // 禁止拷贝构造
+  VirtualCanBus(const VirtualCanBus &) = delete;
+  VirtualCanBus &operator=(const VirtualCanBus &) = delete;
+
+  bool Step();
+  usize RunUntilIdle();
+  void AdvanceTo(u64 time_us);
+
+  void Begin();
+  void Stop();
+
+  /**
+   * @return 模拟时钟的当前时间(us)
+   */
+  [[nodiscard]] u64 now_us() const;
+
+  /**
+   * @return 总线上已经发完的帧数
+   */
+  [[nodiscard]] usize frame_count() const { return this->frame_count_.load(std::memory_order_relaxed); }
+
+  /**
+   * @return 总线被占用的总时间(us)，除以now_us()就是平均负载率
+   */
+  [[nodiscard]] u64 busy_us() const { return this->busy_us_.load(std::memory_order_relaxed); }
+
+  [[nodiscard]] u64 FrameTimeUs(const CanMsg &msg) const;
+
+ private:
+  friend class VirtualCan;
+
+  /**
+   * @brief 等待仲裁的一帧报文
+   */
+  struct PendingFrame {
+    CanMsg msg;
+    VirtualCan *sender;
+    u64 sequence;  ///< 提交顺序，ID相同的帧按这个排序
+    bool loopback{false};  ///< 发完之后发送者自己也要收到，见CanInterface::WriteLoopback()
+  };
+
+  void Attach(VirtualCan &endpoint);
+  void Detach(VirtualCan &endpoint);
+  void Submit(VirtualCan &sender, const CanMsg &msg, bool loopback = false);
+  void NotifySubmit();
+  bool Arbitrate();
+  bool Complete(u64 limit_us);
+  [[nodiscard]] bool HasWaitingFrames() const;
+  void RealTimeThread();
+
+  u32 bitrate_;
+  u32 data_bitrate_;
+  mutable std::mutex mutex_{};
+  std::condition_variable cv_{};
+  std::mutex deliver_mutex_{};  // 投递报文时持有，Detach()借此等待正在进行的投递结束
+  std::vector<VirtualCan *> endpoints_{};
+  std::vector<PendingFrame> pending_{};
+  bool has_in_flight_{false};
+  PendingFrame in_flight_{};
+  u64 in_flight_end_us_{0};
+  u64 now_us_{0};
+  u64 sequence_{0};
+  std::atomic<usize> frame_count_{0};
+  std::atomic<u64> busy_us_{0};
+
+  std::thread real_time_thread_{};
+  bool running_{false};
+  i64 real_time_offset_us_{0};  ///< 实时模式下 模拟时钟 - core::time::NowUs()
+};
+
+/**
+ * @brief 虚拟CAN总线上的一个端点，用法和SocketCan一样
+ * @note  Write()直接把报文交给总线仲裁；Enqueue()先放进发送队列，总线每次仲裁时从队列里取一帧参与仲裁，
+ *        相当于驱动在发送完成中断里重新填邮箱
+ * @note  Begin()之前和Stop()之后收不到报文，但仍然可以发送
+ * @note  SetFilter()要在Begin()之前调用，默认接收所有ID
+ */
+class VirtualCan final : public CanInterface {
+ public:
+  explicit VirtualCan(VirtualCanBus &bus);
+  ~VirtualCan() override;
+
+  // 禁止拷贝构造
+  VirtualCan(const VirtualCan &) = delete;
+  VirtualCan &operator=(const VirtualCan &) = delete;
+
+  void Write(u16 id, const u8 *data, usize size) override;
+  void WriteLoopback(u16 id, const u8 *data, usize size) override;
+  void Write() override;
+  void Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) override;
+  void SetFilter(u16 id, u16 mask) override;
+  void Begin() override;
+  void Stop() override;
+  [[nodiscard]] usize max_data_length() const override { return kCanMaxDataLength; }
+
+  void SetBitRateSwitch(bool enable);
+
+ private:
+  friend class VirtualCanBus;
+
+  void RegisterDevice(device::CanDevice &device, u32 rx_stdid) override;
+  void Deliver(const CanMsg &msg);
+  CanMsg MakeMsg(u16 id, const u8 *data, usize size) const;
+
+  VirtualCanBus *bus_;
+  std::atomic<bool> started_{false};
+  bool bit_rate_switch_{true};
+  std::vector<CanFilter> filters_{};
+  CanDeviceTable<device::CanDevice> device_list_{};
+  CanTxQueue<64> tx_queue_{};  // 由总线的mutex_保护
+};
+
+}  // namespace rm::hal::linux_
+
+#endif  // LIBRM_HAL_LINUX_VIRTUAL_CAN_H
@@ -32,38 +32,29 @@
 
 #include "bxcan.h"
 
-#include <functional>
 #include <stdexcept>
 #include <algorithm>
 
 #include "librm/device/can_device.hpp"
 #include "librm/core/exception.h"
+#include "librm/core/time.hpp"
+#include "librm/hal/stm32/critical_section.h"
+#include "librm/hal/stm32/static_callback.h"
 
-/**
- * 用于存储回调函数的map
- * key: HAL库的CAN_HandleTypeDef
- * value: 回调函数
- */
-static std::unordered_map<CAN_HandleTypeDef *, std::function<void()>> fn_cb_map;
+namespace {
+struct CanRxFifo0Tag;
+struct CanRxFifo1Tag;
+struct CanTxMailboxTag;
+struct CanErrorTag;
 
 /**
- * @brief  把std::function转换为函数指针
- * @param  fn   要转换的函数
- * @param  hcan  HAL库的CAN_HandleTypeDef
- * @return      转换后的函数指针
- * @note
- * 背景：因为要用面向对象的方式对外设进行封装，所以回调函数必须存在于类内。但是存在于类内就意味着这个回调函数多了一个this参数，
- * 而HAL库要求的回调函数并没有这个this参数。通过std::bind，可以生成一个参数列表里没有this指针的std::function对象，而std::function
- * 并不能直接强转成函数指针。借助这个函数，可以把std::function对象转换成函数指针。然后就可以把这个类内的回调函数传给HAL库了。
+ * @brief 接收回调和发送邮箱回调的分发表，最多支持3个bxCAN外设
  */
-static pCAN_CallbackTypeDef StdFunctionToCallbackFunctionPtr(std::function<void()> fn, CAN_HandleTypeDef *hcan) {
-  fn_cb_map[hcan] = std::move(fn);
-  return [](CAN_HandleTypeDef *hcan) {
-    if (fn_cb_map.find(hcan) != fn_cb_map.end()) {
-      fn_cb_map[hcan]();
-    }
-  };
-}
+using CanRxFifo0Callback = rm::hal::stm32::StaticCallback<void(CAN_HandleTypeDef *), CanRxFifo0Tag, 3>;
+using CanRxFifo1Callback = rm::hal::stm32::StaticCallback<void(CAN_HandleTypeDef *), CanRxFifo1Tag, 3>;
+using CanTxMailboxCallback = rm::hal::stm32::StaticCallback<void(CAN_HandleTypeDef *), CanTxMailboxTag, 3>;
+using CanErrorCallback = rm::hal::stm32::StaticCallback<void(CAN_HandleTypeDef *), CanErrorTag, 3>;
+}  // namespace
 
 namespace rm::hal::stm32 {
 
@@ -73,33 +64,60 @@ namespace rm::hal::stm32 {
 BxCan::BxCan(CAN_HandleTypeDef &hcan) : hcan_(&hcan) {}
 
 /**
- * @brief 设置过滤器
+ * @brief 设置过滤器，会清掉之前用AddFilter()添加的规则，通过过滤器的报文都进入FIFO0
  * @param id
  * @param mask
  */
 void BxCan::SetFilter(u16 id, u16 mask) {
+  this->filter_count_ = 0;
+  this->AddFilter(id, mask, CanRxFifo::kFifo0);
+}
+
+/**
+ * @brief 追加一条过滤规则，每个CAN外设最多14条
+ * @note  一帧报文同时通过多条规则时，硬件选用编号最小的那条，所以要先添加范围窄的规则，比如
+ *        先把电机反馈的ID分到FIFO0，再用AddFilter(0, 0, CanRxFifo::kFifo1)把剩下的报文都分到FIFO1
+ * @param id    标准帧ID
+ * @param mask  掩码，为1的位要和id一致
+ * @param fifo  通过这条规则的报文进入哪个接收FIFO
+ */
+void BxCan::AddFilter(u16 id, u16 mask, CanRxFifo fifo) {
+  // CAN1和CAN2共用28个过滤器组，CAN1用0~13，CAN2用14~27
+  constexpr u32 kFilterBanksPerInstance = 14;
+  if (this->filter_count_ >= kFilterBanksPerInstance) {
+    Throw(std::runtime_error("Too many CAN filters"));
+  }
   CAN_FilterTypeDef can_filter_st;
   can_filter_st.FilterActivation = ENABLE;
   can_filter_st.FilterMode = CAN_FILTERMODE_IDMASK;
   can_filter_st.FilterScale = CAN_FILTERSCALE_32BIT;
-  can_filter_st.FilterIdHigh = id >> 8;
-  can_filter_st.FilterIdLow = id;
-  can_filter_st.FilterMaskIdHigh = mask >> 8;
-  can_filter_st.FilterMaskIdLow = mask;
-  can_filter_st.FilterFIFOAssignment = CAN_RX_FIFO0;
-  if (reinterpret_cast<u32>(hcan_->Instance) == CAN1_BASE) {
-    // 如果是CAN1
-    can_filter_st.FilterBank = 0;
-  } else if (reinterpret_cast<u32>(hcan_->Instance) == CAN2_BASE) {
+  // 32位模式下标准帧ID在高16位的[15:5]，低16位是扩展ID、IDE和RTR，不参与匹配
+  can_filter_st.FilterIdHigh = id << 5;
+  can_filter_st.FilterIdLow = 0;
+  can_filter_st.FilterMaskIdHigh = mask << 5;
+  can_filter_st.FilterMaskIdLow = 0;
+  can_filter_st.FilterFIFOAssignment = fifo == CanRxFifo::kFifo0 ? CAN_FILTER_FIFO0 : CAN_FILTER_FIFO1;
+  can_filter_st.SlaveStartFilterBank = kFilterBanksPerInstance;
+  can_filter_st.FilterBank = this->filter_count_;
+  if (hcan_->Instance == CAN2) {
     // 如果是CAN2
-    can_filter_st.SlaveStartFilterBank = 14;
-    can_filter_st.FilterBank = 14;
+    can_filter_st.FilterBank += kFilterBanksPerInstance;
   }
 
   HAL_StatusTypeDef hal_status = HAL_CAN_ConfigFilter(hcan_, &can_filter_st);
   if (hal_status != HAL_OK) {
     Throw(hal_error(hal_status));
   }
+  ++this->filter_count_;
+}
+
+/**
+ * @brief 设置发送队列满了的时候丢弃哪一帧
+ * @param policy 丢弃策略，默认丢弃新来的报文
+ */
+void BxCan::SetTxDropPolicy(CanTxDropPolicy policy) {
+  CriticalSection critical_section;
+  this->tx_queue_.set_drop_policy(policy);
 }
 
 /**
@@ -107,42 +125,44 @@ void BxCan::SetFilter(u16 id, u16 mask) {
  * @param id    标准帧ID
  * @param data  数据指针
  * @param size  数据长度
+ * @note  发送邮箱全满时报文会被放进高优先级队列，等有邮箱空出来时由中断发送
  */
 void BxCan::Write(u16 id, const u8 *data, usize size) {
   if (size > 8) {
     Throw(std::runtime_error("Data is too long for a std CAN frame!"));
   }
-  hal_tx_header_.StdId = id;
-  hal_tx_header_.DLC = size;
+  CanMsg msg{.rx_std_id = id, .dlc = static_cast<u32>(size)};
+  std::copy_n(data, size, msg.data.begin());
 
-  HAL_StatusTypeDef hal_status = HAL_CAN_AddTxMessage(hcan_, &hal_tx_header_, data, &tx_mailbox_);
-  if (hal_status != HAL_OK) {
-    Throw(hal_error(hal_status));
+  CriticalSection critical_section;
+  if (HAL_CAN_GetTxMailboxesFreeLevel(hcan_) == 0 || !this->AddToTxMailbox(msg)) {
+    this->PushTxQueue(msg, CanTxPriority::kHigh);
   }
 }
 
 /**
- * @brief 从消息队列里取出一条消息发送
+ * @brief 发送报文，同时像接收中断里收到的报文一样交给这个接口上的设备
+ * @note  bxCAN没有逐帧的硬件回环，本地投递是软件做的，和接收中断走同一条路径：只有放进延迟接收队列时进临界区，直接投递时不关中断
+ */
+void BxCan::WriteLoopback(u16 id, const u8 *data, usize size) {
+  this->Write(id, data, size);
+  CanMsg msg{.rx_std_id = id, .dlc = static_cast<u32>(size)};
+  std::copy_n(data, size, msg.data.begin());
+  msg.timestamp_us = core::time::NowUs();
+  this->Receive(msg);
+}
+
+/**
+ * @brief 从消息队列里取出报文，填满所有空闲的发送邮箱
+ * @note  发送邮箱空中断会自动做这件事，一般不需要手动调用
  */
 void BxCan::Write() {
-  // 按优先级从高到低遍历所有消息队列
-  for (auto &queue : tx_queue_) {
-    if (queue.second.empty()) {
-      continue;  // 如果是空的就换下一个
-    }
-    // 从队首取出一条消息发送
-    Write(queue.second.front()->rx_std_id, queue.second.front()->data.data(), queue.second.front()->dlc);
-    queue.second.pop_front();
-    // 检查消息队列长度是否超过了设定的最大长度，如果超过了就清空
-    if (queue.second.size() > kQueueMaxSize) {
-      queue.second.clear();
-    }
-    break;
-  }
+  CriticalSection critical_section;
+  this->FillTxMailboxes();
 }
 
 /**
- * @brief 向消息队列里加入一条消息
+ * @brief 向消息队列里加入一条消息，有空闲的发送邮箱时会立刻发送，否则等发送邮箱空中断发送
  * @param id        数据帧ID
  * @param data      数据指针
  * @param size      数据长度
@@ -152,34 +172,74 @@ void BxCan::Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority)
   if (size > 8) {
     Throw(std::runtime_error("Data is too long for a CAN frame!"));
   }
-  // 检查消息队列长度是否超过了设定的最大长度，如果超过了就清空
-  if (tx_queue_[priority].size() > kQueueMaxSize) {
-    tx_queue_[priority].clear();
-  }
-  auto msg = std::make_shared<CanMsg>(CanMsg{
-      .rx_std_id = id,
-      .dlc = size,
-  });
-  std::copy_n(data, size, msg->data.begin());
+  CanMsg msg{.rx_std_id = id, .dlc = static_cast<u32>(size)};
+  std::copy_n(data, size, msg.data.begin());
+
+  CriticalSection critical_section;
+  this->PushTxQueue(msg, priority);
+  this->FillTxMailboxes();
+}
+
+/**
+ * @return 所有优先级的发送队列里一共有多少条报文
+ */
+usize BxCan::tx_queue_size() const {
+  CriticalSection critical_section;
+  return this->tx_queue_.size();
+}
 
-  tx_queue_[priority].push_back(msg);
+/**
+ * @brief 释放回调槽位，之后这个外设的中断不会再调用到已经析构的对象上
+ */
+BxCan::~BxCan() {
+  CanRxFifo0Callback::Unregister(this);
+  CanRxFifo1Callback::Unregister(this);
+  CanTxMailboxCallback::Unregister(this);
+  CanErrorCallback::Unregister(this);
 }
 
 /**
  * @brief 启动CAN外设
  */
 void BxCan::Begin() {
+  pCAN_CallbackTypeDef rx0_callback = CanRxFifo0Callback::Register<&BxCan::Fifo0MsgPendingCallback>(this);
+  pCAN_CallbackTypeDef rx1_callback = CanRxFifo1Callback::Register<&BxCan::Fifo1MsgPendingCallback>(this);
+  pCAN_CallbackTypeDef tx_callback = CanTxMailboxCallback::Register<&BxCan::TxMailboxCompleteCallback>(this);
+  pCAN_CallbackTypeDef error_callback = CanErrorCallback::Register<&BxCan::ErrorCallback>(this);
+  if (rx0_callback == nullptr || rx1_callback == nullptr || tx_callback == nullptr || error_callback == nullptr) {
+    Throw(std::runtime_error("Too many CAN instances"));
+  }
   HAL_StatusTypeDef hal_status;
-  hal_status = HAL_CAN_RegisterCallback(hcan_, HAL_CAN_RX_FIFO0_MSG_PENDING_CB_ID,
-                                        StdFunctionToCallbackFunctionPtr([this] { Fifo0MsgPendingCallback(); }, hcan_));
+  hal_status = HAL_CAN_RegisterCallback(hcan_, HAL_CAN_RX_FIFO0_MSG_PENDING_CB_ID, rx0_callback);
+  if (hal_status != HAL_OK) {
+    Throw(hal_error(hal_status));
+  }
+  hal_status = HAL_CAN_RegisterCallback(hcan_, HAL_CAN_RX_FIFO1_MSG_PENDING_CB_ID, rx1_callback);
   if (hal_status != HAL_OK) {
     Throw(hal_error(hal_status));
   }
+  for (auto callback_id : {HAL_CAN_TX_MAILBOX0_COMPLETE_CB_ID, HAL_CAN_TX_MAILBOX1_COMPLETE_CB_ID,
+                           HAL_CAN_TX_MAILBOX2_COMPLETE_CB_ID, HAL_CAN_TX_MAILBOX0_ABORT_CB_ID,
+                           HAL_CAN_TX_MAILBOX1_ABORT_CB_ID, HAL_CAN_TX_MAILBOX2_ABORT_CB_ID}) {
+    hal_status = HAL_CAN_RegisterCallback(hcan_, callback_id, tx_callback);
+    if (hal_status != HAL_OK) {
+      Throw(hal_error(hal_status));
+    }
+  }
+  hal_status = HAL_CAN_RegisterCallback(hcan_, HAL_CAN_ERROR_CB_ID, error_callback);
+  if (hal_status != HAL_OK) {
+    Throw(hal_error(hal_status));
+  }
+  // HAL_CAN_Init()之后外设还处在初始化模式，这时才能修改MCR
+  hcan_->Init.AutoBusOff = ENABLE;
+  hcan_->Instance->MCR |= CAN_MCR_ABOM;
   hal_status = HAL_CAN_Start(hcan_);
   if (hal_status != HAL_OK) {
     Throw(hal_error(hal_status));
   }
-  hal_status = HAL_CAN_ActivateNotification(hcan_, CAN_IT_RX_FIFO0_MSG_PENDING);
+  hal_status = HAL_CAN_ActivateNotification(
+      hcan_, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING | CAN_IT_TX_MAILBOX_EMPTY |
+                 CAN_IT_ERROR_WARNING | CAN_IT_ERROR_PASSIVE | CAN_IT_BUSOFF | CAN_IT_ERROR);
   if (hal_status != HAL_OK) {
     Throw(hal_error(hal_status));
   }
@@ -199,15 +259,220 @@ void BxCan::Stop() {
  * @brief 利用Register callbacks机制，用这个函数替代HAL_CAN_RxFifo0MsgPendingCallback
  * @note  这个函数替代了HAL_CAN_RxFifo0MsgPendingCallback，HAL库会调用这个函数，不要手动调用
  */
-void BxCan::Fifo0MsgPendingCallback() {
-  static CAN_RxHeaderTypeDef rx_header;
-  HAL_CAN_GetRxMessage(hcan_, CAN_RX_FIFO0, &rx_header, rx_buffer_.data.data());
-  if (device_list_.find(rx_header.StdId) == device_list_.end()) {
+void BxCan::Fifo0MsgPendingCallback() { this->ReadRxFifo(CAN_RX_FIFO0); }
+
+/**
+ * @brief 利用Register callbacks机制，用这个函数替代HAL_CAN_RxFifo1MsgPendingCallback
+ * @note  这个函数替代了HAL_CAN_RxFifo1MsgPendingCallback，HAL库会调用这个函数，不要手动调用
+ */
+void BxCan::Fifo1MsgPendingCallback() { this->ReadRxFifo(CAN_RX_FIFO1); }
+
+/**
+ * @brief 把接收FIFO里积压的报文全部读出来，交给设备或者放进延迟接收队列
+ * @note  硬件FIFO只有3级，一次中断只读一帧的话，总线负载高时中断次数多，处理不及时还会溢出
+ */
+void BxCan::ReadRxFifo(u32 fifo) {
+  this->CheckBusOffRecovered();
+  CAN_RxHeaderTypeDef rx_header;
+  CanMsg msg{};
+  while (HAL_CAN_GetRxFifoFillLevel(hcan_, fifo) > 0) {
+    if (HAL_CAN_GetRxMessage(hcan_, fifo, &rx_header, msg.data.data()) != HAL_OK) {
+      break;
+    }
+    msg.rx_std_id = rx_header.StdId;
+    msg.dlc = rx_header.DLC;
+    msg.timestamp_us = core::time::NowUs();
+    this->Receive(msg);
+  }
+}
+
+/**
+ * @brief 收到一帧报文：延迟接收模式下放进队列，否则直接交给设备
+ * @note  延迟接收队列是单生产者的，WriteLoopback会在中断之外调用这个函数，所以Push要在临界区里做
+ */
+void BxCan::Receive(const CanMsg &msg) {
+  if (this->deferred_rx_.enabled()) {
+    bool pushed;
+    {
+      CriticalSection critical_section;
+      pushed = this->deferred_rx_.Push(msg);
+    }
+    if (!pushed) {
+      this->ReportRxDrop(msg);
+    }
+  } else {
+    this->Dispatch(msg);
+  }
+}
+
+/**
+ * @brief 发送邮箱空中断的回调，一个邮箱发完或者被取消之后，从队列里取报文把空出来的邮箱填上
+ * @note  HAL库会调用这个函数，不要手动调用
+ */
+void BxCan::TxMailboxCompleteCallback() {
+  CriticalSection critical_section;
+  this->CheckBusOffRecovered();
+  this->FillTxMailboxes();
+}
+
+/**
+ * @brief 错误状态中断的回调，跟踪错误状态，进入bus-off时清空发送邮箱和发送队列
+ * @note  HAL库会调用这个函数，不要手动调用
+ */
+void BxCan::ErrorCallback() {
+  CriticalSection critical_section;
+  const u32 esr = hcan_->Instance->ESR;
+  CanBusState state = CanBusState::kErrorActive;
+  if (esr & CAN_ESR_BOFF) {
+    state = CanBusState::kBusOff;
+  } else if (esr & CAN_ESR_EPVF) {
+    state = CanBusState::kErrorPassive;
+  } else if (esr & CAN_ESR_EWGF) {
+    state = CanBusState::kErrorWarning;
+  }
+  ++this->error_counters_.error_frames;
+  if (state == this->error_counters_.state) {
     return;
   }
-  rx_buffer_.rx_std_id = rx_header.StdId;
-  rx_buffer_.dlc = rx_header.DLC;
-  device_list_[rx_header.StdId]->RxCallback(&rx_buffer_);
+  if (state == CanBusState::kBusOff) {
+    // 硬件会自己恢复(ABOM)，这里只需要把积压的旧报文清掉
+    ++this->error_counters_.bus_off_count;
+    HAL_CAN_AbortTxRequest(hcan_, CAN_TX_MAILBOX0 | CAN_TX_MAILBOX1 | CAN_TX_MAILBOX2);
+    this->FlushTxQueue();
+  } else if (this->error_counters_.state == CanBusState::kBusOff) {
+    ++this->error_counters_.restart_count;
+  }
+  this->error_counters_.state = state;
+  this->ReportBusState(state);
+}
+
+/**
+ * @brief bxCAN从bus-off恢复时没有中断，在收发中断里顺便检查一下
+ */
+void BxCan::CheckBusOffRecovered() {
+  CriticalSection critical_section;
+  if (this->error_counters_.state == CanBusState::kBusOff && !(hcan_->Instance->ESR & CAN_ESR_BOFF)) {
+    ++this->error_counters_.restart_count;
+    this->error_counters_.state = CanBusState::kErrorActive;
+    this->ReportBusState(CanBusState::kErrorActive);
+  }
+}
+
+/**
+ * @brief 丢弃发送队列里的所有报文；调用时要在临界区里
+ */
+void BxCan::FlushTxQueue() {
+  CanMsg msg;
+  while (this->tx_queue_.Pop(msg)) {
+    ++this->error_counters_.tx_flushed;
+    this->ReportTxDrop(msg);
+  }
+  this->ReportTxQueueDepth(0);
+}
+
+/**
+ * @return 控制器的错误状态和错误计数
+ */
+CanErrorCounters BxCan::error_counters() const {
+  CriticalSection critical_section;
+  CanErrorCounters counters = this->error_counters_;
+  const u32 esr = hcan_->Instance->ESR;
+  counters.tx_error_count = (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos;
+  counters.rx_error_count = (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
+  return counters;
+}
+
+/**
+ * @brief 按优先级从队列里取出报文，直到发送邮箱全满或者队列为空；调用时要在临界区里
+ */
+void BxCan::FillTxMailboxes() {
+  CanMsg msg;
+  bool popped = false;
+  while (HAL_CAN_GetTxMailboxesFreeLevel(hcan_) > 0 && this->tx_queue_.Pop(msg)) {
+    popped = true;
+    if (!this->AddToTxMailbox(msg)) {
+      this->ReportTxDrop(msg);
+    }
+  }
+  if (popped) {
+    this->ReportTxQueueDepth(this->tx_queue_.size());
+  }
+}
+
+/**
+ * @brief  把一帧报文填进空闲的发送邮箱；调用时要在临界区里
+ * @return 失败时返回false
+ */
+bool BxCan::AddToTxMailbox(const CanMsg &msg) {
+  hal_tx_header_.StdId = msg.rx_std_id;
+  hal_tx_header_.DLC = msg.dlc;
+  if (HAL_CAN_AddTxMessage(hcan_, &hal_tx_header_, msg.data.data(), &tx_mailbox_) != HAL_OK) {
+    return false;
+  }
+  this->ReportTx(msg);
+  return true;
+}
+
+/**
+ * @brief 把报文放进发送队列，队列满时按丢弃策略丢弃一帧；调用时要在临界区里
+ */
+void BxCan::PushTxQueue(const CanMsg &msg, CanTxPriority priority) {
+  CanMsg dropped;
+  if (!this->tx_queue_.Push(msg, priority, &dropped)) {
+    this->ReportTxDrop(dropped);
+  }
+  this->ReportTxQueueDepth(this->tx_queue_.size());
+}
+
+/**
+ * @brief 开启延迟接收：接收中断里只把报文放进无锁队列，由任务或者主循环调用ProcessRx()把报文交给设备
+ * @param queue_size 队列长度，会被向上取整到2的幂；队列满时新的报文会被丢弃并计入rx_overflow_count()
+ * @note  要在Begin()之前调用
+ */
+void BxCan::SetDeferredRx(usize queue_size) { this->deferred_rx_.Enable(queue_size); }
+
+/**
+ * @brief 设置延迟接收模式下，接收中断往队列里放了报文之后调用的通知函数，一般用来唤醒调用ProcessRx()的任务
+ * @param notify 通知函数，在中断里调用
+ * @param arg    传给通知函数的参数
+ */
+void BxCan::SetRxNotify(DeferredRx<CanMsg>::NotifyFunction notify, void *arg) { this->deferred_rx_.SetNotify(notify, arg); }
+
+/**
+ * @brief  延迟接收模式下，把队列里的报文依次交给设备，在任务或者主循环里调用
+ * @return 处理了多少帧报文
+ */
+usize BxCan::ProcessRx() {
+  if (!this->deferred_rx_.enabled()) {
+    return 0;
+  }
+  CanMsg msg;
+  usize count = 0;
+  while (this->deferred_rx_.Pop(msg)) {
+    this->Dispatch(msg);
+    ++count;
+  }
+  return count;
+}
+
+/**
+ * @return 延迟接收模式下，因为队列满而丢弃的报文数量
+ */
+u32 BxCan::rx_overflow_count() const { return this->deferred_rx_.overflow_count(); }
+
+/**
+ * @brief 把收到的报文交给注册了这个ID的设备
+ */
+void BxCan::Dispatch(const CanMsg &msg) {
+  if (this->TryRxFastPath(msg)) {
+    this->ReportRx(msg, true);
+    return;
+  }
+  device::CanDevice *device = this->device_list_.Find(msg.rx_std_id);
+  this->ReportRx(msg, device != nullptr);
+  if (device != nullptr) {
+    device->Deliver(msg);
+  }
 }
 
 /**
@@ -216,10 +481,9 @@ void BxCan::Fifo0MsgPendingCallback() {
  * @param rx_stdid  设备想要接收的的rx消息标准帧id
  */
 void BxCan::RegisterDevice(device::CanDevice &device, u32 rx_stdid) {
-  if (device_list_.find(rx_stdid) != device_list_.end()) {
+  if (!device_list_.Insert(rx_stdid, &device)) {
     Throw(std::runtime_error("Device already registered"));
   }
-  device_list_[rx_stdid] = &device;
 }
 
 }  // namespace rm::hal::stm32
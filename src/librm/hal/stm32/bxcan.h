@@ -31,46 +31,75 @@
 #include "librm/hal/stm32/hal.h"
 #if defined(HAL_CAN_MODULE_ENABLED)
 
-#include <unordered_map>
-#include <deque>
-#include <memory>
-
 #include "librm/hal/can_interface.h"
+#include "librm/hal/can_device_table.hpp"
+#include "librm/hal/can_tx_queue.hpp"
+#include "librm/hal/stm32/can_rx_fifo.h"
+#include "librm/hal/stm32/deferred_rx.h"
 #include "librm/device/can_device.hpp"
 
 namespace rm::hal::stm32 {
 
 /**
  * @brief bxCAN类库
+ * @note  Enqueue()的报文放进定长的发送队列，由发送邮箱空中断自动取出来填进邮箱，三个发送邮箱会一直保持忙碌，
+ *        不需要用户轮询Write()；CubeMX里要打开CANx TX中断
+ * @note  Write()在有空闲邮箱时立刻发送，邮箱全满时不再抛异常，而是把报文放进高优先级队列，由中断稍后发送
+ * @note  发送路径上不会访问堆，所有优先级严格按 高->普通->低 的顺序发送
+ * @note  默认在接收中断里直接调用设备的回调；调用SetDeferredRx()之后中断里只把报文放进队列，由任务调用ProcessRx()分发
+ * @note  每次接收中断都会把FIFO里积压的报文全部读完；可以用AddFilter()把低优先级的报文分到FIFO1，
+ *        这时CubeMX里要同时打开CANx RX0和RX1中断，并且两者要配置成同一个抢占优先级
+ *        (同一个外设的接收回调不能互相打断，延迟接收队列只允许一个生产者)
+ * @note  Begin()会打开硬件的自动离线恢复(ABOM)，进入bus-off之后硬件在总线上检测到128次11个隐性位就会自动恢复，
+ *        1Mbps下大约1.4ms；进入bus-off时会取消发送邮箱里的报文并清空发送队列，CubeMX里要打开CANx SCE中断
  */
 class BxCan final : public CanInterface {
  public:
   explicit BxCan(CAN_HandleTypeDef &hcan);
   BxCan() = default;
-  ~BxCan() override = default;
+  ~BxCan() override;
 
   // 禁止拷贝构造
   BxCan(const BxCan &) = delete;
   BxCan &operator=(const BxCan &) = delete;
 
   void SetFilter(u16 id, u16 mask) override;
+  void AddFilter(u16 id, u16 mask, CanRxFifo fifo);
   void Write(u16 id, const u8 *data, usize size) override;
+  void WriteLoopback(u16 id, const u8 *data, usize size) override;
   void Write() override;
   void Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) override;
   void Begin() override;
   void Stop() override;
 
+  void SetTxDropPolicy(CanTxDropPolicy policy);
+  void SetDeferredRx(usize queue_size);
+  void SetRxNotify(DeferredRx<CanMsg>::NotifyFunction notify, void *arg);
+  usize ProcessRx();
+
+  [[nodiscard]] usize tx_queue_size() const;
+  [[nodiscard]] u32 rx_overflow_count() const;
+  [[nodiscard]] CanErrorCounters error_counters() const override;
+
  private:
   void RegisterDevice(device::CanDevice &device, u32 rx_stdid) override;
   void Fifo0MsgPendingCallback();
+  void Fifo1MsgPendingCallback();
+  void ReadRxFifo(u32 fifo);
+  void Receive(const CanMsg &msg);
+  void Dispatch(const CanMsg &msg);
+  void TxMailboxCompleteCallback();
+  void ErrorCallback();
+  void CheckBusOffRecovered();
+  void FlushTxQueue();
+  void FillTxMailboxes();
+  bool AddToTxMailbox(const CanMsg &msg);
+  void PushTxQueue(const CanMsg &msg, CanTxPriority priority);
 
   u32 tx_mailbox_{0};
-  CanMsg rx_buffer_{};
-  std::unordered_map<CanTxPriority, std::deque<std::shared_ptr<CanMsg>>> tx_queue_{
-      {CanTxPriority::kHigh, {}},
-      {CanTxPriority::kNormal, {}},
-      {CanTxPriority::kLow, {}},
-  };  // <priority, queue>
+  u32 filter_count_{0};
+  DeferredRx<CanMsg> deferred_rx_{};
+  CanTxQueue<16> tx_queue_{};  // 只能在关中断的临界区里访问
   CAN_HandleTypeDef *hcan_{nullptr};
   CAN_TxHeaderTypeDef hal_tx_header_ = {
       .StdId = 0,
@@ -80,14 +109,8 @@ class BxCan final : public CanInterface {
       .DLC = 0,
       .TransmitGlobalTime = DISABLE,
   };
-  std::unordered_map<u16, device::CanDevice *> device_list_{};  // <rx_stdid, device>
-
-  /**
-   * @brief 消息队列最大长度
-   * @note  在插入或发送消息的时候，如果检测到消息队列长度超过这个值，就会清空消息队列（待发送的消息都会被丢弃）
-   * @note  触发清空队列的动作意味着插入消息的速度大于发送消息的速度，应该减少发送消息的数量
-   */
-  static constexpr usize kQueueMaxSize = 100;
+  CanDeviceTable<device::CanDevice> device_list_{};  // <rx_stdid, device>
+  CanErrorCounters error_counters_{};                 // 只在中断里修改，state以外的TEC/REC在读的时候从寄存器里取
 };
 
 }  // namespace rm::hal::stm32
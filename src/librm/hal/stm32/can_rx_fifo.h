@@ -0,0 +1,45 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/stm32/can_rx_fifo.h
+ * @brief bxCAN和FDCAN共用的接收FIFO编号
+ */
+
+#ifndef LIBRM_HAL_STM32_CAN_RX_FIFO_H
+#define LIBRM_HAL_STM32_CAN_RX_FIFO_H
+
+namespace rm::hal::stm32 {
+
+/**
+ * @brief 接收FIFO
+ * @note  两个FIFO各有自己的中断，可以把电机反馈这种高频、对延迟敏感的报文放进FIFO0，
+ *        超级电容、参数应答这种低频报文放进FIFO1，减少互相挤占造成的FIFO溢出
+ */
+enum class CanRxFifo {
+  kFifo0,
+  kFifo1,
+};
+
+}  // namespace rm::hal::stm32
+
+#endif  // LIBRM_HAL_STM32_CAN_RX_FIFO_H
@@ -0,0 +1,57 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/stm32/critical_section.h
+ * @brief 关中断的临界区
+ */
+
+#ifndef LIBRM_HAL_STM32_CRITICAL_SECTION_H
+#define LIBRM_HAL_STM32_CRITICAL_SECTION_H
+
+#include "librm/hal/stm32/hal.h"
+
+#include "librm/core/typedefs.h"
+
+namespace rm::hal::stm32 {
+
+/**
+ * @brief 关中断的临界区，构造时保存PRIMASK并关中断，析构时恢复
+ * @note  可以嵌套，也可以在中断里使用；恢复的是进入前的状态，所以不会在外层临界区里提前打开中断
+ * @note  临界区里的代码要尽量短，关中断期间所有中断都会被推迟
+ */
+class CriticalSection {
+ public:
+  CriticalSection() : primask_(__get_PRIMASK()) { __disable_irq(); }
+  ~CriticalSection() { __set_PRIMASK(this->primask_); }
+
+  // 禁止拷贝构造
+  CriticalSection(const CriticalSection &) = delete;
+  CriticalSection &operator=(const CriticalSection &) = delete;
+
+ private:
+  u32 primask_;
+};
+
+}  // namespace rm::hal::stm32
+
+#endif  // LIBRM_HAL_STM32_CRITICAL_SECTION_H
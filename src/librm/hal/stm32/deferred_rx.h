@@ -0,0 +1,129 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/stm32/deferred_rx.h
+ * @brief 把接收中断里的数据交给任务处理的无锁队列
+ */
+
+#ifndef LIBRM_HAL_STM32_DEFERRED_RX_H
+#define LIBRM_HAL_STM32_DEFERRED_RX_H
+
+#include <atomic>
+#include <memory>
+
+#include "librm/core/spsc_queue.hpp"
+#include "librm/core/typedefs.h"
+
+namespace rm::hal::stm32 {
+
+/**
+ * @brief  延迟接收队列
+ * @note   默认情况下CAN、串口的接收中断会直接调用设备的解码函数，DirectDriveMotor、裁判系统解析这种比较重的处理会把中断拖得很长，
+ *         推迟其他中断。开启延迟接收之后，中断里只把数据拷贝进这个无锁队列，由RTOS任务或者主循环调用ProcessRx()再分发
+ * @note   中断是唯一的生产者，调用ProcessRx()的任务是唯一的消费者
+ * @tparam T 队列元素类型
+ */
+template <typename T>
+class DeferredRx {
+ public:
+  /**
+   * @brief 接收中断往队列里放了数据之后调用的通知函数，可以用来唤醒处理数据的任务，比如
+   *        [](void *thread) { osThreadFlagsSet(static_cast<osThreadId_t>(thread), 1); }
+   */
+  using NotifyFunction = void (*)(void *arg);
+
+  /**
+   * @param capacity 队列容量，会被向上取整到2的幂
+   */
+  void Enable(usize capacity) { this->queue_ = std::make_unique<core::SpscQueue<T>>(capacity); }
+
+  void SetNotify(NotifyFunction notify, void *arg) {
+    this->notify_ = notify;
+    this->notify_arg_ = arg;
+  }
+
+  /**
+   * @brief  在中断里调用，把一个元素放进队列
+   * @return 队列满时返回false，并计入溢出计数
+   */
+  bool Push(const T &item) {
+    if (!this->queue_->Push(item)) {
+      this->overflow_count_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    this->Notify();
+    return true;
+  }
+
+  /**
+   * @brief  在中断里调用，把一组元素整体放进队列
+   * @return 队列剩余空间不够时返回false，一个元素也不会放进去，并计入一次溢出
+   */
+  bool PushBulk(const T *items, usize count) {
+    if (!this->queue_->PushBulk(items, count)) {
+      this->overflow_count_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    this->Notify();
+    return true;
+  }
+
+  /**
+   * @brief  在任务里调用，取出队列里的一个元素
+   * @return 队列为空时返回false
+   */
+  bool Pop(T &item) { return this->queue_->Pop(item); }
+
+  usize PopBulk(T *items, usize count) { return this->queue_->PopBulk(items, count); }
+
+  /**
+   * @return 是否开启了延迟接收
+   */
+  [[nodiscard]] bool enabled() const { return this->queue_ != nullptr; }
+
+  /**
+   * @return 队列是否已经满了
+   */
+  [[nodiscard]] bool full() const { return this->queue_->size() >= this->queue_->capacity(); }
+
+  /**
+   * @return 队列满而被丢弃的次数
+   */
+  [[nodiscard]] u32 overflow_count() const { return this->overflow_count_.load(std::memory_order_relaxed); }
+
+ private:
+  void Notify() {
+    if (this->notify_ != nullptr) {
+      this->notify_(this->notify_arg_);
+    }
+  }
+
+  std::unique_ptr<core::SpscQueue<T>> queue_{};
+  NotifyFunction notify_{nullptr};
+  void *notify_arg_{nullptr};
+  std::atomic<u32> overflow_count_{0};
+};
+
+}  // namespace rm::hal::stm32
+
+#endif  // LIBRM_HAL_STM32_DEFERRED_RX_H
@@ -0,0 +1,890 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/stm32/fake/stm32_hal_fake.cc
+ * @brief 模拟STM32 HAL库的实现
+ */
+
+#if defined(LIBRM_STM32_FAKE_HAL)
+
+#include "librm/hal/stm32/fake/stm32_hal_fake.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+
+DWT_Type fake_dwt{};
+CoreDebug_Type fake_core_debug{};
+uint32_t SystemCoreClock = 168000000;
+
+CAN_TypeDef fake_can1{};
+CAN_TypeDef fake_can2{};
+FDCAN_GlobalTypeDef fake_fdcan1{};
+FDCAN_GlobalTypeDef fake_fdcan2{};
+FDCAN_GlobalTypeDef fake_fdcan3{};
+
+namespace {
+
+using rm::hal::stm32::fake::CanFrame;
+using rm::hal::stm32::fake::I2cHandler;
+using rm::hal::stm32::fake::SpiHandler;
+
+constexpr size_t kBxCanMailboxCount = 3;
+constexpr size_t kBxCanRxFifoDepth = 3;
+constexpr uint32_t kBxCanFilterBankCount = 28;
+constexpr uint32_t kFdcanDefaultFifoDepth = 3;
+constexpr uint32_t kFdcanDlcShift = 16;
+constexpr std::array<uint8_t, 16> kCanDlcToLength{0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+struct BxCanFilterBank {
+  bool active{false};
+  uint32_t id{0};
+  uint32_t mask{0};
+  uint32_t fifo{CAN_FILTER_FIFO0};
+};
+
+struct BxCanState {
+  bool started{false};
+  uint32_t active_its{0};
+  std::array<std::deque<CanFrame>, 2> rx_fifo{};
+  std::array<bool, kBxCanMailboxCount> mailbox_used{};
+  std::array<CanFrame, kBxCanMailboxCount> mailbox{};
+};
+
+struct FdcanFilter {
+  FDCAN_FilterTypeDef config{};
+  bool valid{false};
+};
+
+struct FdcanState {
+  bool started{false};
+  uint32_t active_its{0};
+  uint32_t non_matching_std{FDCAN_ACCEPT_IN_RX_FIFO0};
+  std::vector<FdcanFilter> filters{};
+  std::array<std::deque<CanFrame>, 2> rx_fifo{};
+  std::deque<std::pair<uint32_t, CanFrame>> tx_fifo{};  // 发送缓冲区编号和报文
+  FDCAN_ProtocolStatusTypeDef protocol_status{};
+  FDCAN_ErrorCountersTypeDef error_counters{};
+};
+
+struct UartState {
+  uint8_t *rx_buffer{nullptr};
+  uint16_t rx_size{0};
+  std::vector<uint8_t> tx{};
+};
+
+// 所有模拟外设的状态，Reset()时清空
+struct FakeHal {
+  std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+  uint32_t primask{0};
+  uint32_t irq_depth{0};
+  std::array<BxCanFilterBank, kBxCanFilterBankCount> can_filter_banks{};
+  uint32_t can_slave_start_filter_bank{14};
+  std::unordered_map<const CAN_HandleTypeDef *, BxCanState> can{};
+  std::unordered_map<const FDCAN_HandleTypeDef *, FdcanState> fdcan{};
+  std::unordered_map<const UART_HandleTypeDef *, UartState> uart{};
+  std::unordered_map<const SPI_HandleTypeDef *, SpiHandler> spi{};
+  std::unordered_map<const I2C_HandleTypeDef *, I2cHandler> i2c{};
+};
+
+FakeHal &FakeState() {
+  static FakeHal instance;
+  return instance;
+}
+
+/**
+ * @brief 模拟进入一次中断，中断里__get_IPSR()返回非0
+ */
+template <typename Fn>
+void RunIrq(Fn &&fn) {
+  ++FakeState().irq_depth;
+  fn();
+  --FakeState().irq_depth;
+}
+
+uint64_t ElapsedNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - FakeState().start).count();
+}
+
+CanFrame MakeFrame(uint32_t id, const uint8_t *data, uint8_t size) {
+  CanFrame frame{};
+  frame.id = id;
+  frame.size = std::min<uint8_t>(size, sizeof(frame.data));
+  if (data != nullptr) {
+    std::memcpy(frame.data, data, frame.size);
+  }
+  return frame;
+}
+
+/**
+ * @return 这个bxCAN实例的第一个过滤器组，CAN2从SlaveStartFilterBank开始
+ */
+uint32_t BxCanFirstBank(const CAN_HandleTypeDef *hcan) {
+  return hcan->Instance == CAN2 ? FakeState().can_slave_start_filter_bank : 0;
+}
+
+uint32_t BxCanLastBank(const CAN_HandleTypeDef *hcan) {
+  return hcan->Instance == CAN2 ? kBxCanFilterBankCount : FakeState().can_slave_start_filter_bank;
+}
+
+uint32_t FdcanFifoDepth(uint32_t configured) { return configured == 0 ? kFdcanDefaultFifoDepth : configured; }
+
+uint32_t FdcanFifoIndex(uint32_t rx_location) { return rx_location == FDCAN_RX_FIFO1 ? 1 : 0; }
+
+uint32_t FdcanLengthToDlc(uint8_t size) {
+  for (uint32_t dlc = 0; dlc < kCanDlcToLength.size(); ++dlc) {
+    if (kCanDlcToLength[dlc] >= size) {
+      return dlc;
+    }
+  }
+  return kCanDlcToLength.size() - 1;
+}
+
+/**
+ * @return 报文按FDCAN过滤器的配置进入哪个FIFO，被拒绝时返回-1
+ */
+int FdcanRoute(const FdcanState &state, uint32_t id) {
+  for (const FdcanFilter &filter : state.filters) {
+    if (!filter.valid || filter.config.FilterConfig == FDCAN_FILTER_DISABLE) {
+      continue;
+    }
+    const FDCAN_FilterTypeDef &config = filter.config;
+    bool match = false;
+    switch (config.FilterType) {
+      case FDCAN_FILTER_RANGE:
+        match = id >= config.FilterID1 && id <= config.FilterID2;
+        break;
+      case FDCAN_FILTER_DUAL:
+        match = id == config.FilterID1 || id == config.FilterID2;
+        break;
+      case FDCAN_FILTER_MASK:
+        match = (id & config.FilterID2) == (config.FilterID1 & config.FilterID2);
+        break;
+      default:
+        break;
+    }
+    if (!match) {
+      continue;
+    }
+    switch (config.FilterConfig) {
+      case FDCAN_FILTER_TO_RXFIFO0:
+        return 0;
+      case FDCAN_FILTER_TO_RXFIFO1:
+        return 1;
+      default:
+        return -1;
+    }
+  }
+  switch (state.non_matching_std) {
+    case FDCAN_ACCEPT_IN_RX_FIFO0:
+      return 0;
+    case FDCAN_ACCEPT_IN_RX_FIFO1:
+      return 1;
+    default:
+      return -1;
+  }
+}
+
+}  // namespace
+
+FakeCycleCounter::operator uint32_t() const volatile {
+  return static_cast<uint32_t>(ElapsedNs() * (SystemCoreClock / 1000000) / 1000);
+}
+
+/******** core ********/
+
+uint32_t __get_IPSR(void) { return FakeState().irq_depth > 0 ? 16 : 0; }
+
+uint32_t __get_PRIMASK(void) { return FakeState().primask; }
+
+void __set_PRIMASK(uint32_t primask) { FakeState().primask = primask; }
+
+void __disable_irq(void) { FakeState().primask = 1; }
+
+void __enable_irq(void) { FakeState().primask = 0; }
+
+void HAL_Delay(uint32_t delay) { std::this_thread::sleep_for(std::chrono::milliseconds(delay)); }
+
+uint32_t HAL_GetTick(void) { return static_cast<uint32_t>(ElapsedNs() / 1000000); }
+
+uint32_t HAL_RCC_GetSysClockFreq(void) { return SystemCoreClock; }
+
+/******** GPIO ********/
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+  if (PinState == GPIO_PIN_SET) {
+    GPIOx->ODR |= GPIO_Pin;
+  } else {
+    GPIOx->ODR &= ~static_cast<uint32_t>(GPIO_Pin);
+  }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+  return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+/******** SPI ********/
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+  return HAL_SPI_TransmitReceive(hspi, pData, nullptr, Size, Timeout);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+  return HAL_SPI_TransmitReceive(hspi, nullptr, pData, Size, Timeout);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size,
+                                          uint32_t Timeout) {
+  (void)Timeout;
+  auto it = FakeState().spi.find(hspi);
+  if (it == FakeState().spi.end() || !it->second) {
+    // 没有从机时MISO是空闲电平
+    if (pRxData != nullptr) {
+      std::memset(pRxData, 0xff, Size);
+    }
+    return HAL_OK;
+  }
+  it->second(pTxData, pRxData, Size);
+  return HAL_OK;
+}
+
+/******** I2C ********/
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                    uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+  (void)MemAddSize;
+  (void)Timeout;
+  auto it = FakeState().i2c.find(hi2c);
+  if (it == FakeState().i2c.end() || !it->second) {
+    return HAL_ERROR;  // 没有从机应答
+  }
+  return it->second(true, DevAddress, MemAddress, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                   uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+  (void)MemAddSize;
+  (void)Timeout;
+  auto it = FakeState().i2c.find(hi2c);
+  if (it == FakeState().i2c.end() || !it->second) {
+    return HAL_ERROR;
+  }
+  return it->second(false, DevAddress, MemAddress, pData, Size);
+}
+
+/******** UART ********/
+
+HAL_StatusTypeDef HAL_UART_RegisterCallback(UART_HandleTypeDef *huart, HAL_UART_CallbackIDTypeDef CallbackID,
+                                            pUART_CallbackTypeDef pCallback) {
+  if (CallbackID != HAL_UART_ERROR_CB_ID) {
+    return HAL_ERROR;
+  }
+  huart->ErrorCallback = pCallback;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_RegisterRxEventCallback(UART_HandleTypeDef *huart, pUART_RxEventCallbackTypeDef pCallback) {
+  huart->RxEventCallback = pCallback;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+  (void)Timeout;
+  std::vector<uint8_t> &tx = FakeState().uart[huart].tx;
+  tx.insert(tx.end(), pData, pData + Size);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size) {
+  return HAL_UART_Transmit(huart, pData, Size, 0);
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size) {
+  return HAL_UART_Transmit(huart, pData, Size, 0);
+}
+
+HAL_StatusTypeDef HAL_UART_Receive(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+  // 阻塞接收在模拟里没有数据源，直接当作超时
+  (void)huart;
+  (void)pData;
+  (void)Size;
+  (void)Timeout;
+  return HAL_TIMEOUT;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size) {
+  UartState &state = FakeState().uart[huart];
+  state.rx_buffer = pData;
+  state.rx_size = Size;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size) {
+  return HAL_UART_Receive_IT(huart, pData, Size);
+}
+
+/******** bxCAN ********/
+
+HAL_StatusTypeDef HAL_CAN_ConfigFilter(CAN_HandleTypeDef *hcan, const CAN_FilterTypeDef *sFilterConfig) {
+  (void)hcan;
+  if (sFilterConfig->FilterBank >= kBxCanFilterBankCount ||
+      sFilterConfig->SlaveStartFilterBank > kBxCanFilterBankCount) {
+    return HAL_ERROR;
+  }
+  FakeState().can_slave_start_filter_bank = sFilterConfig->SlaveStartFilterBank;
+  BxCanFilterBank &bank = FakeState().can_filter_banks[sFilterConfig->FilterBank];
+  // 只模拟32位掩码模式，别的模式的过滤器当作没有启用
+  bank.active = sFilterConfig->FilterActivation == ENABLE && sFilterConfig->FilterMode == CAN_FILTERMODE_IDMASK &&
+                sFilterConfig->FilterScale == CAN_FILTERSCALE_32BIT;
+  bank.id = (sFilterConfig->FilterIdHigh << 16) | sFilterConfig->FilterIdLow;
+  bank.mask = (sFilterConfig->FilterMaskIdHigh << 16) | sFilterConfig->FilterMaskIdLow;
+  bank.fifo = sFilterConfig->FilterFIFOAssignment;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef *hcan) {
+  FakeState().can[hcan].started = true;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_Stop(CAN_HandleTypeDef *hcan) {
+  FakeState().can[hcan].started = false;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_AddTxMessage(CAN_HandleTypeDef *hcan, const CAN_TxHeaderTypeDef *pHeader,
+                                       const uint8_t aData[], uint32_t *pTxMailbox) {
+  BxCanState &state = FakeState().can[hcan];
+  if (!state.started) {
+    return HAL_ERROR;
+  }
+  for (size_t i = 0; i < kBxCanMailboxCount; ++i) {
+    if (!state.mailbox_used[i]) {
+      state.mailbox_used[i] = true;
+      state.mailbox[i] = MakeFrame(pHeader->StdId, aData, std::min<uint32_t>(pHeader->DLC, 8));
+      if (pTxMailbox != nullptr) {
+        *pTxMailbox = CAN_TX_MAILBOX0 << i;
+      }
+      return HAL_OK;
+    }
+  }
+  return HAL_ERROR;
+}
+
+/**
+ * @note 直接清空邮箱，不触发发送取消的回调
+ */
+HAL_StatusTypeDef HAL_CAN_AbortTxRequest(CAN_HandleTypeDef *hcan, uint32_t TxMailboxes) {
+  BxCanState &state = FakeState().can[hcan];
+  for (size_t i = 0; i < kBxCanMailboxCount; ++i) {
+    if (TxMailboxes & (CAN_TX_MAILBOX0 << i)) {
+      state.mailbox_used[i] = false;
+    }
+  }
+  return HAL_OK;
+}
+
+uint32_t HAL_CAN_GetTxMailboxesFreeLevel(const CAN_HandleTypeDef *hcan) {
+  const BxCanState &state = FakeState().can[hcan];
+  return std::count(state.mailbox_used.begin(), state.mailbox_used.end(), false);
+}
+
+HAL_StatusTypeDef HAL_CAN_GetRxMessage(CAN_HandleTypeDef *hcan, uint32_t RxFifo, CAN_RxHeaderTypeDef *pHeader,
+                                       uint8_t aData[]) {
+  std::deque<CanFrame> &fifo = FakeState().can[hcan].rx_fifo[RxFifo == CAN_RX_FIFO1 ? 1 : 0];
+  if (fifo.empty()) {
+    return HAL_ERROR;
+  }
+  const CanFrame &frame = fifo.front();
+  *pHeader = CAN_RxHeaderTypeDef{};
+  pHeader->StdId = frame.id;
+  pHeader->IDE = CAN_ID_STD;
+  pHeader->RTR = CAN_RTR_DATA;
+  pHeader->DLC = frame.size;
+  std::memcpy(aData, frame.data, frame.size);
+  fifo.pop_front();
+  return HAL_OK;
+}
+
+uint32_t HAL_CAN_GetRxFifoFillLevel(const CAN_HandleTypeDef *hcan, uint32_t RxFifo) {
+  return FakeState().can[hcan].rx_fifo[RxFifo == CAN_RX_FIFO1 ? 1 : 0].size();
+}
+
+HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef *hcan, uint32_t ActiveITs) {
+  FakeState().can[hcan].active_its |= ActiveITs;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_DeactivateNotification(CAN_HandleTypeDef *hcan, uint32_t InactiveITs) {
+  FakeState().can[hcan].active_its &= ~InactiveITs;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_RegisterCallback(CAN_HandleTypeDef *hcan, HAL_CAN_CallbackIDTypeDef CallbackID,
+                                           pCAN_CallbackTypeDef pCallback) {
+  switch (CallbackID) {
+    case HAL_CAN_TX_MAILBOX0_COMPLETE_CB_ID:
+      hcan->TxMailbox0CompleteCallback = pCallback;
+      break;
+    case HAL_CAN_TX_MAILBOX1_COMPLETE_CB_ID:
+      hcan->TxMailbox1CompleteCallback = pCallback;
+      break;
+    case HAL_CAN_TX_MAILBOX2_COMPLETE_CB_ID:
+      hcan->TxMailbox2CompleteCallback = pCallback;
+      break;
+    case HAL_CAN_TX_MAILBOX0_ABORT_CB_ID:
+      hcan->TxMailbox0AbortCallback = pCallback;
+      break;
+    case HAL_CAN_TX_MAILBOX1_ABORT_CB_ID:
+      hcan->TxMailbox1AbortCallback = pCallback;
+      break;
+    case HAL_CAN_TX_MAILBOX2_ABORT_CB_ID:
+      hcan->TxMailbox2AbortCallback = pCallback;
+      break;
+    case HAL_CAN_RX_FIFO0_MSG_PENDING_CB_ID:
+      hcan->RxFifo0MsgPendingCallback = pCallback;
+      break;
+    case HAL_CAN_RX_FIFO1_MSG_PENDING_CB_ID:
+      hcan->RxFifo1MsgPendingCallback = pCallback;
+      break;
+    case HAL_CAN_ERROR_CB_ID:
+      hcan->ErrorCallback = pCallback;
+      break;
+    default:
+      return HAL_ERROR;
+  }
+  return HAL_OK;
+}
+
+uint32_t HAL_CAN_GetError(const CAN_HandleTypeDef *hcan) { return hcan->ErrorCode; }
+
+HAL_StatusTypeDef HAL_CAN_ResetError(CAN_HandleTypeDef *hcan) {
+  hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+  return HAL_OK;
+}
+
+/******** FDCAN ********/
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigFilter(FDCAN_HandleTypeDef *hfdcan, const FDCAN_FilterTypeDef *sFilterConfig) {
+  if (sFilterConfig->IdType != FDCAN_STANDARD_ID) {
+    return HAL_OK;  // 只模拟标准帧
+  }
+  if (sFilterConfig->FilterIndex >= hfdcan->Init.StdFiltersNbr) {
+    return HAL_ERROR;
+  }
+  std::vector<FdcanFilter> &filters = FakeState().fdcan[hfdcan].filters;
+  if (filters.size() <= sFilterConfig->FilterIndex) {
+    filters.resize(sFilterConfig->FilterIndex + 1);
+  }
+  filters[sFilterConfig->FilterIndex] = {*sFilterConfig, true};
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigGlobalFilter(FDCAN_HandleTypeDef *hfdcan, uint32_t NonMatchingStd,
+                                               uint32_t NonMatchingExt, uint32_t RejectRemoteStd,
+                                               uint32_t RejectRemoteExt) {
+  (void)NonMatchingExt;
+  (void)RejectRemoteStd;
+  (void)RejectRemoteExt;
+  FakeState().fdcan[hfdcan].non_matching_std = NonMatchingStd;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_Start(FDCAN_HandleTypeDef *hfdcan) {
+  FakeState().fdcan[hfdcan].started = true;
+  hfdcan->Instance->CCCR &= ~FDCAN_CCCR_INIT;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_Stop(FDCAN_HandleTypeDef *hfdcan) {
+  FakeState().fdcan[hfdcan].started = false;
+  hfdcan->Instance->CCCR |= FDCAN_CCCR_INIT;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_AddMessageToTxFifoQ(FDCAN_HandleTypeDef *hfdcan, const FDCAN_TxHeaderTypeDef *pTxHeader,
+                                                const uint8_t *pTxData) {
+  FdcanState &state = FakeState().fdcan[hfdcan];
+  const uint32_t depth = FdcanFifoDepth(hfdcan->Init.TxFifoQueueElmtsNbr);
+  if (!state.started || state.tx_fifo.size() >= depth) {
+    return HAL_ERROR;
+  }
+  // 找一个没在用的发送缓冲区
+  uint32_t index = 0;
+  while (std::any_of(state.tx_fifo.begin(), state.tx_fifo.end(),
+                     [index](const std::pair<uint32_t, CanFrame> &entry) { return entry.first == index; })) {
+    ++index;
+  }
+  const uint8_t size = kCanDlcToLength[(pTxHeader->DataLength >> kFdcanDlcShift) & 0xf];
+  state.tx_fifo.emplace_back(index, MakeFrame(pTxHeader->Identifier, pTxData, size));
+  return HAL_OK;
+}
+
+uint32_t HAL_FDCAN_GetTxFifoFreeLevel(const FDCAN_HandleTypeDef *hfdcan) {
+  return FdcanFifoDepth(hfdcan->Init.TxFifoQueueElmtsNbr) - FakeState().fdcan[hfdcan].tx_fifo.size();
+}
+
+HAL_StatusTypeDef HAL_FDCAN_GetRxMessage(FDCAN_HandleTypeDef *hfdcan, uint32_t RxLocation,
+                                         FDCAN_RxHeaderTypeDef *pRxHeader, uint8_t *pRxData) {
+  std::deque<CanFrame> &fifo = FakeState().fdcan[hfdcan].rx_fifo[FdcanFifoIndex(RxLocation)];
+  if (fifo.empty()) {
+    return HAL_ERROR;
+  }
+  const CanFrame &frame = fifo.front();
+  *pRxHeader = FDCAN_RxHeaderTypeDef{};
+  pRxHeader->Identifier = frame.id;
+  pRxHeader->IdType = FDCAN_STANDARD_ID;
+  pRxHeader->RxFrameType = FDCAN_DATA_FRAME;
+  pRxHeader->DataLength = FdcanLengthToDlc(frame.size) << kFdcanDlcShift;
+  pRxHeader->BitRateSwitch = FDCAN_BRS_OFF;
+  pRxHeader->FDFormat = frame.size > 8 ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN;
+  std::memcpy(pRxData, frame.data, frame.size);
+  fifo.pop_front();
+  return HAL_OK;
+}
+
+uint32_t HAL_FDCAN_GetRxFifoFillLevel(const FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo) {
+  return FakeState().fdcan[hfdcan].rx_fifo[FdcanFifoIndex(RxFifo)].size();
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ActivateNotification(FDCAN_HandleTypeDef *hfdcan, uint32_t ActiveITs,
+                                                 uint32_t BufferIndexes) {
+  (void)BufferIndexes;
+  FakeState().fdcan[hfdcan].active_its |= ActiveITs;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_DeactivateNotification(FDCAN_HandleTypeDef *hfdcan, uint32_t InactiveITs) {
+  FakeState().fdcan[hfdcan].active_its &= ~InactiveITs;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_RegisterCallback(FDCAN_HandleTypeDef *hfdcan, HAL_FDCAN_CallbackIDTypeDef CallbackID,
+                                             pFDCAN_CallbackTypeDef pCallback) {
+  // librm的驱动不用这几种回调
+  (void)hfdcan;
+  (void)CallbackID;
+  (void)pCallback;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_RegisterRxFifo0Callback(FDCAN_HandleTypeDef *hfdcan,
+                                                    pFDCAN_RxFifo0CallbackTypeDef pCallback) {
+  hfdcan->RxFifo0Callback = pCallback;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_RegisterRxFifo1Callback(FDCAN_HandleTypeDef *hfdcan,
+                                                    pFDCAN_RxFifo1CallbackTypeDef pCallback) {
+  hfdcan->RxFifo1Callback = pCallback;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_RegisterTxBufferCompleteCallback(FDCAN_HandleTypeDef *hfdcan,
+                                                             pFDCAN_TxBufferCompleteCallbackTypeDef pCallback) {
+  hfdcan->TxBufferCompleteCallback = pCallback;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_RegisterErrorStatusCallback(FDCAN_HandleTypeDef *hfdcan,
+                                                        pFDCAN_ErrorStatusCallbackTypeDef pCallback) {
+  hfdcan->ErrorStatusCallback = pCallback;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_AbortTxRequest(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndex) {
+  std::deque<std::pair<uint32_t, CanFrame>> &tx_fifo = FakeState().fdcan[hfdcan].tx_fifo;
+  tx_fifo.erase(std::remove_if(tx_fifo.begin(), tx_fifo.end(),
+                               [BufferIndex](const std::pair<uint32_t, CanFrame> &entry) {
+                                 return BufferIndex & (1u << entry.first);
+                               }),
+                tx_fifo.end());
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_GetProtocolStatus(const FDCAN_HandleTypeDef *hfdcan,
+                                              FDCAN_ProtocolStatusTypeDef *ProtocolStatus) {
+  *ProtocolStatus = FakeState().fdcan[hfdcan].protocol_status;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_GetErrorCounters(const FDCAN_HandleTypeDef *hfdcan,
+                                             FDCAN_ErrorCountersTypeDef *ErrorCounters) {
+  *ErrorCounters = FakeState().fdcan[hfdcan].error_counters;
+  return HAL_OK;
+}
+
+namespace rm::hal::stm32::fake {
+
+/**
+ * @brief 清空所有模拟外设的状态，每个测试用例开始前调用
+ * @note  外设句柄里注册的回调函数不会被清掉，它们在句柄里，由测试代码自己管理
+ */
+void Reset() {
+  const auto start = FakeState().start;
+  FakeState() = FakeHal{};
+  FakeState().start = start;
+}
+
+/**
+ * @brief 模拟bxCAN从总线上收到一帧标准帧，按已经配置的过滤器放进对应的接收FIFO
+ * @param hcan      CAN句柄
+ * @param id        标准帧ID
+ * @param data      数据
+ * @param size      数据长度，最多8字节
+ * @param raise_irq 是否马上触发接收中断；传false可以先往FIFO里塞几帧，再用下一次触发一起处理
+ * @return 报文进了FIFO时返回true；没启动、没有过滤器匹配、FIFO已满(溢出)时返回false
+ */
+bool CanReceive(CAN_HandleTypeDef *hcan, uint32_t id, const uint8_t *data, uint8_t size, bool raise_irq) {
+  BxCanState &state = FakeState().can[hcan];
+  if (!state.started) {
+    return false;
+  }
+  const uint32_t frame_register = id << 21;  // 标准帧ID在32位过滤器寄存器的[31:21]
+  for (uint32_t bank = BxCanFirstBank(hcan); bank < BxCanLastBank(hcan); ++bank) {
+    const BxCanFilterBank &filter = FakeState().can_filter_banks[bank];
+    if (!filter.active || (frame_register & filter.mask) != (filter.id & filter.mask)) {
+      continue;
+    }
+    const uint32_t fifo = filter.fifo == CAN_FILTER_FIFO1 ? 1 : 0;
+    if (state.rx_fifo[fifo].size() >= kBxCanRxFifoDepth) {
+      return false;
+    }
+    state.rx_fifo[fifo].push_back(MakeFrame(id, data, std::min<uint8_t>(size, 8)));
+    if (!raise_irq) {
+      return true;
+    }
+    void (*callback)(CAN_HandleTypeDef *) =
+        fifo == 0 ? hcan->RxFifo0MsgPendingCallback : hcan->RxFifo1MsgPendingCallback;
+    const uint32_t it = fifo == 0 ? CAN_IT_RX_FIFO0_MSG_PENDING : CAN_IT_RX_FIFO1_MSG_PENDING;
+    if (callback != nullptr && (state.active_its & it)) {
+      RunIrq([&] { callback(hcan); });
+    }
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief 模拟bxCAN把发送邮箱里的报文都发了出去，每个邮箱发完都触发一次发送完成中断
+ * @param hcan CAN句柄
+ * @param sent 不为nullptr时，把发出去的报文追加到这里
+ * @return 这次发出去的报文数量
+ */
+size_t CanCompleteTx(CAN_HandleTypeDef *hcan, std::vector<CanFrame> *sent) {
+  BxCanState &state = FakeState().can[hcan];
+  size_t count = 0;
+  for (size_t i = 0; i < kBxCanMailboxCount; ++i) {
+    if (!state.mailbox_used[i]) {
+      continue;
+    }
+    state.mailbox_used[i] = false;
+    if (sent != nullptr) {
+      sent->push_back(state.mailbox[i]);
+    }
+    ++count;
+    void (*callback)(CAN_HandleTypeDef *) = i == 0   ? hcan->TxMailbox0CompleteCallback
+                                            : i == 1 ? hcan->TxMailbox1CompleteCallback
+                                                     : hcan->TxMailbox2CompleteCallback;
+    if (callback != nullptr && (state.active_its & CAN_IT_TX_MAILBOX_EMPTY)) {
+      RunIrq([&] { callback(hcan); });
+    }
+  }
+  return count;
+}
+
+/**
+ * @brief 设置bxCAN的ESR寄存器，模拟错误状态变化
+ * @note  和硬件一样，只有EWGF、EPVF、BOFF这几个标志被置位时才触发错误中断，标志清除时不触发
+ * @param hcan CAN句柄
+ * @param esr  新的ESR寄存器值，TEC和REC也在里面
+ */
+void CanSetErrorStatus(CAN_HandleTypeDef *hcan, uint32_t esr) {
+  constexpr uint32_t kErrorFlags = CAN_ESR_EWGF | CAN_ESR_EPVF | CAN_ESR_BOFF;
+  const uint32_t raised = esr & ~hcan->Instance->ESR & kErrorFlags;
+  hcan->Instance->ESR = esr;
+  if (esr & CAN_ESR_BOFF) {
+    hcan->ErrorCode |= HAL_CAN_ERROR_BOF;
+  }
+  const BxCanState &state = FakeState().can[hcan];
+  if (raised != 0 && hcan->ErrorCallback != nullptr && (state.active_its & CAN_IT_ERROR)) {
+    RunIrq([&] { hcan->ErrorCallback(hcan); });
+  }
+}
+
+/**
+ * @brief 模拟FDCAN从总线上收到一帧标准帧，按已经配置的过滤器和全局过滤器放进对应的接收FIFO
+ * @param hfdcan    FDCAN句柄
+ * @param id        标准帧ID
+ * @param data      数据
+ * @param size      数据长度，超过8字节时按FD帧处理
+ * @param raise_irq 是否马上触发接收中断
+ * @return 报文进了FIFO时返回true；没启动、被过滤器拒绝、FIFO已满时返回false
+ */
+bool FdcanReceive(FDCAN_HandleTypeDef *hfdcan, uint32_t id, const uint8_t *data, uint8_t size, bool raise_irq) {
+  FdcanState &state = FakeState().fdcan[hfdcan];
+  if (!state.started) {
+    return false;
+  }
+  const int fifo = FdcanRoute(state, id);
+  if (fifo < 0) {
+    return false;
+  }
+  const uint32_t depth = FdcanFifoDepth(fifo == 0 ? hfdcan->Init.RxFifo0ElmtsNbr : hfdcan->Init.RxFifo1ElmtsNbr);
+  if (state.rx_fifo[fifo].size() >= depth) {
+    return false;
+  }
+  state.rx_fifo[fifo].push_back(MakeFrame(id, data, size));
+  if (!raise_irq) {
+    return true;
+  }
+  if (fifo == 0 && hfdcan->RxFifo0Callback != nullptr && (state.active_its & FDCAN_IT_RX_FIFO0_NEW_MESSAGE)) {
+    RunIrq([&] { hfdcan->RxFifo0Callback(hfdcan, FDCAN_IT_RX_FIFO0_NEW_MESSAGE); });
+  } else if (fifo == 1 && hfdcan->RxFifo1Callback != nullptr && (state.active_its & FDCAN_IT_RX_FIFO1_NEW_MESSAGE)) {
+    RunIrq([&] { hfdcan->RxFifo1Callback(hfdcan, FDCAN_IT_RX_FIFO1_NEW_MESSAGE); });
+  }
+  return true;
+}
+
+/**
+ * @brief 模拟FDCAN把发送FIFO里的报文都发了出去，然后触发一次发送完成中断
+ * @param hfdcan FDCAN句柄
+ * @param sent   不为nullptr时，把发出去的报文追加到这里
+ * @return 这次发出去的报文数量
+ */
+size_t FdcanCompleteTx(FDCAN_HandleTypeDef *hfdcan, std::vector<CanFrame> *sent) {
+  FdcanState &state = FakeState().fdcan[hfdcan];
+  uint32_t buffer_indexes = 0;
+  size_t count = 0;
+  while (!state.tx_fifo.empty()) {
+    buffer_indexes |= 1u << state.tx_fifo.front().first;
+    if (sent != nullptr) {
+      sent->push_back(state.tx_fifo.front().second);
+    }
+    state.tx_fifo.pop_front();
+    ++count;
+  }
+  if (count > 0 && hfdcan->TxBufferCompleteCallback != nullptr && (state.active_its & FDCAN_IT_TX_COMPLETE)) {
+    RunIrq([&] { hfdcan->TxBufferCompleteCallback(hfdcan, buffer_indexes); });
+  }
+  return count;
+}
+
+/**
+ * @brief 设置FDCAN的协议状态和错误计数，BusOff、ErrorPassive、Warning有变化时触发错误状态中断
+ * @param hfdcan         FDCAN句柄
+ * @param status         新的协议状态
+ * @param tx_error_count 发送错误计数
+ * @param rx_error_count 接收错误计数
+ */
+void FdcanSetProtocolStatus(FDCAN_HandleTypeDef *hfdcan, const FDCAN_ProtocolStatusTypeDef &status,
+                            uint32_t tx_error_count, uint32_t rx_error_count) {
+  FdcanState &state = FakeState().fdcan[hfdcan];
+  uint32_t its = 0;
+  if (status.BusOff != state.protocol_status.BusOff) {
+    its |= FDCAN_IT_BUS_OFF;
+  }
+  if (status.ErrorPassive != state.protocol_status.ErrorPassive) {
+    its |= FDCAN_IT_ERROR_PASSIVE;
+  }
+  if (status.Warning != state.protocol_status.Warning) {
+    its |= FDCAN_IT_ERROR_WARNING;
+  }
+  state.protocol_status = status;
+  state.error_counters.TxErrorCnt = tx_error_count;
+  state.error_counters.RxErrorCnt = rx_error_count;
+  state.error_counters.RxErrorPassive = status.ErrorPassive;
+  if (status.BusOff) {
+    // 和硬件一样，进入bus-off时置位INIT
+    hfdcan->Instance->CCCR |= FDCAN_CCCR_INIT;
+  }
+  its &= state.active_its;
+  if (its != 0 && hfdcan->ErrorStatusCallback != nullptr) {
+    RunIrq([&] { hfdcan->ErrorStatusCallback(hfdcan, its); });
+  }
+}
+
+/**
+ * @brief 模拟串口收到一段数据后总线空闲，把数据拷进驱动提供的接收缓冲区并触发接收事件回调
+ * @note  和HAL库一样，一次接收完成后要驱动重新启动接收，下一次才能收到数据
+ * @param huart 串口句柄
+ * @param data  数据
+ * @param size  数据长度，超过接收缓冲区的部分被丢掉
+ * @return 驱动没有启动接收时返回false
+ */
+bool UartReceive(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size) {
+  UartState &state = FakeState().uart[huart];
+  if (state.rx_buffer == nullptr) {
+    return false;
+  }
+  const uint16_t received = std::min(size, state.rx_size);
+  std::memcpy(state.rx_buffer, data, received);
+  state.rx_buffer = nullptr;
+  state.rx_size = 0;
+  if (huart->RxEventCallback != nullptr) {
+    RunIrq([&] { huart->RxEventCallback(huart, received); });
+  }
+  return true;
+}
+
+/**
+ * @brief 模拟串口出错，中止正在进行的接收并触发错误回调
+ * @param huart      串口句柄
+ * @param error_code 写进ErrorCode的错误码
+ */
+void UartRaiseError(UART_HandleTypeDef *huart, uint32_t error_code) {
+  UartState &state = FakeState().uart[huart];
+  state.rx_buffer = nullptr;
+  state.rx_size = 0;
+  huart->ErrorCode = error_code;
+  if (huart->ErrorCallback != nullptr) {
+    RunIrq([&] { huart->ErrorCallback(huart); });
+  }
+}
+
+/**
+ * @return 取出串口到目前为止发送的所有数据
+ */
+std::vector<uint8_t> UartTakeTx(UART_HandleTypeDef *huart) {
+  std::vector<uint8_t> tx;
+  tx.swap(FakeState().uart[huart].tx);
+  return tx;
+}
+
+/**
+ * @brief 设置挂在SPI总线上的从机模拟，没有设置时读到的都是0xff
+ */
+void SetSpiHandler(SPI_HandleTypeDef *hspi, SpiHandler handler) { FakeState().spi[hspi] = std::move(handler); }
+
+/**
+ * @brief 设置挂在I2C总线上的从机模拟，没有设置时所有访问都返回HAL_ERROR
+ */
+void SetI2cHandler(I2C_HandleTypeDef *hi2c, I2cHandler handler) { FakeState().i2c[hi2c] = std::move(handler); }
+
+}  // namespace rm::hal::stm32::fake
+
+#endif  // defined(LIBRM_STM32_FAKE_HAL)
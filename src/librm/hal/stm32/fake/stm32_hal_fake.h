@@ -0,0 +1,514 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/stm32/fake/stm32_hal_fake.h
+ * @brief 在Linux主机上模拟STM32 HAL库，只包含librm的STM32驱动用到的那部分API
+ * @note  定义LIBRM_STM32_FAKE_HAL之后，librm/hal/stm32/hal.h会包含这个文件而不是CubeMX生成的HAL库，
+ *        这样bxcan.cc、fdcan.cc、uart.cc、spi_device.cc、i2c_device.cc以及BMI088、IST8310这些设备
+ *        就能在电脑上编译，用来写单元测试、测中断回调的耗时。
+ *        用法和在单片机上一样，自己定义外设句柄(比如CAN_HandleTypeDef hcan1{CAN1})交给驱动，
+ *        然后用rm::hal::stm32::fake里的函数往外设里塞报文、取出发送的数据，这些函数会像硬件中断一样同步调用HAL回调。
+ *        这个模拟不是线程安全的，所有调用都要在同一个线程里
+ */
+
+#ifndef LIBRM_HAL_STM32_FAKE_STM32_HAL_FAKE_H
+#define LIBRM_HAL_STM32_FAKE_STM32_HAL_FAKE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#define HAL_CAN_MODULE_ENABLED
+#define HAL_FDCAN_MODULE_ENABLED
+#define HAL_UART_MODULE_ENABLED
+#define HAL_DMA_MODULE_ENABLED
+#define HAL_SPI_MODULE_ENABLED
+#define HAL_I2C_MODULE_ENABLED
+#define HAL_GPIO_MODULE_ENABLED
+#define USE_HAL_CAN_REGISTER_CALLBACKS 1u
+#define USE_HAL_FDCAN_REGISTER_CALLBACKS 1u
+#define USE_HAL_UART_REGISTER_CALLBACKS 1u
+
+typedef enum { HAL_OK = 0x00U, HAL_ERROR = 0x01U, HAL_BUSY = 0x02U, HAL_TIMEOUT = 0x03U } HAL_StatusTypeDef;
+typedef enum { DISABLE = 0U, ENABLE = !DISABLE } FunctionalState;
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+// core
+/**
+ * @brief 模拟DWT->CYCCNT，读的时候按主机的单调时钟和SystemCoreClock换算成周期数
+ */
+struct FakeCycleCounter {
+  operator uint32_t() const volatile;
+};
+typedef struct {
+  volatile uint32_t CTRL;
+  FakeCycleCounter CYCCNT;
+} DWT_Type;
+typedef struct {
+  volatile uint32_t DEMCR;
+} CoreDebug_Type;
+extern DWT_Type fake_dwt;
+extern CoreDebug_Type fake_core_debug;
+#define DWT (&fake_dwt)
+#define CoreDebug (&fake_core_debug)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24U)
+uint32_t __get_IPSR(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __disable_irq(void);
+void __enable_irq(void);
+void HAL_Delay(uint32_t delay);
+uint32_t HAL_GetTick(void);
+uint32_t HAL_RCC_GetSysClockFreq(void);
+extern uint32_t SystemCoreClock;
+
+// GPIO
+typedef struct {
+  volatile uint32_t ODR;
+  volatile uint32_t IDR;
+} GPIO_TypeDef;
+typedef enum { GPIO_PIN_RESET = 0U, GPIO_PIN_SET } GPIO_PinState;
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+
+// DMA
+typedef struct {
+  volatile uint32_t CR;
+} DMA_Stream_TypeDef;
+typedef struct {
+  DMA_Stream_TypeDef *Instance;
+} DMA_HandleTypeDef;
+#define DMA_IT_HT (0x1UL << 3U)
+#define __HAL_DMA_DISABLE_IT(__HANDLE__, __INTERRUPT__) ((__HANDLE__)->Instance->CR &= ~(__INTERRUPT__))
+
+// SPI
+typedef struct {
+  void *Instance;
+} SPI_HandleTypeDef;
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size,
+                                          uint32_t Timeout);
+
+// I2C
+typedef struct {
+  void *Instance;
+} I2C_HandleTypeDef;
+#define I2C_MEMADD_SIZE_8BIT (0x00000001U)
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                    uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                   uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+
+// UART
+typedef struct {
+  volatile uint32_t SR;
+} USART_TypeDef;
+typedef struct __UART_HandleTypeDef {
+  USART_TypeDef *Instance;
+  DMA_HandleTypeDef *hdmatx;
+  DMA_HandleTypeDef *hdmarx;
+  volatile uint32_t ErrorCode;
+  void (*RxEventCallback)(struct __UART_HandleTypeDef *huart, uint16_t Pos);
+  void (*ErrorCallback)(struct __UART_HandleTypeDef *huart);
+} UART_HandleTypeDef;
+typedef enum { HAL_UART_ERROR_CB_ID = 0x0AU } HAL_UART_CallbackIDTypeDef;
+typedef void (*pUART_CallbackTypeDef)(UART_HandleTypeDef *huart);
+typedef void (*pUART_RxEventCallbackTypeDef)(UART_HandleTypeDef *huart, uint16_t Pos);
+HAL_StatusTypeDef HAL_UART_RegisterCallback(UART_HandleTypeDef *huart, HAL_UART_CallbackIDTypeDef CallbackID,
+                                            pUART_CallbackTypeDef pCallback);
+HAL_StatusTypeDef HAL_UART_RegisterRxEventCallback(UART_HandleTypeDef *huart, pUART_RxEventCallbackTypeDef pCallback);
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Receive(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+
+// bxCAN
+typedef struct {
+  volatile uint32_t MCR;
+  volatile uint32_t MSR;
+  volatile uint32_t TSR;
+  volatile uint32_t RF0R;
+  volatile uint32_t RF1R;
+  volatile uint32_t IER;
+  volatile uint32_t ESR;
+  volatile uint32_t BTR;
+} CAN_TypeDef;
+extern CAN_TypeDef fake_can1;
+extern CAN_TypeDef fake_can2;
+#define CAN1 (&fake_can1)
+#define CAN2 (&fake_can2)
+#define CAN1_BASE (reinterpret_cast<uintptr_t>(&fake_can1))
+#define CAN2_BASE (reinterpret_cast<uintptr_t>(&fake_can2))
+typedef struct {
+  uint32_t Prescaler;
+  uint32_t Mode;
+  FunctionalState AutoBusOff;
+  FunctionalState AutoRetransmission;
+} CAN_InitTypeDef;
+typedef struct {
+  uint32_t FilterIdHigh;
+  uint32_t FilterIdLow;
+  uint32_t FilterMaskIdHigh;
+  uint32_t FilterMaskIdLow;
+  uint32_t FilterFIFOAssignment;
+  uint32_t FilterBank;
+  uint32_t FilterMode;
+  uint32_t FilterScale;
+  uint32_t FilterActivation;
+  uint32_t SlaveStartFilterBank;
+} CAN_FilterTypeDef;
+typedef struct {
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint32_t IDE;
+  uint32_t RTR;
+  uint32_t DLC;
+  FunctionalState TransmitGlobalTime;
+} CAN_TxHeaderTypeDef;
+typedef struct {
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint32_t IDE;
+  uint32_t RTR;
+  uint32_t DLC;
+  uint32_t Timestamp;
+  uint32_t FilterMatchIndex;
+} CAN_RxHeaderTypeDef;
+typedef struct __CAN_HandleTypeDef {
+  CAN_TypeDef *Instance;
+  CAN_InitTypeDef Init;
+  volatile uint32_t ErrorCode;
+  void (*TxMailbox0CompleteCallback)(struct __CAN_HandleTypeDef *hcan);
+  void (*TxMailbox1CompleteCallback)(struct __CAN_HandleTypeDef *hcan);
+  void (*TxMailbox2CompleteCallback)(struct __CAN_HandleTypeDef *hcan);
+  void (*TxMailbox0AbortCallback)(struct __CAN_HandleTypeDef *hcan);
+  void (*TxMailbox1AbortCallback)(struct __CAN_HandleTypeDef *hcan);
+  void (*TxMailbox2AbortCallback)(struct __CAN_HandleTypeDef *hcan);
+  void (*RxFifo0MsgPendingCallback)(struct __CAN_HandleTypeDef *hcan);
+  void (*RxFifo1MsgPendingCallback)(struct __CAN_HandleTypeDef *hcan);
+  void (*ErrorCallback)(struct __CAN_HandleTypeDef *hcan);
+} CAN_HandleTypeDef;
+typedef enum {
+  HAL_CAN_TX_MAILBOX0_COMPLETE_CB_ID = 0x00U,
+  HAL_CAN_TX_MAILBOX1_COMPLETE_CB_ID = 0x01U,
+  HAL_CAN_TX_MAILBOX2_COMPLETE_CB_ID = 0x02U,
+  HAL_CAN_TX_MAILBOX0_ABORT_CB_ID = 0x03U,
+  HAL_CAN_TX_MAILBOX1_ABORT_CB_ID = 0x04U,
+  HAL_CAN_TX_MAILBOX2_ABORT_CB_ID = 0x05U,
+  HAL_CAN_RX_FIFO0_MSG_PENDING_CB_ID = 0x06U,
+  HAL_CAN_RX_FIFO0_FULL_CB_ID = 0x07U,
+  HAL_CAN_RX_FIFO1_MSG_PENDING_CB_ID = 0x08U,
+  HAL_CAN_RX_FIFO1_FULL_CB_ID = 0x09U,
+  HAL_CAN_SLEEP_CB_ID = 0x0AU,
+  HAL_CAN_WAKEUP_FROM_RX_MSG_CB_ID = 0x0BU,
+  HAL_CAN_ERROR_CB_ID = 0x0CU,
+} HAL_CAN_CallbackIDTypeDef;
+typedef void (*pCAN_CallbackTypeDef)(CAN_HandleTypeDef *hcan);
+#define CAN_ID_STD (0x00000000U)
+#define CAN_ID_EXT (0x00000004U)
+#define CAN_RTR_DATA (0x00000000U)
+#define CAN_RTR_REMOTE (0x00000002U)
+#define CAN_RX_FIFO0 (0x00000000U)
+#define CAN_RX_FIFO1 (0x00000001U)
+#define CAN_FILTER_FIFO0 (0x00000000U)
+#define CAN_FILTER_FIFO1 (0x00000001U)
+#define CAN_FILTERMODE_IDMASK (0x00000000U)
+#define CAN_FILTERMODE_IDLIST (0x00000001U)
+#define CAN_FILTERSCALE_16BIT (0x00000000U)
+#define CAN_FILTERSCALE_32BIT (0x00000001U)
+#define CAN_TX_MAILBOX0 (0x00000001U)
+#define CAN_TX_MAILBOX1 (0x00000002U)
+#define CAN_TX_MAILBOX2 (0x00000004U)
+#define CAN_IT_TX_MAILBOX_EMPTY (0x1UL << 0U)
+#define CAN_IT_RX_FIFO0_MSG_PENDING (0x1UL << 1U)
+#define CAN_IT_RX_FIFO0_FULL (0x1UL << 2U)
+#define CAN_IT_RX_FIFO0_OVERRUN (0x1UL << 3U)
+#define CAN_IT_RX_FIFO1_MSG_PENDING (0x1UL << 4U)
+#define CAN_IT_RX_FIFO1_FULL (0x1UL << 5U)
+#define CAN_IT_RX_FIFO1_OVERRUN (0x1UL << 6U)
+#define CAN_IT_ERROR_WARNING (0x1UL << 8U)
+#define CAN_IT_ERROR_PASSIVE (0x1UL << 9U)
+#define CAN_IT_BUSOFF (0x1UL << 10U)
+#define CAN_IT_LAST_ERROR_CODE (0x1UL << 11U)
+#define CAN_IT_ERROR (0x1UL << 15U)
+#define CAN_MCR_ABOM (0x1UL << 6U)
+#define CAN_ESR_EWGF (0x1UL << 0U)
+#define CAN_ESR_EPVF (0x1UL << 1U)
+#define CAN_ESR_BOFF (0x1UL << 2U)
+#define CAN_ESR_LEC_Pos (4U)
+#define CAN_ESR_LEC (0x7UL << CAN_ESR_LEC_Pos)
+#define CAN_ESR_TEC_Pos (16U)
+#define CAN_ESR_TEC (0xFFUL << CAN_ESR_TEC_Pos)
+#define CAN_ESR_REC_Pos (24U)
+#define CAN_ESR_REC (0xFFUL << CAN_ESR_REC_Pos)
+#define HAL_CAN_ERROR_NONE (0x00000000U)
+#define HAL_CAN_ERROR_BOF (0x00000004U)
+HAL_StatusTypeDef HAL_CAN_ConfigFilter(CAN_HandleTypeDef *hcan, const CAN_FilterTypeDef *sFilterConfig);
+HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_Stop(CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_AddTxMessage(CAN_HandleTypeDef *hcan, const CAN_TxHeaderTypeDef *pHeader,
+                                       const uint8_t aData[], uint32_t *pTxMailbox);
+HAL_StatusTypeDef HAL_CAN_AbortTxRequest(CAN_HandleTypeDef *hcan, uint32_t TxMailboxes);
+uint32_t HAL_CAN_GetTxMailboxesFreeLevel(const CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_GetRxMessage(CAN_HandleTypeDef *hcan, uint32_t RxFifo, CAN_RxHeaderTypeDef *pHeader,
+                                       uint8_t aData[]);
+uint32_t HAL_CAN_GetRxFifoFillLevel(const CAN_HandleTypeDef *hcan, uint32_t RxFifo);
+HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef *hcan, uint32_t ActiveITs);
+HAL_StatusTypeDef HAL_CAN_DeactivateNotification(CAN_HandleTypeDef *hcan, uint32_t InactiveITs);
+HAL_StatusTypeDef HAL_CAN_RegisterCallback(CAN_HandleTypeDef *hcan, HAL_CAN_CallbackIDTypeDef CallbackID,
+                                           pCAN_CallbackTypeDef pCallback);
+uint32_t HAL_CAN_GetError(const CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_ResetError(CAN_HandleTypeDef *hcan);
+
+// FDCAN
+typedef struct {
+  volatile uint32_t CCCR;
+  volatile uint32_t ECR;
+  volatile uint32_t PSR;
+} FDCAN_GlobalTypeDef;
+extern FDCAN_GlobalTypeDef fake_fdcan1;
+extern FDCAN_GlobalTypeDef fake_fdcan2;
+extern FDCAN_GlobalTypeDef fake_fdcan3;
+#define FDCAN1 (&fake_fdcan1)
+#define FDCAN2 (&fake_fdcan2)
+#define FDCAN3 (&fake_fdcan3)
+#define FDCAN1_BASE (reinterpret_cast<uintptr_t>(&fake_fdcan1))
+#define FDCAN2_BASE (reinterpret_cast<uintptr_t>(&fake_fdcan2))
+#define FDCAN3_BASE (reinterpret_cast<uintptr_t>(&fake_fdcan3))
+#define FDCAN_CCCR_INIT (0x1UL << 0U)
+typedef struct {
+  uint32_t FrameFormat;
+  uint32_t Mode;
+  FunctionalState AutoRetransmission;
+  uint32_t StdFiltersNbr;
+  uint32_t RxFifo0ElmtsNbr;
+  uint32_t RxFifo1ElmtsNbr;
+  uint32_t TxFifoQueueElmtsNbr;
+} FDCAN_InitTypeDef;
+typedef struct {
+  uint32_t IdType;
+  uint32_t FilterIndex;
+  uint32_t FilterType;
+  uint32_t FilterConfig;
+  uint32_t FilterID1;
+  uint32_t FilterID2;
+  uint32_t RxBufferIndex;
+  uint32_t IsCalibrationMsg;
+} FDCAN_FilterTypeDef;
+typedef struct {
+  uint32_t Identifier;
+  uint32_t IdType;
+  uint32_t TxFrameType;
+  uint32_t DataLength;
+  uint32_t ErrorStateIndicator;
+  uint32_t BitRateSwitch;
+  uint32_t FDFormat;
+  uint32_t TxEventFifoControl;
+  uint32_t MessageMarker;
+} FDCAN_TxHeaderTypeDef;
+typedef struct {
+  uint32_t Identifier;
+  uint32_t IdType;
+  uint32_t RxFrameType;
+  uint32_t DataLength;
+  uint32_t ErrorStateIndicator;
+  uint32_t BitRateSwitch;
+  uint32_t FDFormat;
+  uint32_t RxTimestamp;
+  uint32_t FilterIndex;
+  uint32_t IsFilterMatchingFrame;
+} FDCAN_RxHeaderTypeDef;
+typedef struct {
+  uint32_t LastErrorCode;
+  uint32_t DataLastErrorCode;
+  uint32_t Activity;
+  uint32_t ErrorPassive;
+  uint32_t Warning;
+  uint32_t BusOff;
+} FDCAN_ProtocolStatusTypeDef;
+typedef struct {
+  uint32_t TxErrorCnt;
+  uint32_t RxErrorCnt;
+  uint32_t RxErrorPassive;
+  uint32_t ErrorLogging;
+} FDCAN_ErrorCountersTypeDef;
+typedef struct __FDCAN_HandleTypeDef {
+  FDCAN_GlobalTypeDef *Instance;
+  FDCAN_InitTypeDef Init;
+  volatile uint32_t ErrorCode;
+  void (*RxFifo0Callback)(struct __FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs);
+  void (*RxFifo1Callback)(struct __FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo1ITs);
+  void (*TxBufferCompleteCallback)(struct __FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndexes);
+  void (*ErrorStatusCallback)(struct __FDCAN_HandleTypeDef *hfdcan, uint32_t ErrorStatusITs);
+} FDCAN_HandleTypeDef;
+typedef enum {
+  HAL_FDCAN_TX_FIFO_EMPTY_CB_ID = 0x00U,
+  HAL_FDCAN_RX_BUFFER_NEW_MSG_CB_ID = 0x01U,
+  HAL_FDCAN_HIGH_PRIO_MESSAGE_CB_ID = 0x02U,
+  HAL_FDCAN_TIMESTAMP_WRAPAROUND_CB_ID = 0x03U,
+  HAL_FDCAN_TIMEOUT_OCCURRED_CB_ID = 0x04U,
+  HAL_FDCAN_ERROR_CALLBACK_CB_ID = 0x05U,
+} HAL_FDCAN_CallbackIDTypeDef;
+typedef void (*pFDCAN_CallbackTypeDef)(FDCAN_HandleTypeDef *hfdcan);
+typedef void (*pFDCAN_RxFifo0CallbackTypeDef)(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs);
+typedef void (*pFDCAN_RxFifo1CallbackTypeDef)(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo1ITs);
+typedef void (*pFDCAN_TxBufferCompleteCallbackTypeDef)(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndexes);
+typedef void (*pFDCAN_ErrorStatusCallbackTypeDef)(FDCAN_HandleTypeDef *hfdcan, uint32_t ErrorStatusITs);
+#define FDCAN_STANDARD_ID (0x00000000U)
+#define FDCAN_EXTENDED_ID (0x40000000U)
+#define FDCAN_DATA_FRAME (0x00000000U)
+#define FDCAN_REMOTE_FRAME (0x20000000U)
+#define FDCAN_FRAME_CLASSIC (0x00000000U)
+#define FDCAN_FRAME_FD_NO_BRS (0x00000100U)
+#define FDCAN_FRAME_FD_BRS (0x00000300U)
+#define FDCAN_DLC_BYTES_0 (0x00000000U)
+#define FDCAN_DLC_BYTES_1 (0x00010000U)
+#define FDCAN_DLC_BYTES_2 (0x00020000U)
+#define FDCAN_DLC_BYTES_3 (0x00030000U)
+#define FDCAN_DLC_BYTES_4 (0x00040000U)
+#define FDCAN_DLC_BYTES_5 (0x00050000U)
+#define FDCAN_DLC_BYTES_6 (0x00060000U)
+#define FDCAN_DLC_BYTES_7 (0x00070000U)
+#define FDCAN_DLC_BYTES_8 (0x00080000U)
+#define FDCAN_DLC_BYTES_12 (0x00090000U)
+#define FDCAN_DLC_BYTES_16 (0x000A0000U)
+#define FDCAN_DLC_BYTES_20 (0x000B0000U)
+#define FDCAN_DLC_BYTES_24 (0x000C0000U)
+#define FDCAN_DLC_BYTES_32 (0x000D0000U)
+#define FDCAN_DLC_BYTES_48 (0x000E0000U)
+#define FDCAN_DLC_BYTES_64 (0x000F0000U)
+#define FDCAN_ESI_ACTIVE (0x00000000U)
+#define FDCAN_ESI_PASSIVE (0x80000000U)
+#define FDCAN_BRS_OFF (0x00000000U)
+#define FDCAN_BRS_ON (0x00100000U)
+#define FDCAN_CLASSIC_CAN (0x00000000U)
+#define FDCAN_FD_CAN (0x00200000U)
+#define FDCAN_NO_TX_EVENTS (0x00000000U)
+#define FDCAN_STORE_TX_EVENTS (0x00800000U)
+#define FDCAN_FILTER_RANGE (0x00000000U)
+#define FDCAN_FILTER_DUAL (0x00000001U)
+#define FDCAN_FILTER_MASK (0x00000002U)
+#define FDCAN_FILTER_DISABLE (0x00000000U)
+#define FDCAN_FILTER_TO_RXFIFO0 (0x00000001U)
+#define FDCAN_FILTER_TO_RXFIFO1 (0x00000002U)
+#define FDCAN_FILTER_REJECT (0x00000003U)
+#define FDCAN_ACCEPT_IN_RX_FIFO0 (0x00000000U)
+#define FDCAN_ACCEPT_IN_RX_FIFO1 (0x00000001U)
+#define FDCAN_REJECT (0x00000002U)
+#define FDCAN_RX_FIFO0 (0x00000040U)
+#define FDCAN_RX_FIFO1 (0x00000041U)
+#define FDCAN_IT_RX_FIFO0_NEW_MESSAGE (0x1UL << 0U)
+#define FDCAN_IT_RX_FIFO0_FULL (0x1UL << 1U)
+#define FDCAN_IT_RX_FIFO0_MESSAGE_LOST (0x1UL << 2U)
+#define FDCAN_IT_RX_FIFO1_NEW_MESSAGE (0x1UL << 3U)
+#define FDCAN_IT_RX_FIFO1_FULL (0x1UL << 4U)
+#define FDCAN_IT_RX_FIFO1_MESSAGE_LOST (0x1UL << 5U)
+#define FDCAN_IT_TX_COMPLETE (0x1UL << 9U)
+#define FDCAN_IT_TX_FIFO_EMPTY (0x1UL << 11U)
+#define FDCAN_IT_ERROR_PASSIVE (0x1UL << 23U)
+#define FDCAN_IT_ERROR_WARNING (0x1UL << 24U)
+#define FDCAN_IT_BUS_OFF (0x1UL << 25U)
+#define FDCAN_TX_BUFFER0 (0x00000001U)
+#define FDCAN_TX_BUFFER1 (0x00000002U)
+#define FDCAN_TX_BUFFER2 (0x00000004U)
+#define FDCAN_PROTOCOL_ERROR_NONE (0x00000000U)
+HAL_StatusTypeDef HAL_FDCAN_ConfigFilter(FDCAN_HandleTypeDef *hfdcan, const FDCAN_FilterTypeDef *sFilterConfig);
+HAL_StatusTypeDef HAL_FDCAN_ConfigGlobalFilter(FDCAN_HandleTypeDef *hfdcan, uint32_t NonMatchingStd,
+                                               uint32_t NonMatchingExt, uint32_t RejectRemoteStd,
+                                               uint32_t RejectRemoteExt);
+HAL_StatusTypeDef HAL_FDCAN_Start(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_Stop(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_AddMessageToTxFifoQ(FDCAN_HandleTypeDef *hfdcan, const FDCAN_TxHeaderTypeDef *pTxHeader,
+                                                const uint8_t *pTxData);
+uint32_t HAL_FDCAN_GetTxFifoFreeLevel(const FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_GetRxMessage(FDCAN_HandleTypeDef *hfdcan, uint32_t RxLocation,
+                                         FDCAN_RxHeaderTypeDef *pRxHeader, uint8_t *pRxData);
+uint32_t HAL_FDCAN_GetRxFifoFillLevel(const FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo);
+HAL_StatusTypeDef HAL_FDCAN_ActivateNotification(FDCAN_HandleTypeDef *hfdcan, uint32_t ActiveITs,
+                                                 uint32_t BufferIndexes);
+HAL_StatusTypeDef HAL_FDCAN_DeactivateNotification(FDCAN_HandleTypeDef *hfdcan, uint32_t InactiveITs);
+HAL_StatusTypeDef HAL_FDCAN_RegisterCallback(FDCAN_HandleTypeDef *hfdcan, HAL_FDCAN_CallbackIDTypeDef CallbackID,
+                                             pFDCAN_CallbackTypeDef pCallback);
+HAL_StatusTypeDef HAL_FDCAN_RegisterRxFifo0Callback(FDCAN_HandleTypeDef *hfdcan,
+                                                    pFDCAN_RxFifo0CallbackTypeDef pCallback);
+HAL_StatusTypeDef HAL_FDCAN_RegisterRxFifo1Callback(FDCAN_HandleTypeDef *hfdcan,
+                                                    pFDCAN_RxFifo1CallbackTypeDef pCallback);
+HAL_StatusTypeDef HAL_FDCAN_RegisterTxBufferCompleteCallback(FDCAN_HandleTypeDef *hfdcan,
+                                                             pFDCAN_TxBufferCompleteCallbackTypeDef pCallback);
+HAL_StatusTypeDef HAL_FDCAN_RegisterErrorStatusCallback(FDCAN_HandleTypeDef *hfdcan,
+                                                        pFDCAN_ErrorStatusCallbackTypeDef pCallback);
+HAL_StatusTypeDef HAL_FDCAN_AbortTxRequest(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndex);
+HAL_StatusTypeDef HAL_FDCAN_GetProtocolStatus(const FDCAN_HandleTypeDef *hfdcan,
+                                              FDCAN_ProtocolStatusTypeDef *ProtocolStatus);
+HAL_StatusTypeDef HAL_FDCAN_GetErrorCounters(const FDCAN_HandleTypeDef *hfdcan,
+                                             FDCAN_ErrorCountersTypeDef *ErrorCounters);
+
+// 测试代码用来操作模拟外设的接口
+namespace rm::hal::stm32::fake {
+
+/**
+ * @brief 模拟外设收发的一帧CAN报文
+ */
+struct CanFrame {
+  uint32_t id;
+  uint8_t size;
+  uint8_t data[64];
+};
+
+/**
+ * @brief SPI从机的模拟，tx或者rx为nullptr表示这次是只收或者只发
+ */
+using SpiHandler = std::function<void(const uint8_t *tx, uint8_t *rx, uint16_t size)>;
+
+/**
+ * @brief I2C从机的模拟，write为true时data是写给从机的数据，否则要把读出来的数据填进data
+ */
+using I2cHandler =
+    std::function<HAL_StatusTypeDef(bool write, uint16_t dev_address, uint16_t mem_address, uint8_t *data, uint16_t size)>;
+
+void Reset();
+
+bool CanReceive(CAN_HandleTypeDef *hcan, uint32_t id, const uint8_t *data, uint8_t size, bool raise_irq = true);
+size_t CanCompleteTx(CAN_HandleTypeDef *hcan, std::vector<CanFrame> *sent = nullptr);
+void CanSetErrorStatus(CAN_HandleTypeDef *hcan, uint32_t esr);
+
+bool FdcanReceive(FDCAN_HandleTypeDef *hfdcan, uint32_t id, const uint8_t *data, uint8_t size, bool raise_irq = true);
+size_t FdcanCompleteTx(FDCAN_HandleTypeDef *hfdcan, std::vector<CanFrame> *sent = nullptr);
+void FdcanSetProtocolStatus(FDCAN_HandleTypeDef *hfdcan, const FDCAN_ProtocolStatusTypeDef &status,
+                            uint32_t tx_error_count, uint32_t rx_error_count);
+
+bool UartReceive(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size);
+void UartRaiseError(UART_HandleTypeDef *huart, uint32_t error_code);
+std::vector<uint8_t> UartTakeTx(UART_HandleTypeDef *huart);
+
+void SetSpiHandler(SPI_HandleTypeDef *hspi, SpiHandler handler);
+void SetI2cHandler(I2C_HandleTypeDef *hi2c, I2cHandler handler);
+
+}  // namespace rm::hal::stm32::fake
+
+#endif  // LIBRM_HAL_STM32_FAKE_STM32_HAL_FAKE_H
@@ -32,38 +32,48 @@
 
 #include "fdcan.h"
 
-#include <functional>
 #include <algorithm>
+#include <stdexcept>
 
 #include "librm/device/can_device.hpp"
 #include "librm/core/exception.h"
+#include "librm/core/time.hpp"
+#include "librm/hal/stm32/critical_section.h"
+#include "librm/hal/stm32/static_callback.h"
+
+namespace {
+struct FdcanRxFifo0Tag;
+struct FdcanRxFifo1Tag;
+struct FdcanTxCompleteTag;
+struct FdcanErrorStatusTag;
 
 /**
- * 用于存储回调函数的map
- * key: HAL库的CAN_HandleTypeDef
- * value: 回调函数
+ * @brief 接收回调和发送完成回调的分发表，最多支持3个FDCAN外设
  */
-static std::unordered_map<FDCAN_HandleTypeDef *, std::function<void()>> fn_cb_map;
+using FdcanRxFifo0Callback =
+    rm::hal::stm32::StaticCallback<void(FDCAN_HandleTypeDef *, uint32_t), FdcanRxFifo0Tag, 3>;
+using FdcanRxFifo1Callback =
+    rm::hal::stm32::StaticCallback<void(FDCAN_HandleTypeDef *, uint32_t), FdcanRxFifo1Tag, 3>;
+using FdcanTxCompleteCallback =
+    rm::hal::stm32::StaticCallback<void(FDCAN_HandleTypeDef *, uint32_t), FdcanTxCompleteTag, 3>;
+using FdcanErrorStatusCallback =
+    rm::hal::stm32::StaticCallback<void(FDCAN_HandleTypeDef *, uint32_t), FdcanErrorStatusTag, 3>;
+}  // namespace
 
 /**
- * @brief  把std::function转换为函数指针
- * @param  fn   要转换的函数
- * @param  hfdcan  HAL库的FDCAN_HandleTypeDef
- * @return      转换后的函数指针
- * @note
- * 背景：因为要用面向对象的方式对外设进行封装，所以回调函数必须存在于类内。但是存在于类内就意味着这个回调函数多了一个this参数，
- * 而HAL库要求的回调函数并没有这个this参数。通过std::bind，可以生成一个参数列表里没有this指针的std::function对象，而std::function
- * 并不能直接强转成函数指针。借助这个函数，可以把std::function对象转换成函数指针。然后就可以把这个类内的回调函数传给HAL库了。
+ * @brief FDCAN_TxHeaderTypeDef/FDCAN_RxHeaderTypeDef里DataLength字段的DLC编码偏移量
+ * @note  G4系列的HAL库里FDCAN_DLC_BYTES_x就是DLC本身，而H7系列的是DLC左移16位，直接把字节数赋给DataLength在H7上是错的
  */
-static pFDCAN_RxFifo0CallbackTypeDef StdFunctionToCallbackFunctionPtr(std::function<void()> fn,
-                                                                      FDCAN_HandleTypeDef *hfdcan) {
-  fn_cb_map[hfdcan] = std::move(fn);
-  return [](FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs) {
-    if (fn_cb_map.find(hfdcan) != fn_cb_map.end()) {
-      fn_cb_map[hfdcan]();
-    }
-  };
-}
+static constexpr uint32_t kFdcanDlcShift = FDCAN_DLC_BYTES_1 == 1 ? 0 : 16;
+
+/**
+ * @brief 打开发送完成中断时要指定的发送缓冲区，G4系列只有3个，H7系列最多32个，具体有几个取决于CubeMX里的配置
+ */
+#if defined(FDCAN_TX_BUFFER31)
+static constexpr uint32_t kFdcanAllTxBuffers = 0xffffffffU;
+#else
+static constexpr uint32_t kFdcanAllTxBuffers = FDCAN_TX_BUFFER0 | FDCAN_TX_BUFFER1 | FDCAN_TX_BUFFER2;
+#endif
 
 namespace rm::hal::stm32 {
 
@@ -73,28 +83,35 @@ namespace rm::hal::stm32 {
 FdCan::FdCan(FDCAN_HandleTypeDef &hfdcan) : hfdcan_(&hfdcan) {}
 
 /**
- * @brief 设置过滤器
+ * @brief 设置过滤器，会清掉之前用AddFilter()添加的规则，通过过滤器的报文都进入FIFO0
  * @param id
  * @param mask
  */
 void FdCan::SetFilter(u16 id, u16 mask) {
+  this->filter_count_ = 0;
+  this->AddFilter(id, mask, CanRxFifo::kFifo0);
+}
+
+/**
+ * @brief 追加一条过滤规则，最多能加多少条取决于CubeMX里配置的Std Filters Nbr
+ * @note  硬件按编号从小到大匹配，用第一条匹配上的规则，所以要先添加范围窄的规则；没有匹配上任何规则的报文进入FIFO0
+ * @param id    标准帧ID
+ * @param mask  掩码，为1的位要和id一致
+ * @param fifo  通过这条规则的报文进入哪个接收FIFO
+ */
+void FdCan::AddFilter(u16 id, u16 mask, CanRxFifo fifo) {
+  if (this->filter_count_ >= this->hfdcan_->Init.StdFiltersNbr) {
+    Throw(std::runtime_error("Too many FDCAN filters"));
+  }
   FDCAN_FilterTypeDef can_filter_st;
   can_filter_st.IdType = FDCAN_STANDARD_ID;
+  can_filter_st.FilterIndex = this->filter_count_;
   can_filter_st.FilterType = FDCAN_FILTER_MASK;
-  can_filter_st.FilterConfig = FDCAN_FILTER_TO_RXFIFO0;
+  can_filter_st.FilterConfig = fifo == CanRxFifo::kFifo0 ? FDCAN_FILTER_TO_RXFIFO0 : FDCAN_FILTER_TO_RXFIFO1;
   can_filter_st.FilterID1 = id;
   can_filter_st.FilterID2 = mask;
   can_filter_st.RxBufferIndex = 0;
   can_filter_st.IsCalibrationMsg = 0;
-  if (reinterpret_cast<u32>(this->hfdcan_->Instance) == FDCAN1_BASE) {
-    can_filter_st.FilterIndex = 0;
-  }
-  if (reinterpret_cast<u32>(this->hfdcan_->Instance) == FDCAN2_BASE) {
-    can_filter_st.FilterIndex = 1;
-  }
-  if (reinterpret_cast<u32>(this->hfdcan_->Instance) == FDCAN3_BASE) {
-    can_filter_st.FilterIndex = 2;
-  }
 
   HAL_StatusTypeDef hal_status;
   hal_status = HAL_FDCAN_ConfigGlobalFilter(this->hfdcan_, FDCAN_ACCEPT_IN_RX_FIFO0, FDCAN_REJECT, DISABLE, DISABLE);
@@ -105,72 +122,97 @@ void FdCan::SetFilter(u16 id, u16 mask) {
   if (hal_status != HAL_OK) {
     Throw(hal_error(hal_status));
   }
+  ++this->filter_count_;
+}
+
+/**
+ * @brief 设置CAN FD帧的数据段是否切换到更高的位速率(BRS)
+ * @param enable 是否启用，默认启用
+ * @note  只有在CubeMX里把Frame Format配置成FD mode with BitRate Switching时才有效
+ */
+void FdCan::SetBitRateSwitch(bool enable) { this->bit_rate_switch_ = enable; }
+
+/**
+ * @return 一帧报文最多能发送多少字节，CubeMX里配置成FD模式时是64，经典CAN模式下是8
+ */
+usize FdCan::max_data_length() const {
+  return this->hfdcan_->Init.FrameFormat == FDCAN_FRAME_CLASSIC ? 8 : kCanMaxDataLength;
+}
+
+/**
+ * @brief 设置发送队列满了的时候丢弃哪一帧
+ * @param policy 丢弃策略，默认丢弃新来的报文
+ */
+void FdCan::SetTxDropPolicy(CanTxDropPolicy policy) {
+  CriticalSection critical_section;
+  this->tx_queue_.set_drop_policy(policy);
 }
 
 /**
  * @brief 立刻向总线上发送数据
  * @param id    标准帧ID
  * @param data  数据指针
- * @param size  数据长度
+ * @param size  数据长度，超过8字节时以CAN FD帧发送，多出来的字节补0到CAN FD支持的长度
+ * @note  硬件发送FIFO满了时报文会被放进高优先级队列，等发送完成中断发送
  */
 void FdCan::Write(u16 id, const u8 *data, usize size) {
-  if (size > 8) {
-    // todo:发送长度大于8的消息
-    Throw(std::runtime_error("Frame too long, extended frame is not supported yet"));
+  const CanMsg msg = this->MakeMsg(id, data, size);
+  CriticalSection critical_section;
+  if (HAL_FDCAN_GetTxFifoFreeLevel(this->hfdcan_) == 0 || !this->AddToTxFifo(msg)) {
+    this->PushTxQueue(msg, CanTxPriority::kHigh);
   }
-  this->hal_tx_header_.Identifier = id;
-  this->hal_tx_header_.DataLength = size;
+}
 
-  HAL_StatusTypeDef hal_status =
-      HAL_FDCAN_AddMessageToTxFifoQ(this->hfdcan_, &this->hal_tx_header_, const_cast<u8 *>(data));
-  if (hal_status != HAL_OK) {
-    Throw(hal_error(hal_status));
-  }
+/**
+ * @brief 发送报文，同时像接收中断里收到的报文一样交给这个接口上的设备
+ * @note  本地投递是软件做的，和接收中断走同一条路径：只有放进延迟接收队列时进临界区，直接投递时不关中断
+ */
+void FdCan::WriteLoopback(u16 id, const u8 *data, usize size) {
+  this->Write(id, data, size);
+  CanMsg msg = this->MakeMsg(id, data, size);
+  msg.timestamp_us = core::time::NowUs();
+  this->Receive(msg);
 }
 
 /**
- * @brief 从消息队列里取出一条消息发送
+ * @brief 从消息队列里取出报文，填满硬件发送FIFO
+ * @note  发送完成中断会自动做这件事，一般不需要手动调用
  */
 void FdCan::Write() {
-  // 按优先级从高到低遍历所有消息队列
-  for (auto &queue : this->tx_queue_) {
-    if (queue.second.empty()) {
-      continue;  // 如果是空的就换下一个
-    }
-    // 从队首取出一条消息发送
-    this->Write(queue.second.front()->rx_std_id, queue.second.front()->data.data(), queue.second.front()->dlc);
-    queue.second.pop_front();
-    // 检查消息队列长度是否超过了设定的最大长度，如果超过了就清空
-    if (queue.second.size() > kQueueMaxSize) {
-      queue.second.clear();
-    }
-    break;
-  }
+  CriticalSection critical_section;
+  this->FillTxFifo();
 }
 
 /**
- * @brief 向消息队列里加入一条消息
+ * @brief 向消息队列里加入一条消息，硬件发送FIFO有空位时会立刻发送，否则等发送完成中断发送
  * @param id        数据帧ID
  * @param data      数据指针
  * @param size      数据长度
  * @param priority  消息的优先级
  */
 void FdCan::Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) {
-  if (size > 8) {
-    // todo:发送长度大于8的消息
-    Throw(std::runtime_error("Frame too long, extended frame is not supported yet"));
-  }
-  // 检查消息队列长度是否超过了设定的最大长度，如果超过了就清空
-  if (this->tx_queue_[priority].size() > kQueueMaxSize) {
-    this->tx_queue_[priority].clear();
-  }
-  auto msg = std::make_shared<CanMsg>(CanMsg{
-      .rx_std_id = id,
-      .dlc = size,
-  });
-  std::copy_n(data, size, msg->data.begin());
+  const CanMsg msg = this->MakeMsg(id, data, size);
+  CriticalSection critical_section;
+  this->PushTxQueue(msg, priority);
+  this->FillTxFifo();
+}
+
+/**
+ * @return 所有优先级的发送队列里一共有多少条报文
+ */
+usize FdCan::tx_queue_size() const {
+  CriticalSection critical_section;
+  return this->tx_queue_.size();
+}
 
-  this->tx_queue_[priority].push_back(msg);
+/**
+ * @brief 释放回调槽位，之后这个外设的中断不会再调用到已经析构的对象上
+ */
+FdCan::~FdCan() {
+  FdcanRxFifo0Callback::Unregister(this);
+  FdcanRxFifo1Callback::Unregister(this);
+  FdcanTxCompleteCallback::Unregister(this);
+  FdcanErrorStatusCallback::Unregister(this);
 }
 
 /**
@@ -178,16 +220,33 @@ void FdCan::Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority)
  */
 void FdCan::Begin() {
   HAL_StatusTypeDef hal_status;
-  hal_status = HAL_FDCAN_ActivateNotification(this->hfdcan_, FDCAN_IT_RX_FIFO0_NEW_MESSAGE, 0);
+  hal_status =
+      HAL_FDCAN_ActivateNotification(this->hfdcan_, FDCAN_IT_RX_FIFO0_NEW_MESSAGE | FDCAN_IT_RX_FIFO1_NEW_MESSAGE, 0);
   if (hal_status != HAL_OK) {
     Throw(hal_error(hal_status));
   }
-  hal_status = HAL_FDCAN_ActivateNotification(this->hfdcan_, FDCAN_IT_BUS_OFF, 0);
+  hal_status = HAL_FDCAN_ActivateNotification(this->hfdcan_,
+                                              FDCAN_IT_BUS_OFF | FDCAN_IT_ERROR_WARNING | FDCAN_IT_ERROR_PASSIVE, 0);
   if (hal_status != HAL_OK) {
     Throw(hal_error(hal_status));
   }
-  HAL_FDCAN_RegisterRxFifo0Callback(
-      this->hfdcan_, StdFunctionToCallbackFunctionPtr([this] { Fifo0MsgPendingCallback(); }, this->hfdcan_));
+  hal_status = HAL_FDCAN_ActivateNotification(this->hfdcan_, FDCAN_IT_TX_COMPLETE, kFdcanAllTxBuffers);
+  if (hal_status != HAL_OK) {
+    Throw(hal_error(hal_status));
+  }
+  pFDCAN_RxFifo0CallbackTypeDef rx0_callback = FdcanRxFifo0Callback::Register<&FdCan::Fifo0MsgPendingCallback>(this);
+  pFDCAN_RxFifo1CallbackTypeDef rx1_callback = FdcanRxFifo1Callback::Register<&FdCan::Fifo1MsgPendingCallback>(this);
+  pFDCAN_TxBufferCompleteCallbackTypeDef tx_callback =
+      FdcanTxCompleteCallback::Register<&FdCan::TxCompleteCallback>(this);
+  pFDCAN_ErrorStatusCallbackTypeDef error_callback =
+      FdcanErrorStatusCallback::Register<&FdCan::ErrorStatusCallback>(this);
+  if (rx0_callback == nullptr || rx1_callback == nullptr || tx_callback == nullptr || error_callback == nullptr) {
+    Throw(std::runtime_error("Too many FDCAN instances"));
+  }
+  HAL_FDCAN_RegisterRxFifo0Callback(this->hfdcan_, rx0_callback);
+  HAL_FDCAN_RegisterRxFifo1Callback(this->hfdcan_, rx1_callback);
+  HAL_FDCAN_RegisterTxBufferCompleteCallback(this->hfdcan_, tx_callback);
+  HAL_FDCAN_RegisterErrorStatusCallback(this->hfdcan_, error_callback);
   hal_status = HAL_FDCAN_Start(this->hfdcan_);
   if (hal_status != HAL_OK) {
     Throw(hal_error(hal_status));
@@ -205,18 +264,232 @@ void FdCan::Stop() {
 }
 
 /**
- * @brief 利用Register callbacks机制，用这个函数替代HAL_CAN_RxFifo0MsgPendingCallback
- * @note  这个函数替代了HAL_CAN_RxFifo0MsgPendingCallback，HAL库会调用这个函数，不要手动调用
+ * @brief 利用Register callbacks机制，用这个函数替代HAL_FDCAN_RxFifo0Callback
+ * @note  这个函数替代了HAL_FDCAN_RxFifo0Callback，HAL库会调用这个函数，不要手动调用
  */
-void FdCan::Fifo0MsgPendingCallback() {
-  static FDCAN_RxHeaderTypeDef rx_header;
-  HAL_FDCAN_GetRxMessage(this->hfdcan_, FDCAN_RX_FIFO0, &rx_header, this->rx_buffer_.data.data());
-  if (this->device_list_.find(rx_header.Identifier) == this->device_list_.end()) {
+void FdCan::Fifo0MsgPendingCallback() { this->ReadRxFifo(FDCAN_RX_FIFO0); }
+
+/**
+ * @brief 利用Register callbacks机制，用这个函数替代HAL_FDCAN_RxFifo1Callback
+ * @note  这个函数替代了HAL_FDCAN_RxFifo1Callback，HAL库会调用这个函数，不要手动调用
+ */
+void FdCan::Fifo1MsgPendingCallback() { this->ReadRxFifo(FDCAN_RX_FIFO1); }
+
+/**
+ * @brief 把接收FIFO里积压的报文全部读出来，交给设备或者放进延迟接收队列
+ * @note  一次中断只读一帧的话，总线负载高时中断次数多，处理不及时FIFO还会溢出
+ */
+void FdCan::ReadRxFifo(u32 fifo) {
+  FDCAN_RxHeaderTypeDef rx_header;
+  CanMsg msg{};
+  while (HAL_FDCAN_GetRxFifoFillLevel(this->hfdcan_, fifo) > 0) {
+    if (HAL_FDCAN_GetRxMessage(this->hfdcan_, fifo, &rx_header, msg.data.data()) != HAL_OK) {
+      break;
+    }
+    msg.rx_std_id = rx_header.Identifier;
+    msg.dlc = CanDlcToLength(rx_header.DataLength >> kFdcanDlcShift);
+    msg.fd = rx_header.FDFormat == FDCAN_FD_CAN;
+    msg.brs = rx_header.BitRateSwitch == FDCAN_BRS_ON;
+    msg.timestamp_us = core::time::NowUs();
+    this->Receive(msg);
+  }
+}
+
+/**
+ * @brief 收到一帧报文：延迟接收模式下放进队列，否则直接交给设备
+ * @note  延迟接收队列是单生产者的，WriteLoopback会在中断之外调用这个函数，所以Push要在临界区里做
+ */
+void FdCan::Receive(const CanMsg &msg) {
+  if (this->deferred_rx_.enabled()) {
+    bool pushed;
+    {
+      CriticalSection critical_section;
+      pushed = this->deferred_rx_.Push(msg);
+    }
+    if (!pushed) {
+      this->ReportRxDrop(msg);
+    }
+  } else {
+    this->Dispatch(msg);
+  }
+}
+
+/**
+ * @brief 发送完成中断的回调，从队列里取报文把硬件发送FIFO空出来的位置填上
+ * @note  HAL库会调用这个函数，不要手动调用
+ */
+void FdCan::TxCompleteCallback() {
+  CriticalSection critical_section;
+  this->FillTxFifo();
+}
+
+/**
+ * @brief 错误状态中断的回调，进入和离开bus-off、error warning、error passive时都会触发
+ * @note  HAL库会调用这个函数，不要手动调用
+ */
+void FdCan::ErrorStatusCallback() {
+  CriticalSection critical_section;
+  FDCAN_ProtocolStatusTypeDef protocol_status;
+  HAL_FDCAN_GetProtocolStatus(this->hfdcan_, &protocol_status);
+  CanBusState state = CanBusState::kErrorActive;
+  if (protocol_status.BusOff) {
+    state = CanBusState::kBusOff;
+  } else if (protocol_status.ErrorPassive) {
+    state = CanBusState::kErrorPassive;
+  } else if (protocol_status.Warning) {
+    state = CanBusState::kErrorWarning;
+  }
+  ++this->error_counters_.error_frames;
+  if (state == CanBusState::kBusOff) {
+    ++this->error_counters_.bus_off_count;
+    HAL_FDCAN_AbortTxRequest(this->hfdcan_, kFdcanAllTxBuffers);
+    this->FlushTxQueue();
+    // 进入bus-off时硬件置了INIT位，清掉之后硬件会等总线恢复空闲再重新参与通信
+    this->hfdcan_->Instance->CCCR &= ~FDCAN_CCCR_INIT;
+  } else if (this->error_counters_.state == CanBusState::kBusOff) {
+    ++this->error_counters_.restart_count;
+  }
+  if (state != this->error_counters_.state) {
+    this->error_counters_.state = state;
+    this->ReportBusState(state);
+  }
+}
+
+/**
+ * @brief 丢弃发送队列里的所有报文；调用时要在临界区里
+ */
+void FdCan::FlushTxQueue() {
+  CanMsg msg;
+  while (this->tx_queue_.Pop(msg)) {
+    ++this->error_counters_.tx_flushed;
+    this->ReportTxDrop(msg);
+  }
+  this->ReportTxQueueDepth(0);
+}
+
+/**
+ * @return 控制器的错误状态和错误计数
+ */
+CanErrorCounters FdCan::error_counters() const {
+  FDCAN_ErrorCountersTypeDef hal_counters;
+  HAL_FDCAN_GetErrorCounters(this->hfdcan_, &hal_counters);
+  CriticalSection critical_section;
+  CanErrorCounters counters = this->error_counters_;
+  counters.tx_error_count = hal_counters.TxErrorCnt;
+  counters.rx_error_count = hal_counters.RxErrorCnt;
+  return counters;
+}
+
+/**
+ * @brief 按优先级从队列里取出报文，直到硬件发送FIFO满了或者队列为空；调用时要在临界区里
+ */
+void FdCan::FillTxFifo() {
+  CanMsg msg;
+  bool popped = false;
+  while (HAL_FDCAN_GetTxFifoFreeLevel(this->hfdcan_) > 0 && this->tx_queue_.Pop(msg)) {
+    popped = true;
+    if (!this->AddToTxFifo(msg)) {
+      this->ReportTxDrop(msg);
+    }
+  }
+  if (popped) {
+    this->ReportTxQueueDepth(this->tx_queue_.size());
+  }
+}
+
+/**
+ * @brief  把一帧报文放进硬件发送FIFO；调用时要在临界区里
+ * @return 失败时返回false
+ */
+bool FdCan::AddToTxFifo(const CanMsg &msg) {
+  this->hal_tx_header_.Identifier = msg.rx_std_id;
+  this->hal_tx_header_.DataLength = static_cast<uint32_t>(CanLengthToDlc(msg.dlc)) << kFdcanDlcShift;
+  this->hal_tx_header_.FDFormat = msg.fd ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN;
+  this->hal_tx_header_.BitRateSwitch = msg.brs ? FDCAN_BRS_ON : FDCAN_BRS_OFF;
+  if (HAL_FDCAN_AddMessageToTxFifoQ(this->hfdcan_, &this->hal_tx_header_, const_cast<u8 *>(msg.data.data())) !=
+      HAL_OK) {
+    return false;
+  }
+  this->ReportTx(msg);
+  return true;
+}
+
+/**
+ * @brief 把报文放进发送队列，队列满时按丢弃策略丢弃一帧；调用时要在临界区里
+ */
+void FdCan::PushTxQueue(const CanMsg &msg, CanTxPriority priority) {
+  CanMsg dropped;
+  if (!this->tx_queue_.Push(msg, priority, &dropped)) {
+    this->ReportTxDrop(dropped);
+  }
+  this->ReportTxQueueDepth(this->tx_queue_.size());
+}
+
+/**
+ * @brief 把要发送的数据打包成报文，超过8字节时以CAN FD帧发送，多出来的字节补0到CAN FD支持的长度
+ */
+CanMsg FdCan::MakeMsg(u16 id, const u8 *data, usize size) const {
+  if (size > this->max_data_length()) {
+    Throw(std::runtime_error("Data is too long for a CAN frame!"));
+  }
+  CanMsg msg{};
+  msg.rx_std_id = id;
+  msg.fd = size > 8;
+  msg.brs = msg.fd && this->bit_rate_switch_;
+  msg.dlc = msg.fd ? CanFdPaddedLength(size) : size;
+  std::copy_n(data, size, msg.data.begin());
+  return msg;
+}
+
+/**
+ * @brief 开启延迟接收：接收中断里只把报文放进无锁队列，由任务或者主循环调用ProcessRx()把报文交给设备
+ * @param queue_size 队列长度，会被向上取整到2的幂；队列满时新的报文会被丢弃并计入rx_overflow_count()
+ * @note  要在Begin()之前调用
+ */
+void FdCan::SetDeferredRx(usize queue_size) { this->deferred_rx_.Enable(queue_size); }
+
+/**
+ * @brief 设置延迟接收模式下，接收中断往队列里放了报文之后调用的通知函数，一般用来唤醒调用ProcessRx()的任务
+ * @param notify 通知函数，在中断里调用
+ * @param arg    传给通知函数的参数
+ */
+void FdCan::SetRxNotify(DeferredRx<CanMsg>::NotifyFunction notify, void *arg) { this->deferred_rx_.SetNotify(notify, arg); }
+
+/**
+ * @brief  延迟接收模式下，把队列里的报文依次交给设备，在任务或者主循环里调用
+ * @return 处理了多少帧报文
+ */
+usize FdCan::ProcessRx() {
+  if (!this->deferred_rx_.enabled()) {
+    return 0;
+  }
+  CanMsg msg;
+  usize count = 0;
+  while (this->deferred_rx_.Pop(msg)) {
+    this->Dispatch(msg);
+    ++count;
+  }
+  return count;
+}
+
+/**
+ * @return 延迟接收模式下，因为队列满而丢弃的报文数量
+ */
+u32 FdCan::rx_overflow_count() const { return this->deferred_rx_.overflow_count(); }
+
+/**
+ * @brief 把收到的报文交给注册了这个ID的设备
+ */
+void FdCan::Dispatch(const CanMsg &msg) {
+  if (this->TryRxFastPath(msg)) {
+    this->ReportRx(msg, true);
     return;
   }
-  this->rx_buffer_.rx_std_id = rx_header.Identifier;
-  this->rx_buffer_.dlc = rx_header.DataLength;
-  this->device_list_[rx_header.Identifier]->RxCallback(&this->rx_buffer_);
+  device::CanDevice *device = this->device_list_.Find(msg.rx_std_id);
+  this->ReportRx(msg, device != nullptr);
+  if (device != nullptr) {
+    device->Deliver(msg);
+  }
 }
 
 /**
@@ -225,10 +498,9 @@ void FdCan::Fifo0MsgPendingCallback() {
  * @param rx_stdid  设备想要接收的的rx消息标准帧id
  */
 void FdCan::RegisterDevice(device::CanDevice &device, u32 rx_stdid) {
-  if (this->device_list_.find(rx_stdid) != this->device_list_.end()) {
+  if (!this->device_list_.Insert(rx_stdid, &device)) {
     Throw(std::runtime_error("Device already registered"));
   }
-  this->device_list_[rx_stdid] = &device;
 }
 
 }  // namespace rm::hal::stm32
@@ -32,22 +32,33 @@
 #include "librm/hal/stm32/hal.h"
 #if defined(HAL_FDCAN_MODULE_ENABLED)
 
-#include <unordered_map>
-#include <deque>
-#include <memory>
-
 #include "librm/hal/can_interface.h"
+#include "librm/hal/can_device_table.hpp"
+#include "librm/hal/can_tx_queue.hpp"
+#include "librm/hal/stm32/can_rx_fifo.h"
+#include "librm/hal/stm32/deferred_rx.h"
 #include "librm/device/can_device.hpp"
 
 namespace rm::hal::stm32 {
 
+/**
+ * @brief FDCAN类库
+ * @note  Enqueue()的报文放进定长的发送队列，由发送完成中断自动取出来填进硬件发送FIFO，不需要用户轮询Write()
+ * @note  发送路径上不会访问堆，所有优先级严格按 高->普通->低 的顺序发送
+ * @note  默认在接收中断里直接调用设备的回调；调用SetDeferredRx()之后中断里只把报文放进队列，由任务调用ProcessRx()分发
+ * @note  每次接收中断都会把FIFO里积压的报文全部读完；可以用AddFilter()把低优先级的报文分到FIFO1，
+ *        两个FIFO的中断默认都在中断线0上；如果把它们分到了不同的中断线，两条中断线要配置成同一个抢占优先级
+ *        (同一个外设的接收回调不能互相打断，延迟接收队列只允许一个生产者)
+ * @note  进入bus-off时FDCAN会自己进入初始化模式，错误状态中断里会取消硬件发送FIFO里的报文、清空发送队列，
+ *        然后立刻退出初始化模式，硬件在总线上检测到129次11个隐性位之后自动恢复收发，1Mbps下大约1.4ms
+ */
 class FdCan : public CanInterface {
  public:
   explicit FdCan(FDCAN_HandleTypeDef &hfdcan);
 
   FdCan() = default;
 
-  ~FdCan() override = default;
+  ~FdCan() override;
 
   // 禁止拷贝构造
   FdCan(const FdCan &) = delete;
@@ -56,8 +67,11 @@ class FdCan : public CanInterface {
 
   void SetFilter(u16 id, u16 mask) override;
 
+  void AddFilter(u16 id, u16 mask, CanRxFifo fifo);
+
   void Write(u16 id, const u8 *data, usize size) override;
 
+  void WriteLoopback(u16 id, const u8 *data, usize size) override;
   void Write() override;
 
   void Enqueue(u16 id, const u8 *data, usize size, CanTxPriority priority) override;
@@ -66,18 +80,52 @@ class FdCan : public CanInterface {
 
   void Stop() override;
 
+  void SetBitRateSwitch(bool enable);
+
+  void SetTxDropPolicy(CanTxDropPolicy policy);
+
+  void SetDeferredRx(usize queue_size);
+
+  void SetRxNotify(DeferredRx<CanMsg>::NotifyFunction notify, void *arg);
+
+  usize ProcessRx();
+
+  [[nodiscard]] usize max_data_length() const override;
+
+  [[nodiscard]] usize tx_queue_size() const;
+
+  [[nodiscard]] u32 rx_overflow_count() const;
+
+  [[nodiscard]] CanErrorCounters error_counters() const override;
+
  private:
   void RegisterDevice(device::CanDevice &device, u32 rx_stdid) override;
 
   void Fifo0MsgPendingCallback();
 
-  u32 tx_mailbox_{0};
-  CanMsg rx_buffer_{};
-  std::unordered_map<CanTxPriority, std::deque<std::shared_ptr<CanMsg>>> tx_queue_{
-      {CanTxPriority::kHigh, {}},
-      {CanTxPriority::kNormal, {}},
-      {CanTxPriority::kLow, {}},
-  };
+  void Fifo1MsgPendingCallback();
+
+  void ReadRxFifo(u32 fifo);
+
+  void Receive(const CanMsg &msg);
+  void Dispatch(const CanMsg &msg);
+
+  void TxCompleteCallback();
+
+  void ErrorStatusCallback();
+
+  void FlushTxQueue();
+
+  void FillTxFifo();
+
+  bool AddToTxFifo(const CanMsg &msg);
+
+  void PushTxQueue(const CanMsg &msg, CanTxPriority priority);
+
+  [[nodiscard]] CanMsg MakeMsg(u16 id, const u8 *data, usize size) const;
+
+  DeferredRx<CanMsg> deferred_rx_{};
+  CanTxQueue<8> tx_queue_{};  // 只能在关中断的临界区里访问
   FDCAN_HandleTypeDef *hfdcan_{nullptr};
   FDCAN_TxHeaderTypeDef hal_tx_header_ = {
       .Identifier = 0,
@@ -90,14 +138,10 @@ class FdCan : public CanInterface {
       .TxEventFifoControl = FDCAN_STORE_TX_EVENTS,
       .MessageMarker = 0,
   };
-  std::unordered_map<u16, device::CanDevice *> device_list_{};  // <rx_stdid, device>
-
-  /**
-   * @brief 消息队列最大长度
-   * @note  在插入或发送消息的时候，如果检测到消息队列长度超过这个值，就会清空消息队列（待发送的消息都会被丢弃）
-   * @note  触发清空队列的动作意味着插入消息的速度大于发送消息的速度，应该减少发送消息的数量
-   */
-  static constexpr usize kQueueMaxSize = 100;
+  CanDeviceTable<device::CanDevice> device_list_{};  // <rx_stdid, device>
+  CanErrorCounters error_counters_{};                 // 只在中断里修改，TEC/REC在读的时候从寄存器里取
+  bool bit_rate_switch_{true};
+  u32 filter_count_{0};
 };
 
 }  // namespace rm::hal::stm32
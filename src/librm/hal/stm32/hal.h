@@ -28,7 +28,9 @@
 #ifndef LIBRM_HAL_STM32_HAL_H
 #define LIBRM_HAL_STM32_HAL_H
 
-#if defined(STM32F407xx) && __has_include("stm32f407xx.h") && __has_include("stm32f4xx_hal.h")
+#if defined(LIBRM_STM32_FAKE_HAL)
+#include "librm/hal/stm32/fake/stm32_hal_fake.h"
+#elif defined(STM32F407xx) && __has_include("stm32f407xx.h") && __has_include("stm32f4xx_hal.h")
 #include "stm32f407xx.h"
 #include "stm32f4xx_hal.h"
 #elif defined(STM32H723xx) && __has_include("stm32h723xx.h") && __has_include("stm32h7xx_hal.h")
@@ -0,0 +1,142 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  librm/hal/stm32/static_callback.h
+ * @brief 把HAL库的C风格回调分发到对象的成员函数上，不用std::function和哈希表
+ */
+
+#ifndef LIBRM_HAL_STM32_STATIC_CALLBACK_H
+#define LIBRM_HAL_STM32_STATIC_CALLBACK_H
+
+#include <array>
+#include <type_traits>
+#include <utility>
+
+#include "librm/core/typedefs.h"
+#include "librm/hal/stm32/critical_section.h"
+
+namespace rm::hal::stm32 {
+
+template <typename Signature, typename Tag, usize kMaxInstances>
+class StaticCallback;
+
+/**
+ * @brief  把HAL库的C风格回调分发到对象的成员函数上
+ * @note   背景：HAL库要求的回调是普通函数指针，没有this参数。以前的做法是把std::function存进以句柄为键的unordered_map里，
+ *         每次进中断都要算两次哈希、遍历桶，再经过std::function的间接调用。
+ *         这里为每个实例槽位生成一个独立的跳板函数Trampoline<I>，注册时把槽位I的跳板交给HAL库，
+ *         进中断时跳板直接从固定数组里读出对象指针和成员函数，只需要两次内存读取加一次间接调用，也不需要用句柄查表
+ * @note   注册要在打开中断之前完成，同一个对象重复注册会复用原来的槽位
+ * @note   对象析构前要调用Unregister()释放槽位；之后HAL库即使还拿着跳板函数，进中断时也什么都不做
+ * @note   用法：
+ *         @code
+ *         using RxCallback = StaticCallback<void(CAN_HandleTypeDef *), struct RxTag, 3>;
+ *         HAL_CAN_RegisterCallback(hcan, HAL_CAN_RX_FIFO0_MSG_PENDING_CB_ID, RxCallback::Register<&BxCan::OnRx>(this));
+ *         @endcode
+ * @tparam Handle         HAL库的句柄类型
+ * @tparam Args           回调除了句柄以外的参数；成员函数可以接收这些参数，也可以不带参数
+ * @tparam Tag            区分同一个签名的不同回调(比如接收回调和发送回调)，每个Tag有一张自己的表
+ * @tparam kMaxInstances  最多同时注册几个对象，一般就是这种外设的数量
+ */
+template <typename Handle, typename... Args, typename Tag, usize kMaxInstances>
+class StaticCallback<void(Handle *, Args...), Tag, kMaxInstances> {
+ public:
+  using CallbackPtr = void (*)(Handle *, Args...);
+
+  /**
+   * @brief  把对象的成员函数注册到一个空闲槽位上
+   * @tparam kMethod 成员函数指针
+   * @param  object  对象
+   * @return 交给HAL库的回调函数指针；槽位已经用完时返回nullptr
+   */
+  template <auto kMethod, typename T>
+  static CallbackPtr Register(T *object) {
+    constexpr Invoker invoke = &Invoke<T, kMethod>;
+    for (usize i = 0; i < kMaxInstances; ++i) {
+      if (entries_[i].object == object && entries_[i].invoke == invoke) {
+        return kTrampolines[i];
+      }
+    }
+    for (usize i = 0; i < kMaxInstances; ++i) {
+      if (entries_[i].object == nullptr) {
+        entries_[i].invoke = invoke;
+        entries_[i].object = object;
+        return kTrampolines[i];
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief 释放对象占用的所有槽位
+   * @param object 对象
+   */
+  static void Unregister(const void *object) {
+    // 中断里可能正在读槽位，改的时候关中断，保证跳板函数读到的对象指针和成员函数是一致的
+    CriticalSection critical_section;
+    for (auto &entry : entries_) {
+      if (entry.object == object) {
+        entry.object = nullptr;
+        entry.invoke = nullptr;
+      }
+    }
+  }
+
+ private:
+  using Invoker = void (*)(void *, Args...);
+
+  struct Entry {
+    void *object;
+    Invoker invoke;
+  };
+
+  template <typename T, auto kMethod>
+  static void Invoke(void *object, Args... args) {
+    if constexpr (std::is_invocable_v<decltype(kMethod), T *, Args...>) {
+      (static_cast<T *>(object)->*kMethod)(args...);
+    } else {
+      (static_cast<T *>(object)->*kMethod)();
+    }
+  }
+
+  template <usize I>
+  static void Trampoline(Handle *, Args... args) {
+    const Entry &entry = entries_[I];
+    if (entry.object != nullptr) {
+      entry.invoke(entry.object, args...);
+    }
+  }
+
+  template <usize... I>
+  static constexpr std::array<CallbackPtr, kMaxInstances> MakeTrampolines(std::index_sequence<I...>) {
+    return {&Trampoline<I>...};
+  }
+
+  inline static std::array<Entry, kMaxInstances> entries_{};
+  static constexpr std::array<CallbackPtr, kMaxInstances> kTrampolines =
+      MakeTrampolines(std::make_index_sequence<kMaxInstances>{});
+};
+
+}  // namespace rm::hal::stm32
+
+#endif  // LIBRM_HAL_STM32_STATIC_CALLBACK_H
@@ -32,55 +32,18 @@
 #include "uart.h"
 
 #include "librm/core/exception.h"
+#include "librm/hal/stm32/static_callback.h"
 
-/**
- * @brief 串口接收回调函数键值对
- * @note  用于存储串口接收回调函数
- * @note  key: 串口对象指针
- * @note  value: 回调函数
- * 解释：键是串口对象指针，值是回调函数，用于实现多个串口的回调函数
- */
-static std::unordered_map<UART_HandleTypeDef *, std::function<void(rm::u16)>> fn_cb_map;
-
-/**
- * @brief 串口错误回调函数键值对
- * @note  用于存储串口错误回调函数
- * @note  key: 串口对象指针
- * @note  value: 错误回调函数
- * 解释：键是串口对象指针，值是错误回调函数，用于实现多个串口的错误回调函数
- */
-static std::unordered_map<UART_HandleTypeDef *, std::function<void(void)>> fn_error_map;
+namespace {
+struct UartRxEventTag;
+struct UartErrorTag;
 
 /**
- * @brief  把std::function转换为函数指针
- * @param  fn   要转换的函数
- * @return      转换后的函数指针
- * @note
- * 背景：因为要用面向对象的方式对外
- * 设进行封装，所以回调函数必须存在于类内。但是存在于类内就意味着这个回调函数多了一个this参数，
- * 而HAL库要求的回调函数并没有这个this参数。通过std::bind，可以生成一个参数列表里没有this指针的std::function对象，而std::function
- * 并不能直接强转成函数指针。借助这个函数，可以把std::function对象转换成函数指针。然后就可以把这个类内的回调函数传给HAL库了。
+ * @brief 串口接收事件回调和错误回调的分发表，最多支持10个串口
  */
-
-static auto StdFunctionToCallbackFunctionPtr(std::function<void(rm::u16)> fn,
-                                             UART_HandleTypeDef *huart) -> pUART_RxEventCallbackTypeDef {
-  fn_cb_map[huart] = std::move(fn);
-  return [](UART_HandleTypeDef *handle, rm::u16 rx_len) {
-    if (fn_cb_map.find(handle) != fn_cb_map.end()) {
-      fn_cb_map[handle](rx_len);
-    }
-  };
-}
-
-static auto StdFunctionToErrorCallbackFunctionPtr(std::function<void(void)> fn,
-                                                  UART_HandleTypeDef *huart) -> pUART_CallbackTypeDef {
-  fn_error_map[huart] = std::move(fn);
-  return [](UART_HandleTypeDef *handle) {
-    if (fn_error_map.find(handle) != fn_error_map.end()) {
-      fn_error_map[handle]();
-    }
-  };
-}
+using UartRxEventCallback = rm::hal::stm32::StaticCallback<void(UART_HandleTypeDef *, rm::u16), UartRxEventTag, 10>;
+using UartErrorCallback = rm::hal::stm32::StaticCallback<void(UART_HandleTypeDef *), UartErrorTag, 10>;
+}  // namespace
 
 namespace rm::hal::stm32 {
 
@@ -96,6 +59,14 @@ Uart::Uart(UART_HandleTypeDef &huart, usize rx_buffer_size, UartMode tx_mode, Ua
       rx_mode_(rx_mode),
       rx_buf_{std::vector<u8>(rx_buffer_size), std::vector<u8>(rx_buffer_size)} {}
 
+/**
+ * @brief 释放回调槽位，之后这个串口的中断不会再调用到已经析构的对象上
+ */
+Uart::~Uart() {
+  UartRxEventCallback::Unregister(this);
+  UartErrorCallback::Unregister(this);
+}
+
 /**
  * @brief 初始化UART
  */
@@ -107,15 +78,14 @@ void Uart::Begin() {
   if (this->rx_mode_ == UartMode::kDma && this->huart_->hdmarx == nullptr) {
     Throw(std::runtime_error("DMA mode is selected but DMA is not configured"));
   }
-  // 注册接收完成回调函数
-  HAL_UART_RegisterRxEventCallback(
-      this->huart_,
-      StdFunctionToCallbackFunctionPtr(std::bind(&Uart::HalRxCpltCallback, this, std::placeholders::_1), this->huart_));
-
-  // 注册错误回调函数
-  HAL_UART_RegisterCallback(
-      this->huart_, HAL_UART_ERROR_CB_ID,
-      StdFunctionToErrorCallbackFunctionPtr(std::bind(&Uart::HalErrorCallback, this), this->huart_));
+  // 注册接收完成回调函数和错误回调函数
+  auto rx_event_callback = UartRxEventCallback::Register<&Uart::HalRxCpltCallback>(this);
+  auto error_callback = UartErrorCallback::Register<&Uart::HalErrorCallback>(this);
+  if (rx_event_callback == nullptr || error_callback == nullptr) {
+    Throw(std::runtime_error("Too many UART instances"));
+  }
+  HAL_UART_RegisterRxEventCallback(this->huart_, rx_event_callback);
+  HAL_UART_RegisterCallback(this->huart_, HAL_UART_ERROR_CB_ID, error_callback);
 
   // 启动接收
   switch (this->rx_mode_) {
@@ -167,43 +137,88 @@ void Uart::AttachRxCallback(SerialRxCallbackFunction &callback) { this->rx_callb
  */
 const std::vector<u8> &Uart::rx_buffer() const { return rx_buf_[buffer_selector_]; }
 
+/**
+ * @brief 开启延迟接收：接收中断里只把收到的数据拷贝进无锁队列，由任务或者主循环调用ProcessRx()再调用接收回调
+ * @param queue_size 队列能缓存多少字节，会被向上取整到2的幂；剩余空间放不下一次收到的数据时，这一段数据会被丢弃并计入rx_overflow_count()
+ * @note  要在Begin()之前调用
+ */
+void Uart::SetDeferredRx(usize queue_size) {
+  this->deferred_rx_.Enable(queue_size);
+  this->deferred_rx_length_.Enable(queue_size / 8 + 1);
+  this->deferred_rx_buf_.resize(this->rx_buf_[0].size());
+}
+
+/**
+ * @brief 设置延迟接收模式下，接收中断往队列里放了数据之后调用的通知函数，一般用来唤醒调用ProcessRx()的任务
+ * @param notify 通知函数，在中断里调用
+ * @param arg    传给通知函数的参数
+ */
+void Uart::SetRxNotify(DeferredRx<u8>::NotifyFunction notify, void *arg) {
+  this->deferred_rx_length_.SetNotify(notify, arg);
+}
+
+/**
+ * @brief  延迟接收模式下，把队列里的数据按接收时的分段依次交给接收回调，在任务或者主循环里调用
+ * @return 处理了多少段数据
+ */
+usize Uart::ProcessRx() {
+  if (!this->deferred_rx_.enabled()) {
+    return 0;
+  }
+  u16 rx_len;
+  usize count = 0;
+  while (this->deferred_rx_length_.Pop(rx_len)) {
+    this->deferred_rx_.PopBulk(this->deferred_rx_buf_.data(), rx_len);
+    for (auto callback : this->rx_callbacks_) {
+      if (callback != nullptr) {
+        (*callback)(this->deferred_rx_buf_, rx_len);
+      }
+    }
+    ++count;
+  }
+  return count;
+}
+
+/**
+ * @return 延迟接收模式下，因为队列满而丢弃的数据段数
+ */
+u32 Uart::rx_overflow_count() const {
+  return this->deferred_rx_.overflow_count() + this->deferred_rx_length_.overflow_count();
+}
+
 /**
  * @brief 接收完成回调函数
  * @note  这个回调函数是给HAL库用的，要实现自己的功能就在外部定义一个UartCallbackFunction
  * 类型的回调函数，然后通过AttachRxCallback注册
  */
 void Uart::HalRxCpltCallback(u16 rx_len) {
-  // 判断rx模式，重新启动接收
-  switch (this->rx_mode_) {
-    case UartMode::kNormal:
-      HAL_UART_Receive(this->huart_, this->rx_buf_[!this->buffer_selector_].data(),
-                       this->rx_buf_[!this->buffer_selector_].size(), HAL_MAX_DELAY);
-      break;
-    case UartMode::kInterrupt:
-      HAL_UART_Receive_IT(this->huart_, this->rx_buf_[!this->buffer_selector_].data(),
-                          this->rx_buf_[!this->buffer_selector_].size());
-      break;
-#if defined(HAL_DMA_MODULE_ENABLED)
-    case UartMode::kDma:
-      HAL_UARTEx_ReceiveToIdle_DMA(this->huart_, this->rx_buf_[!this->buffer_selector_].data(),
-                                   this->rx_buf_[!this->buffer_selector_].size());
-      __HAL_DMA_DISABLE_IT(this->huart_->hdmarx, DMA_IT_HT);  // 关闭DMA半传输中断
-      break;
-#endif
-  }
-  // 调用外部重写的回调函数
-  for (auto callback : this->rx_callbacks_) {
-    if (callback != nullptr) {
-      (*callback)(this->rx_buf_[this->buffer_selector_], rx_len);
+  this->RestartRx();
+  if (this->deferred_rx_.enabled()) {
+    // 先放数据再放长度，ProcessRx()取到长度时数据一定已经在队列里了
+    const u8 *data = this->rx_buf_[this->buffer_selector_].data();
+    if (this->deferred_rx_length_.full()) {
+      this->deferred_rx_length_.Push(rx_len);  // 一定会失败，只用来计入溢出次数
+    } else if (this->deferred_rx_.PushBulk(data, rx_len)) {
+      this->deferred_rx_length_.Push(rx_len);
+    }
+  } else {
+    // 调用外部重写的回调函数
+    for (auto callback : this->rx_callbacks_) {
+      if (callback != nullptr) {
+        (*callback)(this->rx_buf_[this->buffer_selector_], rx_len);
+      }
     }
   }
   // 切换缓冲区
   this->buffer_selector_ = !this->buffer_selector_;
 }
 
-void Uart::HalErrorCallback() {
-  // 重启接收
-  u16 rx_len = this->rx_buf_[this->buffer_selector_].size();
+void Uart::HalErrorCallback() { this->RestartRx(); }
+
+/**
+ * @brief 判断rx模式，在另一个缓冲区上重新启动接收
+ */
+void Uart::RestartRx() {
   switch (this->rx_mode_) {
     case UartMode::kNormal:
       HAL_UART_Receive(this->huart_, this->rx_buf_[!this->buffer_selector_].data(),
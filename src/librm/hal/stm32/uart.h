@@ -32,6 +32,7 @@
 #if defined(HAL_UART_MODULE_ENABLED)
 
 #include "librm/hal/serial_interface.h"
+#include "librm/hal/stm32/deferred_rx.h"
 #include "librm/core/typedefs.h"
 
 #include <unordered_map>
@@ -48,20 +49,29 @@ enum class UartMode {
 
 /**
  * @brief UART类
+ * @note  默认在接收中断里直接调用接收回调；调用SetDeferredRx()之后中断里只把收到的数据拷贝进无锁队列，
+ *        由任务或者主循环调用ProcessRx()再调用接收回调，适合裁判系统解析这种比较重的处理
  */
 class Uart : public SerialInterface {
  public:
   Uart(UART_HandleTypeDef &huart, usize rx_buffer_size, UartMode tx_mode = UartMode::kNormal,
        UartMode rx_mode = UartMode::kNormal);
+  ~Uart() override;
 
   void Begin() override;
   void Write(const u8 *data, usize size) override;
   void AttachRxCallback(SerialRxCallbackFunction &callback) override;
   [[nodiscard]] const std::vector<u8> &rx_buffer() const override;
 
+  void SetDeferredRx(usize queue_size);
+  void SetRxNotify(DeferredRx<u8>::NotifyFunction notify, void *arg);
+  usize ProcessRx();
+  [[nodiscard]] u32 rx_overflow_count() const;
+
  private:
   void HalRxCpltCallback(u16 rx_len);
   void HalErrorCallback();
+  void RestartRx();
 
   std::vector<SerialRxCallbackFunction *> rx_callbacks_;
   UART_HandleTypeDef *huart_;
@@ -69,6 +79,9 @@ class Uart : public SerialInterface {
   UartMode rx_mode_;
   std::vector<u8> rx_buf_[2];
   bool buffer_selector_{false};
+  DeferredRx<u8> deferred_rx_{};         // 延迟接收模式下收到的数据
+  DeferredRx<u16> deferred_rx_length_{};  // 每一段数据的长度，和deferred_rx_配合保留每次接收的边界
+  std::vector<u8> deferred_rx_buf_{};     // ProcessRx()把一段数据取出来放在这里交给接收回调
 };
 
 }  // namespace rm::hal::stm32
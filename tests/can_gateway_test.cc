@@ -0,0 +1,129 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  tests/can_gateway_test.cc
+ * @brief CanGateway在同一个进程里转发本机设备报文的测试，用确定性步进的VirtualCanBus
+ */
+
+#include <cstdio>
+
+#include "librm/device/can_device.hpp"
+#include "librm/hal/can_gateway.hpp"
+#include "librm/hal/linux/virtual_can.h"
+
+namespace {
+
+using rm::hal::CanGateway;
+using rm::hal::CanGatewayDirection;
+using rm::hal::CanMonitor;
+using rm::hal::CanMsg;
+using rm::hal::linux_::VirtualCan;
+using rm::hal::linux_::VirtualCanBus;
+
+/**
+ * @brief 挂在主总线上的设备，模拟原来直接接在主总线上、现在被挪到辅助总线上的超级电容
+ */
+class FakeSupercap final : public rm::device::CanDevice {
+ public:
+  explicit FakeSupercap(rm::hal::CanInterface &can) : CanDevice(can, 0x30) {}
+  void RxCallback(const CanMsg *msg) override { ++this->feedback_count; }
+  void SendControl() {
+    const rm::u8 data[8]{};
+    this->can_->Write(0x2e, data, sizeof(data));
+  }
+  int feedback_count{0};
+};
+
+/**
+ * @brief 按ID数一条总线上收到了多少帧
+ */
+class CountingMonitor final : public CanMonitor {
+ public:
+  explicit CountingMonitor(rm::u16 id) : id_(id) {}
+  void OnRx(const CanMsg &msg, bool) override { this->count += msg.rx_std_id == this->id_ ? 1 : 0; }
+  int count{0};
+
+ private:
+  rm::u16 id_;
+};
+
+#define EXPECT_EQ(actual, expected)                                                                \
+  do {                                                                                             \
+    if ((actual) != (expected)) {                                                                  \
+      std::printf("%s:%d: %s == %d, expected %d\n", __FILE__, __LINE__, #actual, (int)(actual), \
+                  (int)(expected));                                                                \
+      return false;                                                                                \
+    }                                                                                              \
+  } while (0)
+
+/**
+ * @brief 本机设备在主总线上发的控制帧转发到辅助总线，辅助总线上的反馈转发回来之后本机设备能收到，而且不会来回转发
+ */
+bool TestForwardLocalDevices() {
+  VirtualCanBus main_bus, aux_bus;
+  VirtualCan can_main{main_bus}, main_peer{main_bus};
+  VirtualCan can_aux{aux_bus}, supercap_side{aux_bus};
+  FakeSupercap supercap{can_main};
+  CountingMonitor control_on_aux{0x2e}, feedback_on_main{0x30};
+  supercap_side.AttachMonitor(control_on_aux);
+  main_peer.AttachMonitor(feedback_on_main);
+
+  CanGateway gateway{can_main, can_aux};
+  const rm::usize to_aux = gateway.AddRoute(CanGatewayDirection::kAToB, 0x2e, 0x7fe);
+  const rm::usize to_main = gateway.AddRoute(CanGatewayDirection::kBToA, 0x30, 0x7ff);
+  gateway.Begin();
+  for (VirtualCan *can : {&can_main, &main_peer, &can_aux, &supercap_side}) {
+    can->Begin();
+  }
+
+  supercap.SendControl();
+  main_bus.RunUntilIdle();
+  aux_bus.RunUntilIdle();
+  EXPECT_EQ(control_on_aux.count, 1);
+
+  const rm::u8 feedback[8]{};
+  supercap_side.Write(0x30, feedback, sizeof(feedback));
+  aux_bus.RunUntilIdle();
+  main_bus.RunUntilIdle();
+  EXPECT_EQ(supercap.feedback_count, 1);
+  EXPECT_EQ(feedback_on_main.count, 1);
+
+  // 再跑一遍两条总线，转发进来的报文不能被再转发回去
+  EXPECT_EQ(aux_bus.RunUntilIdle() + main_bus.RunUntilIdle(), 0);
+  EXPECT_EQ(gateway.forwarded_count(to_aux), 1);
+  EXPECT_EQ(gateway.forwarded_count(to_main), 1);
+  EXPECT_EQ(control_on_aux.count, 1);
+
+  gateway.Stop();
+  supercap_side.DetachMonitor(control_on_aux);
+  main_peer.DetachMonitor(feedback_on_main);
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  const bool ok = TestForwardLocalDevices();
+  std::printf("[%s] ForwardLocalDevices\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
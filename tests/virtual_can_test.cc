@@ -0,0 +1,141 @@
+/*
+  Copyright (c) 2024 XDU-IRobot
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+/**
+ * @file  tests/virtual_can_test.cc
+ * @brief VirtualCanBus实时模式的测试
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "librm/hal/linux/virtual_can.h"
+
+namespace {
+
+using rm::hal::CanMonitor;
+using rm::hal::CanMsg;
+using rm::hal::CanTxPriority;
+using rm::hal::linux_::VirtualCan;
+using rm::hal::linux_::VirtualCanBus;
+
+/**
+ * @brief 数接收端收到了多少帧
+ */
+class CountingMonitor final : public CanMonitor {
+ public:
+  void OnRx(const CanMsg &, bool) override { this->count.fetch_add(1, std::memory_order_relaxed); }
+  std::atomic<int> count{0};
+};
+
+/**
+ * @brief 等到count达到expected，超时返回false
+ */
+bool WaitFor(const std::atomic<int> &count, int expected, std::chrono::milliseconds timeout) {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (count.load(std::memory_order_relaxed) < expected) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief 实时模式下，总线空闲时用Enqueue()放进发送队列的报文要能被后台线程发出去，
+ *        不能因为通知在后台线程开始等待之前到达就一直留在队列里
+ */
+bool TestRealTimeEnqueueWakeup() {
+  VirtualCanBus bus;
+  VirtualCan sender{bus}, receiver{bus};
+  CountingMonitor monitor;
+  receiver.AttachMonitor(monitor);
+  sender.Begin();
+  receiver.Begin();
+  bus.Begin();
+
+  constexpr int kFrames = 5000;
+  const rm::u8 data[8]{};
+  bool ok = true;
+  for (int i = 0; i < kFrames; ++i) {
+    // 上一帧投递完之后后台线程马上就要进入等待，错开不同的时间再Enqueue，让通知落在它检查和等待之间
+    const auto resume = std::chrono::steady_clock::now() + std::chrono::nanoseconds((i * 37) % 2000);
+    while (std::chrono::steady_clock::now() < resume) {
+    }
+    sender.Enqueue(0x200 + (i & 0xf), data, sizeof(data), CanTxPriority::kNormal);
+    if (!WaitFor(monitor.count, i + 1, std::chrono::milliseconds(500))) {
+      std::printf("frame %d was never delivered (received %d)\n", i, monitor.count.load());
+      ok = false;
+      break;
+    }
+  }
+  bus.Stop();
+  receiver.DetachMonitor(monitor);
+  return ok;
+}
+
+/**
+ * @brief 实时模式下Write()直接提交的报文同样要按时投递
+ */
+bool TestRealTimeWrite() {
+  VirtualCanBus bus;
+  VirtualCan sender{bus}, receiver{bus};
+  CountingMonitor monitor;
+  receiver.AttachMonitor(monitor);
+  sender.Begin();
+  receiver.Begin();
+  bus.Begin();
+
+  constexpr int kFrames = 500;
+  const rm::u8 data[8]{};
+  for (int i = 0; i < kFrames; ++i) {
+    sender.Write(0x100, data, sizeof(data));
+  }
+  const bool ok = WaitFor(monitor.count, kFrames, std::chrono::seconds(2));
+  if (!ok) {
+    std::printf("received %d of %d frames\n", monitor.count.load(), kFrames);
+  }
+  bus.Stop();
+  receiver.DetachMonitor(monitor);
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  int failures = 0;
+  const struct {
+    const char *name;
+    bool (*run)();
+  } tests[] = {
+      {"RealTimeEnqueueWakeup", &TestRealTimeEnqueueWakeup},
+      {"RealTimeWrite", &TestRealTimeWrite},
+  };
+  for (const auto &test : tests) {
+    const bool ok = test.run();
+    std::printf("[%s] %s\n", ok ? "PASS" : "FAIL", test.name);
+    failures += ok ? 0 : 1;
+  }
+  return failures == 0 ? 0 : 1;
+}